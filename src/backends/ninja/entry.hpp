@@ -13,7 +13,7 @@
 namespace Backends::Ninja {
 
 /**
- * Generates a ninja file in the build directory
+ * Generates a ninja file, and a compile_commands.json, in the build directory
  */
 void generate(const MIR::BasicBlock * const, const MIR::State::Persistant &);
 
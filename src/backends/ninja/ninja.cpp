@@ -6,16 +6,27 @@
  */
 
 #include <algorithm>
+#include <cctype>
+#include <charconv>
 #include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
 #include <filesystem>
-#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <string_view>
 #include <variant>
 #include <vector>
 
 #include "entry.hpp"
 #include "exceptions.hpp"
+#include "threads.hpp"
 #include "toolchains/compiler.hpp"
+#include "writer.hpp"
 
 namespace fs = std::filesystem;
 
@@ -23,90 +34,192 @@ namespace Backends::Ninja {
 
 namespace {
 
+/// Targets to find rules for on each thread, at least
+constexpr std::size_t TARGET_GRAIN = 8;
+
+/// Build edges, or other entries, to write into each buffer
+constexpr std::size_t EDGE_GRAIN = 1024;
+
+/**
+ * The longest command line to use without a response file
+ *
+ * This is half of what the system allows, to leave room for the environment.
+ * Like Meson, it can be overridden with MESON_RSP_THRESHOLD.
+ */
+std::size_t rsp_threshold() {
+    if (const char * env = std::getenv("MESON_RSP_THRESHOLD"); env != nullptr) {
+        const std::string_view value{env};
+        std::size_t threshold;
+        const auto [end, ec] =
+            std::from_chars(value.data(), value.data() + value.size(), threshold);
+        if (value.empty() || ec != std::errc{} || end != value.data() + value.size()) {
+            throw Util::Exceptions::InvalidArguments{
+                "MESON_RSP_THRESHOLD must be a non-negative integer"};
+        }
+        return threshold;
+    }
+    const long max = sysconf(_SC_ARG_MAX);
+    return max > 0 ? max / 2 : 32768;
+}
+
+/// Memory to allow for each link, when finding the depth of the link pool
+constexpr uint64_t LINK_MEMORY = 4ull * 1024 * 1024 * 1024;
+
+/// Memory to allow for each compile in the heavy compile pool
+constexpr uint64_t HEAVY_COMPILE_MEMORY = 2ull * 1024 * 1024 * 1024;
+
+/**
+ * The depth of a pool, from an option or from the resources of this machine
+ *
+ * By default there is a job for each core, as long as each job can have
+ * `memory` bytes, so that running them all at once doesn't swap. An option of
+ * 0 means the jobs aren't limited at all.
+ */
+unsigned pool_depth(const MIR::State::Persistant & pstate, const std::string & option,
+                    const uint64_t & memory) {
+    if (const auto found = pstate.options.find(option); found != pstate.options.end()) {
+        const auto & value = found->second;
+        if (value.empty() || value.size() > 9 ||
+            value.find_first_not_of("0123456789") != std::string::npos) {
+            throw Util::Exceptions::InvalidArguments{option +
+                                                     " must be a non-negative integer"};
+        }
+        return std::stoul(value);
+    }
+
+    const uint64_t jobs = Util::default_jobs();
+    const auto mem = Util::physical_memory();
+    if (mem == 0) {
+        return jobs;
+    }
+    return std::max<uint64_t>(1, std::min(jobs, mem / memory));
+}
+
+/**
+ * Settings that apply to every target
+ */
+class Config {
+  public:
+    Config(const MIR::State::Persistant & pstate)
+        : rsp_threshold{Ninja::rsp_threshold()},
+          link_depth{pool_depth(pstate, "backend_max_links", LINK_MEMORY)},
+          heavy_compile_depth{
+              pool_depth(pstate, "backend_max_heavy_compiles", HEAVY_COMPILE_MEMORY)} {};
+
+    /// The longest command line to use without a response file
+    const std::size_t rsp_threshold;
+
+    /// How many links can run at once, or 0 for no limit
+    const unsigned link_depth;
+
+    /// How many compiles of targets in the heavy_compile pool can run at once,
+    /// or 0 for no limit
+    const unsigned heavy_compile_depth;
+
+    /// The ninja pool for every link, or empty for the default
+    std::string link_pool() const { return link_depth > 0 ? "link_pool" : ""; }
+
+    /// The ninja pool to compile a target's sources in, from its `pool` keyword
+    std::string compile_pool(const std::string & requested) const {
+        if (requested == "heavy_compile" && heavy_compile_depth > 0) {
+            return "heavy_compile_pool";
+        }
+        return "";
+    }
+};
+
 void write_compiler_rule(const std::string & lang,
                          const std::unique_ptr<MIR::Toolchain::Compiler::Compiler> & c,
-                         std::ofstream & out) {
+                         Buffer & out) {
 
     // TODO: build or host correctly
     out << "rule " << lang << "_compiler_for_"
-        << "build" << std::endl;
+        << "build\n";
 
     // Write the command
-    // TODO: write the depfile stuff
     out << "  command =";
     for (const auto & c : c->command) {
         out << " " << c;
     }
     out << " ${ARGS}";
+    const auto depfile = c->depfile_command("${out}.d");
+    for (const auto & c : depfile) {
+        out << " " << c;
+    }
     for (const auto & c : c->output_command("${out}")) {
         out << " " << c;
     }
     for (const auto & c : c->compile_only_command()) {
         out << " " << c;
     }
-    out << " ${in}" << std::endl;
+    out << " ${in}\n";
+
+    // Let ninja track the headers each object uses, it reads the depfile into
+    // .ninja_deps and then deletes it
+    if (!depfile.empty()) {
+        out << "  deps = gcc\n"
+            << "  depfile = ${out}.d\n";
+    }
 
     // Write the description
-    out << "  description = Compiling " << c->language() << " object ${out}" << std::endl
-        << std::endl;
+    out << "  description = Compiling " << c->language() << " object ${out}\n\n";
+}
+
+/**
+ * Write the end of a command, which are the arguments that may be too long
+ *
+ * With a response file they are written to the file instead, and GCC and
+ * MSVC style tools both read it with `@file`.
+ */
+void write_arguments(const std::string & args, const bool & rsp, Buffer & out) {
+    if (rsp) {
+        out << " @${out}.rsp\n"
+            << "  rspfile = ${out}.rsp\n"
+            << "  rspfile_content = " << args << "\n";
+    } else {
+        out << " " << args << "\n";
+    }
 }
 
 void write_archiver_rule(const std::string & lang,
                          const std::unique_ptr<MIR::Toolchain::Archiver::Archiver> & c,
-                         std::ofstream & out) {
+                         const bool & rsp, Buffer & out) {
 
     // TODO: build or host correctly
-    out << "rule " << lang << "_archiver_for_"
-        << "build" << std::endl;
+    out << "rule " << lang << "_archiver_for_build" << (rsp ? "_RSP" : "") << "\n";
 
     // Write the command
-    // TODO: write the depfile stuff
     out << "  command =";
     out << "rm -f ${out} &&";
     for (const auto & c : c->command()) {
         out << " " << c;
     }
-    out << " ${ARGS} ${out} ${in}\n";
+    write_arguments("${ARGS} ${out} ${in}", rsp, out);
 
     // Write the description
-    out << "  description = Linking Static target ${out}\n" << std::endl;
+    out << "  description = Linking Static target ${out}\n\n";
 }
 
 void write_linker_rule(const std::string & lang,
-                       const std::unique_ptr<MIR::Toolchain::Linker::Linker> & c,
-                       std::ofstream & out) {
+                       const std::unique_ptr<MIR::Toolchain::Linker::Linker> & c, const bool & rsp,
+                       Buffer & out) {
 
     // TODO: build or host correctly
-    out << "rule " << lang << "_linker_for_"
-        << "build" << std::endl;
+    out << "rule " << lang << "_linker_for_build" << (rsp ? "_RSP" : "") << "\n";
 
     // Write the command
-    // TODO: write the depfile stuff
     out << "  command =";
     for (const auto & c : c->command()) {
         out << " " << c;
     }
-    out << " ${ARGS}";
+    std::string args = "${ARGS}";
     for (const auto & c : c->output_command("${out}")) {
-        out << " " << c;
+        args += " " + c;
     }
-    out << " ${in} ${ARGS}" << std::endl;
+    write_arguments(args + " ${in} ${ARGS}", rsp, out);
 
     // Write the description
-    out << "  description = Linking target ${out}" << std::endl << std::endl;
-}
-
-std::string escape(const std::string & str) {
-    std::string new_s{};
-    for (const auto & s : str) {
-        if (s == ' ') {
-            new_s.push_back('$');
-            new_s.push_back(s);
-        } else {
-            new_s.push_back(s);
-        }
-    }
-    return new_s;
+    out << "  description = Linking target ${out}\n\n";
 }
 
 enum class RuleType {
@@ -122,11 +235,16 @@ class Rule {
   public:
     Rule(const std::vector<std::string> & in, const std::string & out, const RuleType & r,
          const MIR::Toolchain::Language & l, const MIR::Machines::Machine & m)
-        : input{in}, output{out}, type{r}, lang{l}, machine{m}, arguments{} {};
+        : input{in}, output{out}, type{r}, lang{l}, machine{m},
+          arguments{std::make_shared<const std::vector<std::string>>()}, rsp{false}, pool{},
+          subdir{}, variable{} {};
     Rule(const std::vector<std::string> & in, const std::string & out, const RuleType & r,
          const MIR::Toolchain::Language & l, const MIR::Machines::Machine & m,
-         const std::vector<std::string> & args)
-        : input{in}, output{out}, type{r}, lang{l}, machine{m}, arguments{args} {};
+         const std::shared_ptr<const std::vector<std::string>> & args, const bool & rsp_ = false,
+         const std::string & pool_ = "", const std::string & subdir_ = "",
+         const std::string & var = "")
+        : input{in}, output{out}, type{r}, lang{l}, machine{m}, arguments{args}, rsp{rsp_},
+          pool{pool_}, subdir{subdir_}, variable{var} {};
 
     /// The input for this rule
     const std::vector<std::string> input;
@@ -143,11 +261,62 @@ class Rule {
     /// The machine of this rule
     const MIR::Machines::Machine machine;
 
-    /// The arguments for this rule
-    const std::vector<std::string> arguments;
+    /// The arguments for this rule, which may be shared with the target's other rules
+    const std::shared_ptr<const std::vector<std::string>> arguments;
+
+    /// Whether to pass the inputs and arguments in a response file
+    const bool rsp;
+
+    /// The ninja pool to run in, or empty for the default pool
+    const std::string pool;
+
+    /// The subdir of the target this rule is for, relative to the source root
+    const std::string subdir;
+
+    /**
+     * A variable that holds the arguments, or empty to write them on the edge
+     *
+     * The arguments are written into the variable once, before the first edge
+     * that uses it, instead of on every edge.
+     */
+    const std::string variable;
 };
 
-void write_build_rule(const Rule & rule, std::ofstream & out) {
+/**
+ * A name for the variable holding a target's arguments
+ *
+ * Characters that can't be in a variable are replaced, so different names
+ * can turn into the same one, such as foo-bar and foo.bar. The target's index
+ * keeps the variables apart.
+ *
+ * @param index The target's position in the list of all targets
+ */
+std::string arguments_variable(const std::string & target, const std::size_t & index) {
+    std::string var = target;
+    for (auto & c : var) {
+        if (!std::isalnum(static_cast<unsigned char>(c))) {
+            c = '_';
+        }
+    }
+    return var + "_" + std::to_string(index) + "_ARGS";
+}
+
+/**
+ * Write the edge for a rule
+ *
+ * @param define Whether to define the rule's argument variable first
+ */
+void write_build_rule(const Rule & rule, const bool & define, Buffer & out) {
+    // Variables are expanded as the edges are read, so a later target using
+    // the same name doesn't change the arguments of this one
+    if (define && !rule.variable.empty()) {
+        out << rule.variable << " =";
+        for (const auto & a : *rule.arguments) {
+            out << " " << a;
+        }
+        out << "\n\n";
+    }
+
     // TODO: get the actual compiler/linker
     std::string rule_name;
     switch (rule.type) {
@@ -164,21 +333,31 @@ void write_build_rule(const Rule & rule, std::ofstream & out) {
             throw std::exception{}; // should be unreachable
     }
 
-    out << "build " << rule.output << ": " << rule_name;
+    out << "build " << Escaped{rule.output} << ": " << rule_name << (rule.rsp ? "_RSP" : "");
     for (const auto & o : rule.input) {
-        out << " " << o;
+        out << " " << Escaped{o};
     }
     out << "\n";
 
     out << "  ARGS =";
-    for (const auto & a : rule.arguments) {
-        out << " " << a;
+    if (!rule.variable.empty()) {
+        out << " ${" << rule.variable << "}";
+    } else {
+        for (const auto & a : *rule.arguments) {
+            out << " " << a;
+        }
     }
-    out << "\n" << std::endl;
+    out << "\n";
+
+    if (!rule.pool.empty()) {
+        out << "  pool = " << rule.pool << "\n";
+    }
+    out << "\n";
 }
 
 template <typename T>
-std::vector<Rule> target_rule(const T & e, const MIR::State::Persistant & pstate) {
+std::vector<Rule> target_rule(const T & e, const std::size_t & index,
+                              const MIR::State::Persistant & pstate, const Config & config) {
     static_assert(std::is_base_of<MIR::Objects::Executable, T>::value ||
                       std::is_base_of<MIR::Objects::StaticLibrary, T>::value,
                   "Must be derived from a build target");
@@ -187,30 +366,35 @@ std::vector<Rule> target_rule(const T & e, const MIR::State::Persistant & pstate
     if (e.arguments.find(MIR::Toolchain::Language::CPP) != e.arguments.end()) {
         const auto & tc = pstate.toolchains.at(MIR::Toolchain::Language::CPP);
         for (const auto & a : e.arguments.at(MIR::Toolchain::Language::CPP)) {
-            cpp_args.emplace_back(tc.build()->compiler->specialize_argument(a));
+            cpp_args.emplace_back(tc.build()->compiler()->specialize_argument(a));
         }
     }
 
     std::vector<Rule> rules{};
     const auto & tc = pstate.toolchains.at(MIR::Toolchain::Language::CPP);
 
-    std::vector<std::string> srcs{};
+    // Every source of the target is compiled with the same arguments, so they
+    // are only found once, and shared by each rule
+    const auto always_args = tc.build()->compiler()->always_args();
+    cpp_args.insert(cpp_args.end(), always_args.begin(), always_args.end());
+    const auto lang_args = std::make_shared<const std::vector<std::string>>(std::move(cpp_args));
+    const auto variable = arguments_variable(e.name, index);
+
     for (const auto & f : e.sources) {
         // TODO: obj files are a per compiler thing, I think
         // TODO: get the proper language
-        // TODO: actually set args to something
         // TODO: do something better for private dirs, we really need the subdir for this
 
-        auto lang_args = cpp_args;
-        auto always_args = tc.build()->compiler->always_args();
-        lang_args.insert(lang_args.end(), always_args.begin(), always_args.end());
-
-        rules.emplace_back(Rule{{escape(f.relative_to_build_dir())},
-                                escape(fs::path{e.name + ".p"} / f.get_name()) + ".o",
+        rules.emplace_back(Rule{{f.relative_to_build_dir()},
+                                (fs::path{e.name + ".p"} / f.get_name()).string() + ".o",
                                 RuleType::COMPILE,
                                 MIR::Toolchain::Language::CPP,
                                 MIR::Machines::Machine::BUILD,
-                                lang_args});
+                                lang_args,
+                                false,
+                                config.compile_pool(e.pool),
+                                e.subdir,
+                                variable});
     }
 
     std::vector<std::string> final_outs;
@@ -221,56 +405,265 @@ std::vector<Rule> target_rule(const T & e, const MIR::State::Persistant & pstate
     std::string name;
     RuleType type;
     std::vector<std::string> link_args{};
+    // The rest of the command the rule writes, apart from the inputs and arguments
+    std::vector<std::string> tool{};
+    MIR::Toolchain::RSPFileSupport rsp_support;
     if constexpr (std::is_base_of<MIR::Objects::StaticLibrary, T>::value) {
         type = RuleType::ARCHIVE;
         // TODO: per platform?
         name = e.name + ".a";
+        const auto & archiver = tc.build()->archiver();
         // TODO: need to combin with link_arguments from DSL
-        link_args = tc.build()->archiver->always_args();
+        link_args = archiver->always_args();
+        rsp_support = archiver->rsp_support();
+        tool = {"rm", "-f", name, "&&"};
+        const auto command = archiver->command();
+        tool.insert(tool.end(), command.begin(), command.end());
+        tool.emplace_back(name);
     } else {
         type = RuleType::LINK;
         name = e.name;
-        link_args = tc.build()->linker->always_args();
+        const auto & linker = tc.build()->linker();
+        link_args = linker->always_args();
+        rsp_support = linker->rsp_support();
+        for (const auto & part : {linker->command(), linker->output_command(name), link_args}) {
+            tool.insert(tool.end(), part.begin(), part.end());
+        }
     }
 
     // TODO: linker/archiver always_args
 
+    // Only use a response file when the command would be too long, as they
+    // make the commands harder to read. The link rule passes the arguments
+    // both before and after the inputs, so the tool includes them once more.
+    std::size_t length = 0;
+    for (const auto & words : {tool, final_outs, link_args}) {
+        for (const auto & w : words) {
+            length += w.size() + 1;
+        }
+    }
+    const bool rsp =
+        rsp_support != MIR::Toolchain::RSPFileSupport::NONE && length > config.rsp_threshold;
+
     rules.emplace_back(Rule{
         final_outs,
         name,
         type,
         MIR::Toolchain::Language::CPP,
         MIR::Machines::Machine::BUILD,
-        link_args,
+        std::make_shared<const std::vector<std::string>>(std::move(link_args)),
+        rsp,
+        // Linking large targets uses a lot of memory, so they are always limited
+        type == RuleType::LINK ? config.link_pool() : "",
+        e.subdir,
     });
 
     return rules;
 }
 
 std::vector<Rule> mir_to_rules(const MIR::BasicBlock * const block,
-                               const MIR::State::Persistant & pstate) {
+                               const MIR::State::Persistant & pstate, const Config & config) {
+    std::vector<const MIR::Object *> targets{};
+    for (const auto & i : block->instructions) {
+        if (std::holds_alternative<MIR::Ptr<MIR::Executable>>(i) ||
+            std::holds_alternative<MIR::Ptr<MIR::StaticLibrary>>(i)) {
+            targets.emplace_back(&i);
+        }
+    }
+
+    // Each target's rules only depend on that target, so they are found in
+    // parallel, and then put together in the order of the targets
+    std::vector<std::vector<Rule>> per_target(targets.size());
+    Util::parallel_for(targets.size(), TARGET_GRAIN, [&](std::size_t begin, std::size_t end) {
+        for (auto t = begin; t < end; ++t) {
+            const auto & i = *targets[t];
+            if (const auto x = std::get_if<MIR::Ptr<MIR::Executable>>(&i); x != nullptr) {
+                per_target[t] = target_rule((*x)->value, t, pstate, config);
+            } else {
+                per_target[t] = target_rule(
+                    std::get<MIR::Ptr<MIR::StaticLibrary>>(i)->value, t, pstate, config);
+            }
+        }
+    });
+
+    std::size_t count = 0;
+    for (const auto & r : per_target) {
+        count += r.size();
+    }
+
     // A list of all rules
     std::vector<Rule> rules{};
+    rules.reserve(count);
 
     // A mapping of named targets to their rules.
     std::unordered_map<std::string, const Rule * const> rule_map{};
 
-    for (const auto & i : block->instructions) {
-        if (const auto x = std::get_if<std::unique_ptr<MIR::Executable>>(&i); x != nullptr) {
-            auto r = target_rule((*x)->value, pstate);
-            std::move(r.begin(), r.end(), std::back_inserter(rules));
-            const Rule * const named_rule = &rules.back();
-            rule_map.emplace(named_rule->output, named_rule);
+    for (auto & r : per_target) {
+        std::move(r.begin(), r.end(), std::back_inserter(rules));
+        const Rule * const named_rule = &rules.back();
+        rule_map.emplace(named_rule->output, named_rule);
+    }
+
+    return rules;
+}
+
+/// Quote a string for the shell
+std::string shell_quote(const std::string & str) {
+    std::string quoted = "'";
+    for (const auto & c : str) {
+        if (c == '\'') {
+            quoted += "'\\''";
+        } else {
+            quoted += c;
         }
-        if (std::holds_alternative<std::unique_ptr<MIR::StaticLibrary>>(i)) {
-            auto r = target_rule(std::get<std::unique_ptr<MIR::StaticLibrary>>(i)->value, pstate);
-            std::move(r.begin(), r.end(), std::back_inserter(rules));
-            const Rule * const named_rule = &rules.back();
-            rule_map.emplace(named_rule->output, named_rule);
+    }
+    return quoted + "'";
+}
+
+/**
+ * Write an edge that configures the build directory again
+ *
+ * Ninja runs this before anything else when build.ninja is older than any of
+ * the files the configuration was read from, and then reloads build.ninja.
+ * Only files that change are written, so with restat ninja only reloads, and
+ * rebuilds, what it has to.
+ */
+void write_regenerate(const MIR::State::Persistant & pstate, Buffer & out) {
+    std::error_code ec;
+    const auto exe = fs::read_symlink("/proc/self/exe", ec);
+    if (ec) {
+        // Without knowing how to run ourselves, the user has to reconfigure
+        return;
+    }
+
+    const std::string command = shell_quote(exe) + " configure -s " +
+                                shell_quote(fs::weakly_canonical(pstate.source_root)) + " " +
+                                shell_quote(fs::weakly_canonical(pstate.build_root));
+
+    // Only `$` is special in a variable
+    std::string value{};
+    for (const auto & c : command) {
+        if (c == '$') {
+            value += '$';
         }
+        value += c;
     }
 
-    return rules;
+    out << "# Regenerate the build files when the configuration changes\n\n"
+        << "rule REGENERATE_BUILD\n"
+        << "  command = " << value << "\n"
+        << "  description = Regenerating build files\n"
+        << "  generator = 1\n"
+        << "  restat = 1\n"
+        << "  pool = console\n\n";
+
+    out << "build build.ninja: REGENERATE_BUILD |";
+    for (const auto & f : pstate.build_files) {
+        out << " " << Escaped{fs::relative(f, pstate.build_root).string()};
+    }
+    out << "\n\n";
+}
+
+/**
+ * Call `write(i, buffer)` for each i in [0, count) in parallel
+ *
+ * Each chunk is written into its own buffer, and the buffers are joined in
+ * order, so the output is the same as writing them one at a time.
+ */
+void write_in_order(const std::size_t & count, Buffer & out,
+                    const std::function<void(std::size_t, Buffer &)> & write) {
+    const std::size_t chunks = (count + EDGE_GRAIN - 1) / EDGE_GRAIN;
+    std::vector<Buffer> buffers(chunks);
+    Util::parallel_for(chunks, 1, [&](std::size_t begin, std::size_t end) {
+        for (auto c = begin; c < end; ++c) {
+            const auto last = std::min((c + 1) * EDGE_GRAIN, count);
+            for (auto i = c * EDGE_GRAIN; i < last; ++i) {
+                write(i, buffers[c]);
+            }
+        }
+    });
+    for (const auto & b : buffers) {
+        out << b.str();
+    }
+}
+
+/// Write a string as a quoted JSON string
+void write_json(std::string_view s, Buffer & out) {
+    out << '"';
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        const auto c = static_cast<unsigned char>(s[i]);
+        if (c != '"' && c != '\\' && c >= 0x20) {
+            continue;
+        }
+        out << s.substr(start, i - start);
+        if (c == '"' || c == '\\') {
+            out << '\\' << s[i];
+        } else if (c == '\n') {
+            out << "\\n";
+        } else if (c == '\t') {
+            out << "\\t";
+        } else {
+            char code[7];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            out << code;
+        }
+        start = i + 1;
+    }
+    out << s.substr(start) << '"';
+}
+
+/**
+ * Write compile_commands.json, for editors and other tools
+ *
+ * This is written from the same rules as the ninja file, so that it doesn't
+ * need to be generated from the ninja file with `ninja -t compdb`.
+ */
+void write_compile_commands(const std::vector<Rule> & rules,
+                            const MIR::State::Persistant & pstate) {
+    std::vector<const Rule *> compiles{};
+    for (const auto & r : rules) {
+        if (r.type == RuleType::COMPILE) {
+            compiles.emplace_back(&r);
+        }
+    }
+
+    const auto dir = fs::absolute(pstate.build_root).lexically_normal().string();
+
+    Writer out{pstate.build_root / "compile_commands.json"};
+    out << "[";
+    write_in_order(compiles.size(), out, [&](std::size_t i, Buffer & buf) {
+        const Rule & r = *compiles[i];
+        // TODO: build or host correctly
+        const auto & c = pstate.toolchains.at(r.lang).build()->compiler();
+
+        // The same command as the compile rule writes, with the variables
+        // filled in
+        auto args = c->command;
+        const auto & output = r.output;
+        for (const auto & more : {*r.arguments, c->depfile_command(output + ".d"),
+                                  c->output_command(output), c->compile_only_command()}) {
+            args.insert(args.end(), more.begin(), more.end());
+        }
+        args.insert(args.end(), r.input.begin(), r.input.end());
+
+        buf << (i == 0 ? "\n" : ",\n") << "  {\n    \"directory\": ";
+        write_json(dir, buf);
+        buf << ",\n    \"arguments\": [";
+        for (std::size_t a = 0; a < args.size(); ++a) {
+            if (a != 0) {
+                buf << ", ";
+            }
+            write_json(args[a], buf);
+        }
+        buf << "],\n    \"file\": ";
+        write_json(r.input.front(), buf);
+        buf << ",\n    \"output\": ";
+        write_json(output, buf);
+        buf << "\n  }";
+    });
+    out << "\n]\n";
+    out.commit();
 }
 
 } // namespace
@@ -286,50 +679,129 @@ void generate(const MIR::BasicBlock * const block, const MIR::State::Persistant
         }
     }
 
-    std::ofstream out{};
-    out.open(pstate.build_root / "build.ninja", std::ios::out | std::ios::trunc);
-    out << "# This is a build file for the project \"" << pstate.name << "\"." << std::endl
-        << "# It is autogenerated by the Meson++ build system." << std::endl
-        << "# Do not edit by hand." << std::endl
-        << std::endl
-        << "ninja_required_version = 1.8.2" << std::endl
-        << std::endl;
+    Writer out{pstate.build_root / "build.ninja"};
+    out << "# This is a build file for the project \"" << pstate.name << "\".\n"
+        << "# It is autogenerated by the Meson++ build system.\n"
+        << "# Do not edit by hand.\n\n"
+        << "ninja_required_version = 1.8.2\n\n";
+
+    // Finding the rules for each target finds the tools they need, so only
+    // tools that are used are written out, and only they are ever detected.
+    const Config config{pstate};
+    const auto & rules = mir_to_rules(block, pstate, config);
+    const auto uses = [&](const MIR::Toolchain::Language & l, const RuleType & t,
+                          const bool & rsp = false) {
+        return std::any_of(rules.begin(), rules.end(), [&](const Rule & r) {
+            return r.lang == l && r.type == t && r.rsp == rsp;
+        });
+    };
+
+    // The toolchains are unordered, so sort them to write the same file every time
+    std::vector<MIR::Toolchain::Language> langs{};
+    for (const auto & [l, _] : pstate.toolchains) {
+        langs.emplace_back(l);
+    }
+    std::sort(langs.begin(), langs.end());
+
+    // Pools limit how many memory hungry jobs run at once, without limiting
+    // the rest of the build
+    const std::vector<std::pair<std::string, unsigned>> pools{
+        {"link_pool", config.link_depth},
+        {"heavy_compile_pool", config.heavy_compile_depth},
+    };
+    bool have_pools = false;
+    for (const auto & [pool, depth] : pools) {
+        if (std::none_of(rules.begin(), rules.end(),
+                         [&](const Rule & r) { return r.pool == pool; })) {
+            continue;
+        }
+        if (!have_pools) {
+            out << "# Pools\n\n";
+            have_pools = true;
+        }
+        out << "pool " << pool << "\n"
+            << "  depth = " << std::to_string(depth) << "\n\n";
+    }
 
-    out << "# Compilation rules" << std::endl << std::endl;
+    out << "# Compilation rules\n\n";
 
-    for (const auto & [l, tc] : pstate.toolchains) {
+    for (const auto & l : langs) {
+        if (!uses(l, RuleType::COMPILE)) {
+            continue;
+        }
         const auto & lstr = MIR::Toolchain::to_string(l);
         // TODO: should also have a _for_host
-        write_compiler_rule(lstr, tc.build()->compiler, out);
+        write_compiler_rule(lstr, pstate.toolchains.at(l).build()->compiler(), out);
     }
 
-    out << "# Static Linking rules" << std::endl << std::endl;
+    out << "# Static Linking rules\n\n";
 
-    for (const auto & [l, tc] : pstate.toolchains) {
+    for (const auto & l : langs) {
         const auto & lstr = MIR::Toolchain::to_string(l);
-        // TODO: should also have a _for_host
-        write_archiver_rule(lstr, tc.build()->archiver, out);
+        for (const bool rsp : {false, true}) {
+            if (uses(l, RuleType::ARCHIVE, rsp)) {
+                // TODO: should also have a _for_host
+                write_archiver_rule(lstr, pstate.toolchains.at(l).build()->archiver(), rsp, out);
+            }
+        }
     }
 
-    out << "# Dynamic Linking rules" << std::endl << std::endl;
+    out << "# Dynamic Linking rules\n\n";
 
-    for (const auto & [l, tc] : pstate.toolchains) {
+    for (const auto & l : langs) {
         const auto & lstr = MIR::Toolchain::to_string(l);
-        // TODO: should also have a _for_host
-        write_linker_rule(lstr, tc.build()->linker, out);
+        for (const bool rsp : {false, true}) {
+            if (uses(l, RuleType::LINK, rsp)) {
+                // TODO: should also have a _for_host
+                write_linker_rule(lstr, pstate.toolchains.at(l).build()->linker(), rsp, out);
+            }
+        }
     }
 
     out << "# Phony build target, always out of date\n\n"
         << "build PHONY: phony\n\n";
+
+    write_regenerate(pstate, out);
     out << "# Build rules for targets\n\n";
 
-    const auto & rules = mir_to_rules(block, pstate);
+    // The edges for targets in each subdir are written into their own file, so
+    // that a change to one subdir only rewrites that file. The files are
+    // included with subninja, which shares the rules and pools of this file.
+    std::map<std::string, std::vector<const Rule *>> subdirs{};
     for (const auto & r : rules) {
-        write_build_rule(r, out);
+        subdirs[r.subdir].emplace_back(&r);
     }
 
-    out.flush();
-    out.close();
+    const auto write_rules = [](const std::vector<const Rule *> & rs, Buffer & buf) {
+        write_in_order(rs.size(), buf, [&](std::size_t i, Buffer & b) {
+            write_build_rule(*rs[i], i == 0 || rs[i - 1]->arguments != rs[i]->arguments, b);
+        });
+    };
+    write_rules(subdirs[""], out);
+
+    bool subninja_changed = false;
+    for (const auto & [subdir, rs] : subdirs) {
+        if (subdir.empty()) {
+            continue;
+        }
+        const auto file = fs::path{subdir} / "build.ninja";
+        out << "subninja " << Escaped{file.string()} << "\n";
+
+        fs::create_directories(pstate.build_root / subdir);
+        Writer sub{pstate.build_root / file};
+        sub << "# Build rules for targets in " << subdir << ".\n"
+            << "# It is autogenerated by the Meson++ build system.\n"
+            << "# Do not edit by hand.\n\n";
+        write_rules(rs, sub);
+        subninja_changed |= sub.commit();
+    }
+
+    // Ninja only reloads its files if build.ninja itself changed after the
+    // regenerate edge ran, so a change to a subninja file alone has to make
+    // it newer too, or ninja would go on building from the old graph.
+    out.commit(subninja_changed);
+
+    write_compile_commands(rules, pstate);
 }
 
 } // namespace Backends::Ninja
@@ -0,0 +1,333 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "ast_to_mir.hpp"
+#include "driver.hpp"
+#include "exceptions.hpp"
+#include "lower.hpp"
+#include "ninja/entry.hpp"
+#include "passes.hpp"
+#include "state/state.hpp"
+#include "threads.hpp"
+#include "toolchains/archiver.hpp"
+#include "toolchains/compilers/cpp/cpp.hpp"
+#include "toolchains/linker.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+fs::path temp_dir(const std::string & name) {
+    std::string templ = fs::temp_directory_path() / ("meson++-ninja-" + name + "-XXXXXX");
+    if (mkdtemp(templ.data()) == nullptr) {
+        throw std::runtime_error{"Could not create a temporary directory"};
+    }
+    return templ;
+}
+
+std::string read(const fs::path & p) {
+    std::ifstream in{p};
+    std::stringstream ss{};
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+/// A project with a single meson.build
+fs::path write_source(const std::string & contents) {
+    const auto dir = temp_dir("src");
+    std::ofstream{dir / "meson.build"} << contents;
+    return dir;
+}
+
+/// A target named `name`, with `count` sources
+std::string target(const std::string & func, const std::string & name, const unsigned & count,
+                   const std::string & extra = "") {
+    std::string out = func + "('" + name + "'";
+    for (unsigned i = 0; i < count; ++i) {
+        out += ", '" + name + "_" + std::to_string(i) + ".cpp'";
+    }
+    return out + ", cpp_args : ['-DTARGET=" + name + "']" + extra + ")\n";
+}
+
+/**
+ * Write a project with more targets, and more edges, than one thread handles
+ *
+ * It also uses response files, pools, and a subdir, so that every part of
+ * the output is written.
+ */
+fs::path write_project() {
+    const auto dir = temp_dir("src");
+    fs::create_directories(dir / "sub");
+
+    std::ofstream root{dir / "meson.build"};
+    root << "project('many', 'cpp')\n";
+    for (unsigned t = 0; t < 40; ++t) {
+        root << target("executable", "exe" + std::to_string(t), 30);
+    }
+    root << target("executable", "linked", 2, ", pool : 'heavy_compile'");
+    root << "subdir('sub')\n";
+
+    std::ofstream sub{dir / "sub" / "meson.build"};
+    for (unsigned t = 0; t < 10; ++t) {
+        sub << target("static_library", "lib" + std::to_string(t), 3,
+                      t % 2 ? ", pool : 'heavy_compile'" : "");
+    }
+    return dir;
+}
+
+/// The outputs of the build edges for targets, in the order they're written
+std::vector<std::string> edges(const std::string & ninja) {
+    std::vector<std::string> outs{};
+    std::istringstream in{ninja.substr(ninja.find("# Build rules for targets"))};
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 6, "build ") == 0) {
+            outs.emplace_back(line.substr(6, line.find(':') - 6));
+        }
+    }
+    return outs;
+}
+
+/// The edges for a target, compiles first
+void expect_edges(std::vector<std::string> & expected, const std::string & name,
+                  const unsigned & count, const std::string & suffix = "") {
+    for (unsigned i = 0; i < count; ++i) {
+        expected.emplace_back(name + ".p/" + name + "_" + std::to_string(i) + ".cpp.o");
+    }
+    expected.emplace_back(name + suffix);
+}
+
+/// Every file the backend writes, by its path relative to the build dir
+using Output = std::map<std::string, std::string>;
+
+Output configure(const fs::path & src, const fs::path & build) {
+    MIR::State::Persistant pstate{src, build};
+    pstate.options["backend_max_links"] = "2";
+    pstate.options["backend_max_heavy_compiles"] = "1";
+
+    // Use a toolchain that is already known, rather than finding one
+    const std::vector<std::string> cmd{"c++"};
+    auto comp = std::make_unique<MIR::Toolchain::Compiler::CPP::Gnu>(cmd);
+    const auto * raw = comp.get();
+    pstate.toolchains[MIR::Toolchain::Language::CPP] =
+        MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>{
+            std::make_shared<MIR::Toolchain::Toolchain>(
+                std::move(comp),
+                std::make_unique<MIR::Toolchain::Linker::Drivers::Gnu>(
+                    MIR::Toolchain::Linker::GnuBFD{cmd}, raw),
+                std::make_unique<MIR::Toolchain::Archiver::Gnu>(
+                    std::vector<std::string>{"ar"}))};
+
+    Frontend::Driver drv{};
+    auto block = drv.parse(src / "meson.build");
+    for (const auto & f : drv.files) {
+        pstate.build_files.emplace_back(f);
+    }
+    auto irlist = MIR::lower_ast(block, pstate);
+    MIR::Passes::lower_project(&irlist, pstate);
+    MIR::lower(&irlist, pstate);
+    Backends::Ninja::generate(&irlist, pstate);
+
+    Output out{};
+    for (const auto & f : {"build.ninja", "sub/build.ninja", "compile_commands.json"}) {
+        out[f] = read(build / f);
+    }
+    return out;
+}
+
+} // namespace
+
+TEST(ninja, parallel_matches_serial) {
+    // Make long links use response files
+    setenv("MESON_RSP_THRESHOLD", "600", 1);
+
+    const auto src = write_project();
+    const auto build = temp_dir("build");
+
+    const auto parallel = configure(src, build);
+
+    // Work started from a pool worker is done serially, on that thread
+    const auto serial =
+        Util::global_pool().submit([&]() { return configure(src, build); }).get();
+
+    for (const auto & [file, contents] : parallel) {
+        EXPECT_EQ(contents, serial.at(file)) << file << " differs";
+    }
+
+    // Each target's edges are written in the order the targets are defined
+    std::vector<std::string> expected{};
+    for (unsigned t = 0; t < 40; ++t) {
+        expect_edges(expected, "exe" + std::to_string(t), 30);
+    }
+    expect_edges(expected, "linked", 2);
+    EXPECT_EQ(edges(parallel.at("build.ninja")), expected);
+
+    expected.clear();
+    for (unsigned t = 0; t < 10; ++t) {
+        expect_edges(expected, "lib" + std::to_string(t), 3, ".a");
+    }
+    EXPECT_EQ(edges(parallel.at("sub/build.ninja")), expected);
+
+    // Make sure every kind of output was written
+    const auto & ninja = parallel.at("build.ninja");
+    const auto & sub = parallel.at("sub/build.ninja");
+    EXPECT_NE(ninja.find("  deps = gcc\n  depfile = ${out}.d\n"), std::string::npos);
+    EXPECT_NE(ninja.find("rule cpp_linker_for_build_RSP\n"), std::string::npos);
+    EXPECT_NE(ninja.find("build exe0: cpp_linker_for_build_RSP "), std::string::npos);
+    EXPECT_NE(ninja.find("exe39_39_ARGS = -DTARGET=exe39"), std::string::npos);
+    EXPECT_NE(ninja.find("  ARGS = ${exe39_39_ARGS}\n"), std::string::npos);
+    EXPECT_NE(ninja.find("subninja sub/build.ninja\n"), std::string::npos);
+    EXPECT_NE(sub.find("build lib9.a: cpp_archiver_for_build "), std::string::npos);
+    EXPECT_NE(parallel.at("compile_commands.json").find("exe39_29.cpp\",\n"), std::string::npos);
+
+    unsetenv("MESON_RSP_THRESHOLD");
+    fs::remove_all(src);
+    fs::remove_all(build);
+}
+
+TEST(ninja, similar_names) {
+    // Both names turn into the same variable name, without the target's index
+    const auto src = write_source("project('similar', 'cpp')\n" +
+                                  target("executable", "foo-bar", 1) +
+                                  target("executable", "foo.bar", 1));
+    const auto build = temp_dir("build");
+
+    const auto ninja = configure(src, build).at("build.ninja");
+    EXPECT_NE(ninja.find("foo_bar_0_ARGS = -DTARGET=foo-bar"), std::string::npos);
+    EXPECT_NE(ninja.find("foo_bar_1_ARGS = -DTARGET=foo.bar"), std::string::npos);
+    EXPECT_NE(ninja.find("build foo-bar.p/foo-bar_0.cpp.o: cpp_compiler_for_build "),
+              std::string::npos);
+    EXPECT_NE(ninja.find("  ARGS = ${foo_bar_0_ARGS}\n"), std::string::npos);
+    EXPECT_NE(ninja.find("  ARGS = ${foo_bar_1_ARGS}\n"), std::string::npos);
+
+    fs::remove_all(src);
+    fs::remove_all(build);
+}
+
+TEST(ninja, rsp_threshold_invalid) {
+    setenv("MESON_RSP_THRESHOLD", "lots", 1);
+    const auto src = write_source("project('one', 'cpp')\nexecutable('a', 'a.cpp')\n");
+    const auto build = temp_dir("build");
+
+    EXPECT_THROW(configure(src, build), Util::Exceptions::InvalidArguments);
+
+    unsetenv("MESON_RSP_THRESHOLD");
+    fs::remove_all(src);
+    fs::remove_all(build);
+}
+
+TEST(ninja, rsp_threshold_counts_command) {
+    // The objects and output alone are 13 characters, `c++ -o a` makes it 22
+    setenv("MESON_RSP_THRESHOLD", "16", 1);
+    const auto src = write_source("project('one', 'cpp')\nexecutable('a', 'a.cpp')\n");
+    const auto build = temp_dir("build");
+
+    const auto out = configure(src, build);
+    EXPECT_NE(out.at("build.ninja").find("build a: cpp_linker_for_build_RSP a.p/a.cpp.o\n"),
+              std::string::npos);
+
+    unsetenv("MESON_RSP_THRESHOLD");
+    fs::remove_all(src);
+    fs::remove_all(build);
+}
+
+TEST(ninja, pools) {
+    const auto src = write_source("project('pools', 'cpp')\n"
+                                  "executable('a', 'a.cpp')\n"
+                                  "executable('b', 'b.cpp', pool : 'heavy_compile')\n"
+                                  "static_library('c', 'c.cpp', pool : 'heavy_compile')\n");
+    const auto build = temp_dir("build");
+
+    // Each edge, and the pool it is in
+    const auto pools = [](const std::string & ninja) {
+        std::vector<std::pair<std::string, std::string>> found{};
+        std::istringstream in{ninja.substr(ninja.find("# Build rules for targets"))};
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.compare(0, 6, "build ") == 0) {
+                found.emplace_back(line.substr(6, line.find(':') - 6), "");
+            } else if (line.compare(0, 9, "  pool = ") == 0) {
+                found.back().second = line.substr(9);
+            }
+        }
+        return found;
+    };
+
+    const auto out = configure(src, build);
+    const auto & ninja = out.at("build.ninja");
+    EXPECT_EQ(pools(ninja), (std::vector<std::pair<std::string, std::string>>{
+                                {"a.p/a.cpp.o", ""},
+                                {"a", "link_pool"},
+                                {"b.p/b.cpp.o", "heavy_compile_pool"},
+                                {"b", "link_pool"},
+                                {"c.p/c.cpp.o", "heavy_compile_pool"},
+                                {"c.a", ""},
+                            }));
+    EXPECT_NE(ninja.find("pool link_pool\n  depth = 2\n"), std::string::npos);
+    EXPECT_NE(ninja.find("pool heavy_compile_pool\n  depth = 1\n"), std::string::npos);
+
+    fs::remove_all(src);
+    fs::remove_all(build);
+}
+
+TEST(ninja, subninja_changed) {
+    const auto src = write_source("project('sub', 'cpp')\nsubdir('sub')\n");
+    fs::create_directories(src / "sub");
+    std::ofstream{src / "sub" / "meson.build"} << "executable('a', 'a.cpp')\n";
+    const auto build = temp_dir("build");
+
+    const auto first = configure(src, build);
+    const auto before = fs::last_write_time(build / "build.ninja") - std::chrono::hours{1};
+    fs::last_write_time(build / "build.ninja", before);
+
+    // Only the edges in sub/build.ninja change
+    std::ofstream{src / "sub" / "meson.build"} << "executable('b', 'b.cpp')\n";
+    const auto second = configure(src, build);
+    ASSERT_EQ(first.at("build.ninja"), second.at("build.ninja"));
+    ASSERT_NE(first.at("sub/build.ninja"), second.at("sub/build.ninja"));
+
+    // But build.ninja must still be newer, so that ninja reloads it
+    EXPECT_GT(fs::last_write_time(build / "build.ninja"), before);
+
+    fs::remove_all(src);
+    fs::remove_all(build);
+}
+
+TEST(ninja, regenerate) {
+    const auto src = write_source("project('regen', 'cpp')\nsubdir('sub')\n");
+    fs::create_directories(src / "sub");
+    std::ofstream{src / "sub" / "meson.build"} << "executable('a', 'a.cpp')\n";
+    const auto build = temp_dir("build");
+
+    const auto out = configure(src, build);
+    const auto & ninja = out.at("build.ninja");
+
+    // Configuring runs this same binary again, on the same directories
+    const auto exe = fs::read_symlink("/proc/self/exe").string();
+    const std::string command = "  command = '" + exe + "' configure -s '" +
+                                fs::weakly_canonical(src).string() + "' '" +
+                                fs::weakly_canonical(build).string() + "'\n";
+    const auto rule = ninja.find("rule REGENERATE_BUILD\n");
+    ASSERT_NE(rule, std::string::npos);
+    EXPECT_EQ(ninja.find(command, rule), ninja.find('\n', rule) + 1);
+    EXPECT_NE(ninja.find("  generator = 1\n  restat = 1\n", rule), std::string::npos);
+
+    // Every meson.build that was read is an input
+    const auto rel = fs::relative(src, build).string();
+    EXPECT_NE(ninja.find("build build.ninja: REGENERATE_BUILD | " + rel + "/meson.build " +
+                         rel + "/sub/meson.build\n"),
+              std::string::npos);
+
+    fs::remove_all(src);
+    fs::remove_all(build);
+}
@@ -0,0 +1,72 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+/**
+ * Buffered output for ninja files
+ */
+
+#include <array>
+
+#include "exceptions.hpp"
+#include "files.hpp"
+#include "writer.hpp"
+
+namespace Backends::Ninja {
+
+namespace {
+
+/// Enough for most projects without growing
+constexpr std::size_t BUFFER_SIZE = 4 * 1024 * 1024;
+
+/// Characters that need to be escaped with a `$`
+constexpr std::array<bool, 256> SPECIAL = []() {
+    std::array<bool, 256> t{};
+    t['$'] = true;
+    t[' '] = true;
+    t[':'] = true;
+    return t;
+}();
+
+} // namespace
+
+Buffer::Buffer() : buffer{} {};
+
+Writer::Writer(const std::filesystem::path & p) : Buffer{}, path{p} {
+    buffer.reserve(BUFFER_SIZE);
+};
+
+Buffer & Buffer::operator<<(std::string_view s) {
+    buffer.append(s);
+    return *this;
+}
+
+Buffer & Buffer::operator<<(char c) {
+    buffer.push_back(c);
+    return *this;
+}
+
+Buffer & Buffer::operator<<(const Escaped & e) {
+    // Copy the text between special characters in one go, rather than a
+    // character at a time
+    const auto & s = e.str;
+    if (s.find('\n') != std::string_view::npos) {
+        throw Util::Exceptions::InvalidArguments{
+            "Paths in a ninja file cannot contain a newline: " + std::string{s}};
+    }
+
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        if (SPECIAL[static_cast<unsigned char>(s[i])]) {
+            buffer.append(s, start, i - start);
+            buffer.push_back('$');
+            buffer.push_back(s[i]);
+            start = i + 1;
+        }
+    }
+    buffer.append(s, start);
+    return *this;
+}
+
+bool Writer::commit(bool force) { return Util::write_if_changed(path, buffer, force); }
+
+} // namespace Backends::Ninja
@@ -0,0 +1,73 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+/**
+ * Buffered output for ninja files
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace Backends::Ninja {
+
+/**
+ * Text to be escaped for use in a ninja file
+ *
+ * `$`, ` `, and `:` are escaped with `$`. Ninja has no way to escape a
+ * newline, so writing text containing one throws InvalidArguments.
+ */
+class Escaped {
+  public:
+    explicit Escaped(std::string_view s) : str{s} {};
+
+    const std::string_view str;
+};
+
+/**
+ * Text for a ninja file, built in memory
+ */
+class Buffer {
+  public:
+    Buffer();
+
+    Buffer & operator<<(std::string_view s);
+    Buffer & operator<<(char c);
+    Buffer & operator<<(const Escaped & e);
+
+    const std::string & str() const { return buffer; };
+
+  protected:
+    std::string buffer;
+};
+
+/**
+ * Writes a ninja file through a large buffer
+ *
+ * The whole file is built in memory, and only written if it differs from
+ * what is already on disk, so that reconfiguring without changes doesn't
+ * touch the file and make ninja reload it. The file is replaced atomically,
+ * so ninja never sees a partial file.
+ */
+class Writer : public Buffer {
+  public:
+    Writer(const std::filesystem::path & p);
+
+    Writer(const Writer &) = delete;
+    Writer & operator=(const Writer &) = delete;
+
+    /**
+     * Write the file, if its contents have changed or force is set
+     *
+     * Forcing a write updates the modification time even when the contents
+     * are the same. Returns true if the file was written.
+     */
+    bool commit(bool force = false);
+
+  private:
+    const std::filesystem::path path;
+};
+
+} // namespace Backends::Ninja
@@ -0,0 +1,118 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "exceptions.hpp"
+#include "ninja/writer.hpp"
+
+namespace {
+
+std::filesystem::path temp_file(const std::string & name) {
+    return std::filesystem::temp_directory_path() / ("meson++-writer-" + name);
+}
+
+std::string read(const std::filesystem::path & p) {
+    std::ifstream in{p};
+    std::stringstream ss{};
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+} // namespace
+
+TEST(writer, escape) {
+    const auto p = temp_file("escape");
+    Backends::Ninja::Writer out{p};
+    out << "build " << Backends::Ninja::Escaped{"a b:c$d"} << ": phony\n";
+    ASSERT_TRUE(out.commit());
+    ASSERT_EQ(read(p), "build a$ b$:c$$d: phony\n");
+    std::filesystem::remove(p);
+}
+
+TEST(writer, escape_newline) {
+    Backends::Ninja::Buffer out{};
+    ASSERT_THROW(out << Backends::Ninja::Escaped{"a\nb"}, Util::Exceptions::InvalidArguments);
+}
+
+TEST(writer, escape_nothing) {
+    const auto p = temp_file("escape_nothing");
+    Backends::Ninja::Writer out{p};
+    out << Backends::Ninja::Escaped{"plain/path.cpp"} << Backends::Ninja::Escaped{""}
+        << Backends::Ninja::Escaped{"$"};
+    ASSERT_TRUE(out.commit());
+    ASSERT_EQ(read(p), "plain/path.cpp$$");
+    std::filesystem::remove(p);
+}
+
+TEST(writer, large) {
+    // Larger than the initial buffer
+    const auto p = temp_file("large");
+    const std::string line = "build x$ y: phony\n";
+    Backends::Ninja::Writer out{p};
+    for (int i = 0; i < 500000; ++i) {
+        out << "build " << Backends::Ninja::Escaped{"x y"} << ": phony\n";
+    }
+    ASSERT_TRUE(out.commit());
+    const auto got = read(p);
+    ASSERT_EQ(got.size(), line.size() * 500000);
+    ASSERT_EQ(got.substr(got.size() - line.size()), line);
+    std::filesystem::remove(p);
+}
+
+TEST(writer, truncates) {
+    const auto p = temp_file("truncates");
+    std::ofstream{p} << "some old content that is longer";
+    Backends::Ninja::Writer out{p};
+    out << "new";
+    ASSERT_TRUE(out.commit());
+    ASSERT_EQ(read(p), "new");
+    std::filesystem::remove(p);
+}
+
+TEST(writer, unchanged) {
+    const auto p = temp_file("unchanged");
+    {
+        Backends::Ninja::Writer out{p};
+        out << "build a: phony\n";
+        ASSERT_TRUE(out.commit());
+    }
+    const auto before = std::filesystem::last_write_time(p);
+    {
+        Backends::Ninja::Writer out{p};
+        out << "build a: phony\n";
+        ASSERT_FALSE(out.commit());
+    }
+    ASSERT_EQ(std::filesystem::last_write_time(p), before);
+    {
+        Backends::Ninja::Writer out{p};
+        out << "build b: phony\n";
+        ASSERT_TRUE(out.commit());
+    }
+    ASSERT_EQ(read(p), "build b: phony\n");
+    ASSERT_FALSE(std::filesystem::exists(p.string() + ".tmp"));
+    std::filesystem::remove(p);
+}
+
+TEST(writer, forced) {
+    const auto p = temp_file("forced");
+    {
+        Backends::Ninja::Writer out{p};
+        out << "build a: phony\n";
+        ASSERT_TRUE(out.commit());
+    }
+    const auto before = std::filesystem::last_write_time(p) - std::chrono::hours{1};
+    std::filesystem::last_write_time(p, before);
+    {
+        Backends::Ninja::Writer out{p};
+        out << "build a: phony\n";
+        ASSERT_TRUE(out.commit(true));
+    }
+    ASSERT_GT(std::filesystem::last_write_time(p), before);
+    ASSERT_EQ(read(p), "build a: phony\n");
+    std::filesystem::remove(p);
+}
@@ -14,6 +14,7 @@ namespace Frontend {
 
 std::unique_ptr<AST::CodeBlock> Driver::parse(const std::string & s) {
     name = s;
+    files.emplace_back(s);
 
     std::ifstream stream{s, std::ios_base::in | std::ios_base::binary};
 
@@ -23,14 +24,25 @@ std::unique_ptr<AST::CodeBlock> Driver::parse(const std::string & s) {
 std::unique_ptr<AST::CodeBlock> Driver::parse(std::istream & iss) {
     auto block = std::make_unique<Frontend::AST::CodeBlock>();
     auto scanner = std::make_unique<Frontend::Scanner>(&iss, name);
-    auto parser = std::make_unique<Frontend::Parser>(*scanner, block);
+
+    // The parser reports the first statement of every block as soon as it is
+    // parsed, only the very first of those is passed on
+    bool seen = false;
+    const std::function<void(const AST::StatementV &)> on_block_start =
+        [&](const AST::StatementV & stmt) {
+            if (!seen && on_first_statement) {
+                on_first_statement(stmt);
+            }
+            seen = true;
+        };
+    auto parser = std::make_unique<Frontend::Parser>(*scanner, block, on_block_start);
 
     parser->parse();
 
     std::vector<AST::StatementV> new_stmts{};
 
     // Walk over all of the statements, replacing any subdir() calls with new
-    AST::SubdirVisitor sv{};
+    AST::SubdirVisitor sv{&files};
     for (unsigned i = 0; i < block->statements.size(); ++i) {
         auto const & stmt = block->statements[i];
         auto res = std::visit(sv, stmt);
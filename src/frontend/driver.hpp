@@ -3,6 +3,7 @@
 
 #pragma once
 
+#include <functional>
 #include <istream>
 #include <memory>
 #include <string>
@@ -21,6 +22,17 @@ class Driver {
     std::unique_ptr<AST::CodeBlock> parse(const std::string &);
 
     std::string name;
+
+    /**
+     * Called with the first statement of the file as soon as it is parsed
+     *
+     * The rest of the file hasn't been parsed yet, so this can be used to
+     * start work that only depends on the project() call.
+     */
+    std::function<void(const AST::StatementV &)> on_first_statement;
+
+    /// Every file that has been parsed, including those read by subdir()
+    std::vector<std::string> files;
 };
 
 } // namespace Frontend
@@ -4,6 +4,8 @@
 #pragma once
 
 #include <optional>
+#include <string>
+#include <vector>
 
 #include "node.hpp"
 
@@ -13,6 +15,9 @@ namespace Frontend::AST {
  * Convert all `subdir()` calls into AST and insert it into the tree.
  */
 struct SubdirVisitor {
+    /// Where to add the files that are read, if set
+    std::vector<std::string> * files = nullptr;
+
     std::optional<std::unique_ptr<CodeBlock>> operator()(const std::unique_ptr<Statement> &) const;
     std::optional<std::unique_ptr<CodeBlock>>
     operator()(const std::unique_ptr<IfStatement> &) const;
@@ -10,6 +10,7 @@
 %define api.location.file "locations.hpp"
 
 %code requires {
+    #include <functional>
     #include <memory>
     #include "node.hpp"
 
@@ -21,6 +22,7 @@
 
 %parse-param { Scanner & scanner }
 %parse-param { std::unique_ptr<AST::CodeBlock> & block }
+%parse-param { const std::function<void(const AST::StatementV &)> & on_block_start }
 
 %locations
 %initial-action {
@@ -98,7 +100,7 @@ program : statements                                { block = std::move($1); }
         | statements "\n"                           { block = std::move($1); }
         ;
 
-statements : statement                              { $$ = std::make_unique<AST::CodeBlock>(std::move($1)); }
+statements : statement                              { if (on_block_start) { on_block_start($1); } $$ = std::make_unique<AST::CodeBlock>(std::move($1)); }
            | statements "\n" statement              { $1->statements.push_back(std::move($3)); $$ = std::move($1); }
            ;
 
@@ -414,3 +414,17 @@ TEST(parser, inline_comment) {
     auto block = parse("a = b  # foo\n");
     ASSERT_EQ(block->statements.size(), 1);
 }
+
+TEST(parser, first_statement) {
+    Frontend::Driver drv{};
+    std::istringstream stream{"project('foo')\nif true\n  x = 1\nendif\ny = 2\n"};
+    drv.name = "test file name";
+
+    std::vector<std::string> seen{};
+    drv.on_first_statement = [&](const Frontend::AST::StatementV & s) {
+        seen.emplace_back(std::get<0>(s)->as_string());
+    };
+    (void)drv.parse(stream);
+
+    ASSERT_EQ(seen, std::vector<std::string>{"project('foo')"});
+}
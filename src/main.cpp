@@ -26,19 +26,38 @@ static int configure(const Options::ConfigureOptions & opts) {
               << "Source dir: " << Util::Log::bold(fs::absolute(opts.sourcedir)) << std::endl
               << "Build dir: " << Util::Log::bold(fs::absolute(opts.builddir)) << std::endl;
 
-    // Parse the source into a an AST
+    MIR::State::Persistant pstate{opts.sourcedir, opts.builddir};
+
+    // Options from the last configuration are kept, unless they are set again
+    pstate.options = Options::configured_options(opts);
+
+    // Parse the source into a an AST, starting compiler detection as soon as
+    // the project() call has been parsed
     Frontend::Driver drv{};
+    drv.on_first_statement = [&](const Frontend::AST::StatementV & stmt) {
+        MIR::Passes::speculate_project(stmt, pstate);
+    };
     auto block = drv.parse(opts.sourcedir / "meson.build");
-
-    MIR::State::Persistant pstate{opts.sourcedir, opts.builddir};
+    for (const auto & f : drv.files) {
+        pstate.build_files.emplace_back(fs::absolute(f));
+    }
+    pstate.build_files.emplace_back(fs::absolute(Options::saved_options_file(opts.builddir)));
 
     // Create IR from the AST, then run our lowering passes on it
     auto irlist = MIR::lower_ast(block, pstate);
     MIR::Passes::lower_project(&irlist, pstate);
     MIR::lower(&irlist, pstate);
 
+    // The options are saved first, as they are an input of build.ninja
+    Options::save_options(opts.builddir, pstate.options);
     Backends::Ninja::generate(&irlist, pstate);
 
+    // The backend finds the linker and archiver, if any target needs them
+    MIR::report_toolchains(pstate);
+
+    // Only the tools that were actually needed have been found by now
+    pstate.toolchain_cache.save();
+
     return 0;
 };
 
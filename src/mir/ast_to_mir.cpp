@@ -2,6 +2,7 @@
 // Copyright © 2021 Intel Corporation
 
 #include <filesystem>
+#include <unordered_map>
 
 #include "ast_to_mir.hpp"
 #include "exceptions.hpp"
@@ -15,18 +16,19 @@ namespace {
  */
 struct ExpressionLowering {
 
-    ExpressionLowering(const MIR::State::Persistant & ps) : pstate{ps} {};
+    ExpressionLowering(const MIR::State::Persistant & ps, BlockArena & a) : pstate{ps}, arena{a} {};
 
     const MIR::State::Persistant & pstate;
+    BlockArena & arena;
 
     Object operator()(const std::unique_ptr<Frontend::AST::String> & expr) const {
-        return std::make_unique<String>(expr->value);
+        return arena.make<String>(expr->value);
     };
 
     Object operator()(const std::unique_ptr<Frontend::AST::FunctionCall> & expr) const {
         // I think that a function can only be an ID, I think
         auto fname_id = std::visit(*this, expr->id);
-        auto fname_ptr = std::get_if<std::unique_ptr<Identifier>>(&fname_id);
+        auto fname_ptr = std::get_if<Ptr<Identifier>>(&fname_id);
         if (fname_ptr == nullptr) {
             // TODO: Better error message witht the thing being called
             throw Util::Exceptions::MesonException{"Object is not callable"};
@@ -34,15 +36,15 @@ struct ExpressionLowering {
         auto fname = (*fname_ptr)->value;
 
         // Get the positional arguments
-        std::vector<Object> pos{};
+        std::pmr::vector<Object> pos{arena.allocator()};
         for (const auto & i : expr->args->positional) {
             pos.emplace_back(std::visit(*this, i));
         }
 
-        std::unordered_map<std::string, Object> kwargs{};
+        std::pmr::unordered_map<std::string, Object> kwargs{arena.allocator()};
         for (const auto & [k, v] : expr->args->keyword) {
             auto key_obj = std::visit(*this, k);
-            auto key_ptr = std::get_if<std::unique_ptr<MIR::Identifier>>(&key_obj);
+            auto key_ptr = std::get_if<MIR::Ptr<MIR::Identifier>>(&key_obj);
             if (key_ptr == nullptr) {
                 // TODO: better error message
                 throw Util::Exceptions::MesonException{"keyword arguments must be identifiers"};
@@ -55,25 +57,25 @@ struct ExpressionLowering {
 
         // We have to move positional arguments because Object isn't copy-able
         // TODO: filename is currently absolute, but we need the source dir to make it relative
-        return std::make_unique<FunctionCall>(
+        return arena.make<FunctionCall>(
             fname, std::move(pos), std::move(kwargs),
             std::filesystem::relative(path.parent_path(), pstate.build_root));
     };
 
     Object operator()(const std::unique_ptr<Frontend::AST::Boolean> & expr) const {
-        return std::make_unique<Boolean>(expr->value);
+        return arena.make<Boolean>(expr->value);
     };
 
     Object operator()(const std::unique_ptr<Frontend::AST::Number> & expr) const {
-        return std::make_unique<Number>(expr->value);
+        return arena.make<Number>(expr->value);
     };
 
     Object operator()(const std::unique_ptr<Frontend::AST::Identifier> & expr) const {
-        return std::make_unique<Identifier>(expr->value);
+        return arena.make<Identifier>(expr->value);
     };
 
     Object operator()(const std::unique_ptr<Frontend::AST::Array> & expr) const {
-        auto arr = std::make_unique<Array>();
+        auto arr = arena.make<Array>();
         for (const auto & i : expr->elements) {
             arr->value.emplace_back(std::visit(*this, i));
         }
@@ -81,13 +83,13 @@ struct ExpressionLowering {
     };
 
     Object operator()(const std::unique_ptr<Frontend::AST::Dict> & expr) const {
-        auto dict = std::make_unique<Dict>();
+        auto dict = arena.make<Dict>();
         for (const auto & [k, v] : expr->elements) {
             auto key_obj = std::visit(*this, k);
-            if (!std::holds_alternative<std::unique_ptr<String>>(key_obj)) {
+            if (!std::holds_alternative<Ptr<String>>(key_obj)) {
                 throw Util::Exceptions::InvalidArguments("Dictionary keys must be strintg");
             }
-            auto key = std::get<std::unique_ptr<MIR::String>>(key_obj)->value;
+            auto key = std::get<MIR::Ptr<MIR::String>>(key_obj)->value;
 
             dict->value[key] = std::visit(*this, v);
         }
@@ -99,73 +101,137 @@ struct ExpressionLowering {
         // meson.get_compiler('c').get_id()
         // Which this code *cannot* handle here.
         auto holding_obj = std::visit(*this, expr->object);
-        assert(std::holds_alternative<std::unique_ptr<MIR::Identifier>>(holding_obj));
+        assert(std::holds_alternative<MIR::Ptr<MIR::Identifier>>(holding_obj));
 
         // Meson only allows methods in objects, so we can enforce that this is a function
         auto method = std::visit(*this, expr->id);
-        assert(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(method));
+        assert(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(method));
 
-        auto func = std::move(std::get<std::unique_ptr<MIR::FunctionCall>>(method));
-        func->holder = std::get<std::unique_ptr<MIR::Identifier>>(holding_obj)->value;
+        auto func = std::move(std::get<MIR::Ptr<MIR::FunctionCall>>(method));
+        func->holder = std::get<MIR::Ptr<MIR::Identifier>>(holding_obj)->value;
 
         return func;
     };
 
     // XXX: all of thse are lies to get things compiling
     Object operator()(const std::unique_ptr<Frontend::AST::AdditiveExpression> & expr) const {
-        return std::make_unique<String>("placeholder: add");
+        return arena.make<String>("placeholder: add");
     };
     Object operator()(const std::unique_ptr<Frontend::AST::MultiplicativeExpression> & expr) const {
-        return std::make_unique<String>("placeholder: mul");
+        return arena.make<String>("placeholder: mul");
     };
     Object operator()(const std::unique_ptr<Frontend::AST::UnaryExpression> & expr) const {
-        return std::make_unique<String>("placeholder: unary");
+        return arena.make<String>("placeholder: unary");
     };
     Object operator()(const std::unique_ptr<Frontend::AST::Subscript> & expr) const {
-        return std::make_unique<String>("placeholder: subscript");
+        return arena.make<String>("placeholder: subscript");
     };
     Object operator()(const std::unique_ptr<Frontend::AST::Relational> & expr) const {
-        return std::make_unique<String>("placeholder: rel");
+        return arena.make<String>("placeholder: rel");
     };
     Object operator()(const std::unique_ptr<Frontend::AST::Ternary> & expr) const {
-        return std::make_unique<String>("placeholder: tern");
+        return arena.make<String>("placeholder: tern");
     };
 };
 
+/**
+ * Where break and continue jump to in the innermost foreach loop
+ */
+struct LoopTargets {
+    /// The block after the loop
+    BasicBlock * exit;
+
+    /// The start of the next iteration
+    BasicBlock * next;
+};
+
+/**
+ * Does this block contain a break or continue for the loop it is the body of?
+ *
+ * Nested foreach loops are not searched, as their break and continue
+ * statements apply to themselves.
+ */
+bool has_loop_control(const std::unique_ptr<Frontend::AST::CodeBlock> & block) {
+    for (const auto & s : block->statements) {
+        if (std::holds_alternative<std::unique_ptr<Frontend::AST::Break>>(s) ||
+            std::holds_alternative<std::unique_ptr<Frontend::AST::Continue>>(s)) {
+            return true;
+        }
+        if (const auto * ptr = std::get_if<std::unique_ptr<Frontend::AST::IfStatement>>(&s)) {
+            const auto & stmt = *ptr;
+            if (has_loop_control(stmt->ifblock.block)) {
+                return true;
+            }
+            for (const auto & el : stmt->efblock) {
+                if (has_loop_control(el.block)) {
+                    return true;
+                }
+            }
+            if (stmt->eblock.block != nullptr && has_loop_control(stmt->eblock.block)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 /**
  * Lowers AST statements into MIR objects.
  */
 struct StatementLowering {
 
-    StatementLowering(const MIR::State::Persistant & ps) : pstate{ps} {};
+    StatementLowering(const MIR::State::Persistant & ps, BlockArena & a,
+                      const LoopTargets * l = nullptr)
+        : pstate{ps}, arena{a}, loop{l} {};
 
     const MIR::State::Persistant & pstate;
 
+    /// Where all new BasicBlocks are allocated from
+    BlockArena & arena;
+
+    /// The innermost loop being lowered, if any
+    const LoopTargets * loop;
+
+    /// Store value to the variable name
+    void assign(BasicBlock * list, const std::string & name, Object && value) const {
+        std::visit([&](const auto & t) { t->var.name = name; }, value);
+        list->instructions.emplace_back(std::move(value));
+    };
+
     BasicBlock * operator()(BasicBlock * list,
                             const std::unique_ptr<Frontend::AST::Statement> & stmt) const {
-        const ExpressionLowering l{pstate};
+        const ExpressionLowering l{pstate, arena};
         list->instructions.emplace_back(std::visit(l, stmt->expr));
         return list;
     };
 
+    /**
+     * Lower each statement of a code block, starting in the given BasicBlock
+     *
+     * Returns the block that the last statement ended in, which will differ
+     * from the one passed in if there are any if statements.
+     */
+    BasicBlock * lower_block(BasicBlock * list,
+                             const std::unique_ptr<Frontend::AST::CodeBlock> & block) const {
+        for (const auto & i : block->statements) {
+            list = std::visit([&](const auto & a) { return this->operator()(list, a); }, i);
+        }
+        return list;
+    };
+
     BasicBlock * operator()(BasicBlock * list,
                             const std::unique_ptr<Frontend::AST::IfStatement> & stmt) const {
-        const ExpressionLowering l{pstate};
+        const ExpressionLowering l{pstate, arena};
 
-        auto next_block = std::make_shared<BasicBlock>();
+        auto next_block = arena.new_block();
 
         assert(list != nullptr);
         auto cur = list;
         BasicBlock * last_block;
 
-        cur->condition = std::optional<Condition>{std::visit(l, stmt->ifblock.condition)};
-        for (const auto & i : stmt->ifblock.block->statements) {
-            last_block = std::visit(
-                [&](const auto & a) {
-                    return this->operator()(cur->condition.value().if_true.get(), a);
-                },
-                i);
-        }
+        cur->condition.emplace(std::visit(l, stmt->ifblock.condition), arena);
+        last_block = lower_block(cur->condition.value().if_true, stmt->ifblock.block);
+
         // We shouldn't have a condition here, this is where we wnat to put our next target
         assert(!last_block->condition.has_value());
         last_block->next = next_block;
@@ -175,15 +241,9 @@ struct StatementLowering {
         // objects
         if (!stmt->efblock.empty()) {
             for (const auto & el : stmt->efblock) {
-                cur = cur->condition->if_false.get();
-                cur->condition = std::optional<Condition>{std::visit(l, el.condition)};
-                for (const auto & i : el.block->statements) {
-                    last_block = std::visit(
-                        [&](const auto & a) {
-                            return this->operator()(cur->condition.value().if_true.get(), a);
-                        },
-                        i);
-                }
+                cur = cur->condition->if_false;
+                cur->condition.emplace(std::visit(l, el.condition), arena);
+                last_block = lower_block(cur->condition.value().if_true, el.block);
 
                 // We shouldn't have a condition here, this is where we wnat to put our next target
                 assert(!last_block->condition.has_value());
@@ -191,57 +251,144 @@ struct StatementLowering {
             }
         }
 
+        // Without an else the false branch is empty, and just continues on
+        last_block = cur->condition.value().if_false;
         if (stmt->eblock.block != nullptr) {
-            for (const auto & i : stmt->eblock.block->statements) {
-                last_block = std::visit(
-                    [&](const auto & a) {
-                        return this->operator()(cur->condition.value().if_false.get(), a);
-                    },
-                    i);
-            }
+            last_block = lower_block(last_block, stmt->eblock.block);
         }
         // We shouldn't have a condition here, this is where we wnat to put our next target
         assert(!last_block->condition.has_value());
         last_block->next = next_block;
 
-        // Return the raw pointer, which is fine because we're not giving the
-        // caller ownership of the pointer, the other basic blocks are the owners.
-        return next_block.get();
+        // The arena owns the block, the caller just continues filling it in
+        return next_block;
     };
 
     BasicBlock * operator()(BasicBlock * list,
                             const std::unique_ptr<Frontend::AST::Assignment> & stmt) const {
-        const ExpressionLowering l{pstate};
+        const ExpressionLowering l{pstate, arena};
         auto target = std::visit(l, stmt->lhs);
         auto value = std::visit(l, stmt->rhs);
 
-        // XXX: need to handle mutative assignments
-        assert(stmt->op == Frontend::AST::AssignOp::EQUAL);
-
         // XXX: need to handle other things that can be assigned to, like subscript
-        auto name_ptr = std::get_if<std::unique_ptr<Identifier>>(&target);
+        auto name_ptr = std::get_if<Ptr<Identifier>>(&target);
         if (name_ptr == nullptr) {
             throw Util::Exceptions::MesonException{
                 "This might be a bug, or might be an incomplete implementation"};
         }
-        std::visit([&](const auto & t) { t->var.name = (*name_ptr)->value; }, value);
+        const auto & name = (*name_ptr)->value;
+
+        if (stmt->op == Frontend::AST::AssignOp::ADD_EQUAL) {
+            // What this does depends on the values of both sides, which
+            // constant propagation works out
+            value = arena.make<PlusAssignment>(std::move(value), name);
+        } else if (stmt->op != Frontend::AST::AssignOp::EQUAL) {
+            // TODO: -=, *=, /=, and %=, which only apply to numbers
+            throw Util::Exceptions::MesonException{
+                "Mutating assignments other than += are not implemented"};
+        }
 
-        list->instructions.emplace_back(std::move(value));
+        assign(list, name, std::move(value));
         return list;
     };
 
-    // XXX: None of this is actually implemented
+    /**
+     * Lower a foreach loop by unrolling it
+     *
+     * Each element is assigned to the loop variable, followed by a copy of
+     * the body. Elements are lowered directly from the AST as each copy is
+     * made, so this is linear in the number of elements times the size of
+     * the body.
+     *
+     * When the body contains a break or continue each iteration gets its own
+     * block, so that they have somewhere to jump to. Otherwise everything is
+     * lowered straight into the current block.
+     *
+     * Anything other than an array literal isn't known yet, so the loop is
+     * kept as a Foreach, to be unrolled once it is.
+     */
     BasicBlock * operator()(BasicBlock * list,
                             const std::unique_ptr<Frontend::AST::ForeachStatement> & stmt) const {
+        const auto * arr = std::get_if<std::unique_ptr<Frontend::AST::Array>>(&stmt->expr);
+        if (arr == nullptr) {
+            return defer_foreach(list, stmt);
+        }
+
+        const ExpressionLowering l{pstate, arena};
+        const bool control = has_loop_control(stmt->block);
+        auto * exit = control ? arena.new_block() : nullptr;
+
+        for (const auto & e : (*arr)->elements) {
+            assign(list, stmt->id.value, std::visit(l, e));
+
+            if (!control) {
+                list = lower_block(list, stmt->block);
+                continue;
+            }
+
+            const LoopTargets targets{exit, arena.new_block()};
+            const StatementLowering body{pstate, arena, &targets};
+            auto * last_block = body.lower_block(list, stmt->block);
+            assert(!last_block->condition.has_value());
+            last_block->next = targets.next;
+            list = targets.next;
+        }
+
+        if (control) {
+            list->next = exit;
+            list = exit;
+        }
         return list;
     };
+
+    /**
+     * Lower the body of a foreach loop once, and keep it until the iterable is known
+     *
+     * The body is lowered into its own blocks, with break and continue
+     * jumping to placeholders, which are replaced for each copy of the body
+     * once the loop is unrolled.
+     */
+    BasicBlock *
+    defer_foreach(BasicBlock * list,
+                  const std::unique_ptr<Frontend::AST::ForeachStatement> & stmt) const {
+        const ExpressionLowering l{pstate, arena};
+
+        const LoopTargets targets{arena.new_block(), arena.new_block()};
+        auto * body = arena.new_block();
+        const StatementLowering lower_body{pstate, arena, &targets};
+        auto * last_block = lower_body.lower_block(body, stmt->block);
+        assert(!last_block->condition.has_value());
+        last_block->next = targets.next;
+
+        list->instructions.emplace_back(arena.make<Foreach>(
+            std::visit(l, stmt->expr), stmt->id.value, body, targets.next, targets.exit));
+        return list;
+    };
+
+    /**
+     * Jump to the end of the loop
+     *
+     * Anything after the break is unreachable, so it is lowered into a new
+     * block that nothing points to.
+     */
     BasicBlock * operator()(BasicBlock * list,
                             const std::unique_ptr<Frontend::AST::Break> & stmt) const {
-        return list;
+        if (loop == nullptr) {
+            throw Util::Exceptions::MesonException{"break statement outside of a foreach loop"};
+        }
+        list->next = loop->exit;
+        return arena.new_block();
     };
+
+    /// Jump to the next iteration of the loop
     BasicBlock * operator()(BasicBlock * list,
                             const std::unique_ptr<Frontend::AST::Continue> & stmt) const {
-        return list;
+        if (loop == nullptr) {
+            throw Util::Exceptions::MesonException{
+                "continue statement outside of a foreach loop"};
+        }
+        list->next = loop->next;
+        return arena.new_block();
     };
 };
 
@@ -250,14 +397,11 @@ struct StatementLowering {
 /**
  * Lower AST representation into MIR.
  */
-BasicBlock lower_ast(const std::unique_ptr<Frontend::AST::CodeBlock> & block,
-                     const MIR::State::Persistant & pstate) {
-    BasicBlock bl{};
-    BasicBlock * current_block = &bl;
-    const StatementLowering lower{pstate};
-    for (const auto & i : block->statements) {
-        current_block = std::visit([&](const auto & a) { return lower(current_block, a); }, i);
-    }
+Program lower_ast(const std::unique_ptr<Frontend::AST::CodeBlock> & block,
+                  const MIR::State::Persistant & pstate) {
+    Program bl{};
+    const StatementLowering lower{pstate, bl.arena};
+    lower.lower_block(&bl, block);
 
     return bl;
 }
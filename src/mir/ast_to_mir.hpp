@@ -9,8 +9,13 @@
 
 namespace MIR {
 
-/// Lower AST to IR
-BasicBlock lower_ast(const std::unique_ptr<Frontend::AST::CodeBlock> &,
-                     const MIR::State::Persistant &);
+/**
+ * Lower AST to IR
+ *
+ * The returned Program owns every BasicBlock created, the blocks only point at
+ * each other.
+ */
+Program lower_ast(const std::unique_ptr<Frontend::AST::CodeBlock> &,
+                  const MIR::State::Persistant &);
 
 }; // namespace MIR
@@ -7,7 +7,9 @@
 
 #include "ast_to_mir.hpp"
 #include "driver.hpp"
+#include "exceptions.hpp"
 #include "mir.hpp"
+#include "passes.hpp"
 
 namespace {
 
@@ -19,7 +21,7 @@ std::unique_ptr<Frontend::AST::CodeBlock> parse(const std::string & in) {
     return block;
 }
 
-MIR::BasicBlock lower(const std::string & in) {
+MIR::Program lower(const std::string & in) {
     auto block = parse(in);
     const MIR::State::Persistant pstate{"foo/src", "foo/build"};
     auto ir = MIR::lower_ast(block, pstate);
@@ -32,8 +34,8 @@ TEST(ast_to_ir, number) {
     auto irlist = lower("7");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(obj));
-    const auto & ir = std::get<std::unique_ptr<MIR::Number>>(obj);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(obj));
+    const auto & ir = std::get<MIR::Ptr<MIR::Number>>(obj);
     ASSERT_EQ(ir->value, 7);
 }
 
@@ -41,8 +43,8 @@ TEST(ast_to_ir, boolean) {
     auto irlist = lower("true");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Boolean>>(obj));
-    const auto & ir = std::get<std::unique_ptr<MIR::Boolean>>(obj);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Boolean>>(obj));
+    const auto & ir = std::get<MIR::Ptr<MIR::Boolean>>(obj);
     ASSERT_EQ(ir->value, true);
 }
 
@@ -50,8 +52,8 @@ TEST(ast_to_ir, string) {
     auto irlist = lower("'true'");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::String>>(obj));
-    const auto & ir = std::get<std::unique_ptr<MIR::String>>(obj);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::String>>(obj));
+    const auto & ir = std::get<MIR::Ptr<MIR::String>>(obj);
     ASSERT_EQ(ir->value, "true");
 }
 
@@ -59,21 +61,21 @@ TEST(ast_to_ir, array) {
     auto irlist = lower("['a', 'b', 1, [2]]");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Array>>(obj));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Array>>(obj));
 
-    const auto & arr = std::get<std::unique_ptr<MIR::Array>>(obj);
+    const auto & arr = std::get<MIR::Ptr<MIR::Array>>(obj);
 
-    const auto & arr0 = std::get<std::unique_ptr<MIR::String>>(arr->value[0]);
+    const auto & arr0 = std::get<MIR::Ptr<MIR::String>>(arr->value[0]);
     ASSERT_EQ(arr0->value, "a");
 
-    const auto & arr1 = std::get<std::unique_ptr<MIR::String>>(arr->value[1]);
+    const auto & arr1 = std::get<MIR::Ptr<MIR::String>>(arr->value[1]);
     ASSERT_EQ(arr1->value, "b");
 
-    const auto & arr2 = std::get<std::unique_ptr<MIR::Number>>(arr->value[2]);
+    const auto & arr2 = std::get<MIR::Ptr<MIR::Number>>(arr->value[2]);
     ASSERT_EQ(arr2->value, 1);
 
-    const auto & arr3 = std::get<std::unique_ptr<MIR::Array>>(arr->value[3]);
-    const auto & arr3_1 = std::get<std::unique_ptr<MIR::Number>>(arr3->value[0]);
+    const auto & arr3 = std::get<MIR::Ptr<MIR::Array>>(arr->value[3]);
+    const auto & arr3_1 = std::get<MIR::Ptr<MIR::Number>>(arr3->value[0]);
     ASSERT_EQ(arr3_1->value, 2);
 }
 
@@ -81,11 +83,11 @@ TEST(ast_to_ir, dict) {
     auto irlist = lower("{'str': 1}");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Dict>>(obj));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Dict>>(obj));
 
-    const auto & dict = std::get<std::unique_ptr<MIR::Dict>>(obj);
+    const auto & dict = std::get<MIR::Ptr<MIR::Dict>>(obj);
 
-    const auto & val = std::get<std::unique_ptr<MIR::Number>>(dict->value["str"]);
+    const auto & val = std::get<MIR::Ptr<MIR::Number>>(dict->value["str"]);
     ASSERT_EQ(val->value, 1);
 }
 
@@ -93,9 +95,9 @@ TEST(ast_to_ir, simple_function) {
     auto irlist = lower("has_no_args()");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(obj));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(obj));
 
-    const auto & ir = std::get<std::unique_ptr<MIR::FunctionCall>>(obj);
+    const auto & ir = std::get<MIR::Ptr<MIR::FunctionCall>>(obj);
     ASSERT_EQ(ir->name, "has_no_args");
     const auto & arguments = ir->pos_args;
     ASSERT_TRUE(arguments.empty());
@@ -105,9 +107,9 @@ TEST(ast_to_ir, simple_method) {
     auto irlist = lower("obj.method()");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(obj));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(obj));
 
-    const auto & ir = std::get<std::unique_ptr<MIR::FunctionCall>>(obj);
+    const auto & ir = std::get<MIR::Ptr<MIR::FunctionCall>>(obj);
     ASSERT_EQ(ir->name, "method");
     ASSERT_EQ(ir->source_dir, ""); // We want to ensure this isn't meson.build
     ASSERT_TRUE(ir->holder.has_value());
@@ -123,9 +125,9 @@ TEST(ast_to_ir, chained_method) {
     auto irlist = lower("obj.method().chained()");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(obj));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(obj));
 
-    const auto & ir = std::get<std::unique_ptr<MIR::FunctionCall>>(obj);
+    const auto & ir = std::get<MIR::Ptr<MIR::FunctionCall>>(obj);
     ASSERT_EQ(ir->name, "method");
     ASSERT_TRUE(ir->holder.has_value());
     ASSERT_EQ(ir->holder.value(), "obj");
@@ -138,25 +140,25 @@ TEST(ast_to_ir, function_positional_arguments_only) {
     auto irlist = lower("has_args(1, 2, 3)");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(obj));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(obj));
 
-    const auto & ir = std::get<std::unique_ptr<MIR::FunctionCall>>(obj);
+    const auto & ir = std::get<MIR::Ptr<MIR::FunctionCall>>(obj);
     ASSERT_EQ(ir->name, "has_args");
 
     const auto & arguments = ir->pos_args;
     ASSERT_EQ(arguments.size(), 3);
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(arguments[0])->value, 1);
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(arguments[1])->value, 2);
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(arguments[2])->value, 3);
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(arguments[0])->value, 1);
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(arguments[1])->value, 2);
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(arguments[2])->value, 3);
 }
 
 TEST(ast_to_ir, function_keyword_arguments_only) {
     auto irlist = lower("has_args(a : 1, b : '2')");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(obj));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(obj));
 
-    const auto & ir = std::get<std::unique_ptr<MIR::FunctionCall>>(obj);
+    const auto & ir = std::get<MIR::Ptr<MIR::FunctionCall>>(obj);
     ASSERT_EQ(ir->name, "has_args");
 
     const auto & arguments = ir->pos_args;
@@ -165,10 +167,10 @@ TEST(ast_to_ir, function_keyword_arguments_only) {
     auto & kwargs = ir->kw_args;
     ASSERT_EQ(kwargs.size(), 2);
 
-    const auto & kw_a = std::get<std::unique_ptr<MIR::Number>>(kwargs["a"]);
+    const auto & kw_a = std::get<MIR::Ptr<MIR::Number>>(kwargs["a"]);
     ASSERT_EQ(kw_a->value, 1);
 
-    const auto & kw_b = std::get<std::unique_ptr<MIR::String>>(kwargs["b"]);
+    const auto & kw_b = std::get<MIR::Ptr<MIR::String>>(kwargs["b"]);
     ASSERT_EQ(kw_b->value, "2");
 }
 
@@ -176,19 +178,19 @@ TEST(ast_to_ir, function_both_arguments) {
     auto irlist = lower("both_args(1, a, a : 1)");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(obj));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(obj));
 
-    const auto & ir = std::get<std::unique_ptr<MIR::FunctionCall>>(obj);
+    const auto & ir = std::get<MIR::Ptr<MIR::FunctionCall>>(obj);
     ASSERT_EQ(ir->name, "both_args");
 
     const auto & arguments = ir->pos_args;
     ASSERT_EQ(arguments.size(), 2);
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(arguments[0])->value, 1);
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::Identifier>>(arguments[1])->value, "a");
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(arguments[0])->value, 1);
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Identifier>>(arguments[1])->value, "a");
 
     auto & kwargs = ir->kw_args;
     ASSERT_EQ(kwargs.size(), 1);
-    const auto & kw_a = std::get<std::unique_ptr<MIR::Number>>(kwargs["a"]);
+    const auto & kw_a = std::get<MIR::Ptr<MIR::Number>>(kwargs["a"]);
     ASSERT_EQ(kw_a->value, 1);
 }
 
@@ -196,14 +198,14 @@ TEST(ast_to_ir, if_only) {
     auto irlist = lower("if true\n 7\nendif\n");
     ASSERT_TRUE(irlist.condition.has_value());
     auto const & con = irlist.condition.value();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Boolean>>(con.condition));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Boolean>>(con.condition));
 
     auto const & if_true = con.if_true->instructions;
     ASSERT_EQ(if_true.size(), 1);
 
     auto const & val = if_true.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(val));
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(val)->value, 7);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(val));
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(val)->value, 7);
 }
 
 TEST(ast_to_ir, if_else_more) {
@@ -249,33 +251,33 @@ TEST(ast_to_ir, if_else) {
     auto irlist = lower("if true\n 7\nelse\n8\nendif\n");
     ASSERT_TRUE(irlist.condition.has_value());
     auto const & con = irlist.condition.value();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Boolean>>(con.condition));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Boolean>>(con.condition));
 
     auto const & if_true = con.if_true->instructions;
     ASSERT_EQ(if_true.size(), 1);
     auto const & val = if_true.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(val));
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(val)->value, 7);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(val));
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(val)->value, 7);
 
     auto const & if_false = con.if_false->instructions;
     ASSERT_EQ(if_false.size(), 1);
     auto const & val2 = if_false.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(val2));
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(val2)->value, 8);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(val2));
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(val2)->value, 8);
 }
 
 TEST(ast_to_ir, if_elif) {
     auto irlist = lower("if true\n 7\nelif false\n8\nelif true\n9\nendif\n");
     ASSERT_TRUE(irlist.condition.has_value());
     auto const & con = irlist.condition.value();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Boolean>>(con.condition));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Boolean>>(con.condition));
 
     {
         auto const & if_true = con.if_true->instructions;
         ASSERT_EQ(if_true.size(), 1);
         auto const & val = if_true.front();
-        ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(val));
-        ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(val)->value, 7);
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(val));
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(val)->value, 7);
 
         auto const & if_false = con.if_false->instructions;
         ASSERT_EQ(if_false.size(), 0);
@@ -283,28 +285,28 @@ TEST(ast_to_ir, if_elif) {
 
     ASSERT_TRUE(con.if_false->condition.has_value());
     auto const & elcon = con.if_false->condition.value();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Boolean>>(elcon.condition));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Boolean>>(elcon.condition));
 
     {
         auto const & if_true = elcon.if_true->instructions;
         ASSERT_EQ(if_true.size(), 1);
         auto const & val = if_true.front();
-        ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(val));
-        ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(val)->value, 8);
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(val));
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(val)->value, 8);
 
         auto const & if_false = elcon.if_false->instructions;
         ASSERT_EQ(if_false.size(), 0);
     }
 
     auto const & elcon2 = elcon.if_false->condition.value();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Boolean>>(elcon2.condition));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Boolean>>(elcon2.condition));
 
     {
         auto const & if_true = elcon2.if_true->instructions;
         ASSERT_EQ(if_true.size(), 1);
         auto const & val = if_true.front();
-        ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(val));
-        ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(val)->value, 9);
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(val));
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(val)->value, 9);
 
         auto const & if_false = elcon.if_false->instructions;
         ASSERT_EQ(if_false.size(), 0);
@@ -315,32 +317,32 @@ TEST(ast_to_ir, if_elif_else) {
     auto irlist = lower("if true\n 7\nelif false\n8\nelse\n9\nendif\n");
     ASSERT_TRUE(irlist.condition.has_value());
     auto const & con = irlist.condition.value();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Boolean>>(con.condition));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Boolean>>(con.condition));
 
     {
         auto const & if_true = con.if_true->instructions;
         ASSERT_EQ(if_true.size(), 1);
         auto const & val = if_true.front();
-        ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(val));
-        ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(val)->value, 7);
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(val));
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(val)->value, 7);
     }
 
     ASSERT_TRUE(con.if_false->condition.has_value());
     auto const & elcon = con.if_false->condition.value();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Boolean>>(elcon.condition));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Boolean>>(elcon.condition));
 
     {
         auto const & if_true = elcon.if_true->instructions;
         ASSERT_EQ(if_true.size(), 1);
         auto const & val = if_true.front();
-        ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(val));
-        ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(val)->value, 8);
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(val));
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(val)->value, 8);
 
         auto const & if_false = elcon.if_false->instructions;
         ASSERT_EQ(if_false.size(), 1);
         auto const & val2 = if_false.front();
-        ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(val2));
-        ASSERT_EQ(std::get<std::unique_ptr<MIR::Number>>(val2)->value, 9);
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(val2));
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(val2)->value, 9);
     }
 }
 
@@ -348,9 +350,161 @@ TEST(ast_to_ir, assign) {
     auto irlist = lower("a = 5");
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & obj = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Number>>(obj));
-    const auto & ir = std::get<std::unique_ptr<MIR::Number>>(obj);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Number>>(obj));
+    const auto & ir = std::get<MIR::Ptr<MIR::Number>>(obj);
     ASSERT_EQ(ir->value, 5);
     ASSERT_EQ(ir->var.name, "a");
     ASSERT_EQ(ir->var.version, 0);
 }
+
+TEST(ast_to_ir, blocks_in_arena) {
+    auto irlist = lower("if true\n 7\nelse\n8\nendif\n");
+    // One block for each branch, and one for after the branches rejoin
+    ASSERT_EQ(irlist.arena.size(), 3);
+
+    auto const & con = irlist.condition.value();
+    ASSERT_EQ(con.if_true->next, con.if_false->next);
+}
+
+TEST(ast_to_ir, objects_in_arena) {
+    auto lowered = lower("func(['a'], x : {'b' : 'c'})");
+    const auto * resource = lowered.arena.allocator().resource();
+
+    // Moving the program doesn't move what it holds
+    const auto irlist = std::move(lowered);
+    ASSERT_EQ(irlist.arena.allocator().resource(), resource);
+
+    // The arguments, and the elements of what is passed, are all in the arena
+    const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(irlist.instructions.front());
+    ASSERT_EQ(f->pos_args.get_allocator().resource(), resource);
+    ASSERT_EQ(f->kw_args.get_allocator().resource(), resource);
+    const auto & arr = std::get<MIR::Ptr<MIR::Array>>(f->pos_args[0]);
+    ASSERT_EQ(arr->value.get_allocator().resource(), resource);
+    const auto & dict = std::get<MIR::Ptr<MIR::Dict>>(f->kw_args.at("x"));
+    ASSERT_EQ(dict->value.get_allocator().resource(), resource);
+}
+
+TEST(ast_to_ir, foreach) {
+    auto irlist = lower("foreach x : ['a', 'b']\n  func(x)\nendforeach\n");
+    // No break or continue, so everything goes into the one block
+    ASSERT_EQ(irlist.arena.size(), 0);
+    ASSERT_EQ(irlist.instructions.size(), 4);
+
+    auto it = irlist.instructions.begin();
+    for (const auto & v : {"a", "b"}) {
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::String>>(*it));
+        const auto & s = std::get<MIR::Ptr<MIR::String>>(*it);
+        ASSERT_EQ(s->value, v);
+        ASSERT_EQ(s->var.name, "x");
+        ++it;
+
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(*it));
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::FunctionCall>>(*it)->name, "func");
+        ++it;
+    }
+}
+
+TEST(ast_to_ir, foreach_nested) {
+    auto irlist = lower("foreach x : ['a', 'b']\n  foreach y : [1, 2, 3]\n    func(x, y)\n  "
+                        "endforeach\nendforeach\n");
+    // two outer assignments, and three inner assignments and calls for each
+    ASSERT_EQ(irlist.instructions.size(), 2 + 2 * 3 * 2);
+}
+
+TEST(ast_to_ir, foreach_break) {
+    auto irlist = lower("foreach x : ['a', 'b']\n  if x\n    break\n  endif\n  func(x)\n"
+                        "endforeach\nfunc(1)");
+    ASSERT_EQ(irlist.instructions.size(), 1);
+    ASSERT_TRUE(irlist.condition.has_value());
+    const auto & con = irlist.condition.value();
+
+    // The break jumps past every remaining iteration
+    const auto * exit = con.if_true->next;
+    ASSERT_NE(exit, nullptr);
+    ASSERT_EQ(exit->instructions.size(), 1);
+    ASSERT_EQ(exit->next, nullptr);
+
+    // While not breaking calls func(x), and moves on to the next iteration
+    ASSERT_EQ(con.if_false->next->instructions.size(), 1);
+    const auto * second = con.if_false->next->next;
+    ASSERT_EQ(second->instructions.size(), 1);
+    ASSERT_TRUE(second->condition.has_value());
+    ASSERT_EQ(second->condition->if_true->next, exit);
+}
+
+TEST(ast_to_ir, foreach_continue) {
+    auto irlist = lower("foreach x : ['a', 'b']\n  continue\n  func(x)\nendforeach\n");
+    MIR::Passes::simplify_cfg(&irlist);
+
+    // The calls to func are unreachable, so only the assignments are left
+    ASSERT_EQ(irlist.instructions.size(), 2);
+    for (const auto & i : irlist.instructions) {
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::String>>(i));
+    }
+}
+
+TEST(ast_to_ir, foreach_deferred) {
+    auto irlist = lower("foreach x : y\n  func(x)\nendforeach\nfunc(1)");
+    ASSERT_EQ(irlist.instructions.size(), 2);
+
+    // The loop is kept until y is known, with the body lowered once
+    const auto & obj = irlist.instructions.front();
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Foreach>>(obj));
+    const auto & loop = std::get<MIR::Ptr<MIR::Foreach>>(obj);
+    ASSERT_EQ(loop->id, "x");
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Identifier>>(loop->iterable)->value, "y");
+    ASSERT_EQ(loop->body->instructions.size(), 1);
+    ASSERT_EQ(loop->body->next, loop->next);
+}
+
+TEST(ast_to_ir, break_outside_loop) {
+    ASSERT_THROW(lower("break\n"), Util::Exceptions::MesonException);
+}
+
+TEST(ast_to_ir, add_equal_array) {
+    auto irlist = lower("x = ['a']\nx += ['b', 'c']\nx += 'd'\n");
+    ASSERT_EQ(irlist.instructions.size(), 3);
+
+    auto it = irlist.instructions.begin();
+    ASSERT_FALSE(std::get<MIR::Ptr<MIR::Array>>(*it)->base);
+
+    // What adding does isn't decided until both sides are known
+    for (const auto & n : {2, 0}) {
+        ++it;
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::PlusAssignment>>(*it));
+        const auto & add = std::get<MIR::Ptr<MIR::PlusAssignment>>(*it);
+        ASSERT_EQ(add->var.name, "x");
+        ASSERT_EQ(add->base.name, "x");
+        if (n != 0) {
+            ASSERT_EQ(std::get<MIR::Ptr<MIR::Array>>(add->value)->value.size(), n);
+        } else {
+            ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::String>>(add->value));
+        }
+    }
+}
+
+TEST(ast_to_ir, add_equal_in_loop) {
+    auto irlist = lower("x = []\nforeach s : ['a', 'b', 'c']\n  x += s\nendforeach\n");
+    ASSERT_EQ(irlist.instructions.size(), 7);
+
+    for (const auto & i : irlist.instructions) {
+        if (const auto * add = std::get_if<MIR::Ptr<MIR::PlusAssignment>>(&i)) {
+            ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Identifier>>((*add)->value));
+        }
+    }
+}
+
+TEST(ast_to_ir, add_equal_variable) {
+    auto irlist = lower("x = files('a.cpp')\nx += y\n");
+    ASSERT_EQ(irlist.instructions.size(), 2);
+
+    const auto & obj = irlist.instructions.back();
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::PlusAssignment>>(obj));
+    const auto & add = std::get<MIR::Ptr<MIR::PlusAssignment>>(obj);
+    ASSERT_EQ(add->base.name, "x");
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Identifier>>(add->value)->value, "y");
+}
+
+TEST(ast_to_ir, sub_equal) {
+    ASSERT_THROW(lower("x = ['a']\nx -= ['a']\n"), Util::Exceptions::MesonException);
+}
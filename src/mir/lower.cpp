@@ -1,24 +1,80 @@
 // SPDX-license-identifier: Apache-2.0
 // Copyright © 2021 Intel Corporation
 
+#include <algorithm>
+#include <iostream>
+
 #include "lower.hpp"
+#include "exceptions.hpp"
 
 namespace MIR {
 
-void lower(BasicBlock * block, State::Persistant & pstate) {
+void lower(Program * block, State::Persistant & pstate) {
+    // Work the passes have started, that instructions are waiting on
+    Passes::Pending pending{};
+
+    // Everything the passes create is owned by the program
+    auto & arena = block->arena;
+
     bool progress;
-    // clang-format off
     do {
+        report_toolchains(pstate);
+        // clang-format off
         progress = false
-            || Passes::machine_lower(block, pstate.machines)
-            || Passes::insert_compilers(block, pstate.toolchains)
-            || Passes::flatten(block, pstate)
-            || Passes::lower_free_functions(block, pstate)
-            || Passes::branch_pruning(block)
-            || Passes::join_blocks(block)
+            || Passes::value_numbering(block)
+            || Passes::constant_propagation(block, arena)
+            || Passes::unroll_foreach(block, arena)
+            || Passes::machine_lower(block, arena, pstate.machines, pstate.toolchains, pending)
+            || Passes::insert_compilers(block, arena, pstate.toolchains, pending)
+            || Passes::lower_compiler_methods(block, arena, pending)
+            || Passes::flatten(block, arena, pstate)
+            || Passes::lower_free_functions(block, arena, pstate, pending)
+            || Passes::simplify_cfg(block)
             ;
+        // clang-format on
+
+        // Nothing else can be done until some of that work is finished. Only
+        // the instructions waiting on it can be lowered any further, so the
+        // rest aren't walked again until one of them has changed.
+        while (!progress && pending.wait()) {
+            report_toolchains(pstate);
+            // clang-format off
+            progress = false
+                || Passes::machine_lower(block, arena, pstate.machines, pstate.toolchains, pending)
+                || Passes::insert_compilers(block, arena, pstate.toolchains, pending)
+                || Passes::lower_compiler_methods(block, arena, pending)
+                || Passes::lower_free_functions(block, arena, pstate, pending)
+                ;
+            // clang-format on
+        }
+        pending.resume_all();
     } while (progress);
-    // clang-format on
+    report_toolchains(pstate);
+
+    // Anything left in the first block is always run, so a loop there must
+    // be known by now
+    for (const auto & i : block->instructions) {
+        if (std::holds_alternative<Ptr<Foreach>>(i)) {
+            throw Util::Exceptions::MesonException{
+                "Could not determine what foreach iterates over"};
+        }
+    }
+}
+
+void report_toolchains(State::Persistant & pstate) {
+    std::vector<Toolchain::Language> langs{};
+    for (const auto & [l, _] : pstate.toolchains) {
+        langs.emplace_back(l);
+    }
+    std::sort(langs.begin(), langs.end());
+
+    // TODO: report the host toolchains as well, once they can differ
+    for (const auto & l : langs) {
+        const auto & tc = pstate.toolchains.at(l).build();
+        if (tc != nullptr) {
+            tc->report(std::cout);
+        }
+    }
 }
 
 } // namespace MIR
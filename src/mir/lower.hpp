@@ -8,12 +8,26 @@
 
 #pragma once
 
+#include "node.hpp"
 #include "passes.hpp"
 #include "state/state.hpp"
 
 namespace MIR {
 
-void lower(BasicBlock *, State::Persistant &);
+/**
+ * Run the lowering passes until none of them can make any progress
+ *
+ * Takes the whole program, as unrolling loops creates new blocks in its arena.
+ */
+void lower(Program *, State::Persistant &);
+
+/**
+ * Print the tools that have been found since the last time this was called
+ *
+ * Tools are found on whichever thread needs them first, this prints them from
+ * the calling thread, one language at a time.
+ */
+void report_toolchains(State::Persistant &);
 
 namespace Passes {
 
@@ -26,6 +40,17 @@ namespace Passes {
  */
 void lower_project(BasicBlock * block, State::Persistant & pstate);
 
+/**
+ * Start finding the compilers for a project() call in the background
+ *
+ * This is meant to be called with the first statement of the root meson.build
+ * as soon as it is parsed, so that detection overlaps with parsing the rest of
+ * the tree. lower_project uses the same toolchains, and waits for detection
+ * only when a compiler is actually needed. Anything that isn't a valid
+ * project() call is ignored here, and reported by lower_project.
+ */
+void speculate_project(const Frontend::AST::StatementV & stmt, State::Persistant & pstate);
+
 } // namespace Passes
 
 } // namespace MIR
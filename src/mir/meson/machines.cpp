@@ -56,6 +56,18 @@ std::string detect_cpu_family() {
 
 } // namespace
 
+std::string to_string(const Machine & m) {
+    switch (m) {
+        case Machine::BUILD:
+            return "build";
+        case Machine::HOST:
+            return "host";
+        case Machine::TARGET:
+            return "target";
+    }
+    assert(false);
+}
+
 Info detect_build() {
     return Info{Machine::BUILD, detect_kernel(), detect_endian(), detect_cpu_family()};
 }
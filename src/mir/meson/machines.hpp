@@ -49,11 +49,11 @@ class Info {
 
     const std::string system() const;
 
-    const Machine machine;
-    const Kernel kernel;
-    const Endian endian;
-    const std::string cpu_family;
-    const std::string cpu;
+    Machine machine;
+    Kernel kernel;
+    Endian endian;
+    std::string cpu_family;
+    std::string cpu;
 };
 
 template <typename T> class PerMachine {
@@ -120,6 +120,9 @@ template <typename T> class PerMachine {
     std::optional<T> _target;
 };
 
+/// The name of a machine, as used in messages and the DSL
+std::string to_string(const Machine &);
+
 /**
  * Detect the build machine.
  *
@@ -71,6 +71,9 @@ class BuildTarget {
     /// Which machine is this executable to be built for?
     const Machines::Machine machine;
 
+    /// The directory it was defined in, relative to the source root
+    const fs::path subdir;
+
     /**
      * Arguments for the target, sorted by langauge
      *
@@ -79,10 +82,18 @@ class BuildTarget {
      */
     const ArgMap arguments;
 
+    /**
+     * The pool this target's sources are compiled in, or empty for the default
+     *
+     * Only compiles are affected, links always run in the link pool.
+     */
+    const std::string pool;
+
   protected:
     BuildTarget(const std::string & name_, const std::vector<File> & srcs,
-                const Machines::Machine & m, const ArgMap & args)
-        : name{name_}, sources{srcs}, machine{m}, arguments{args} {};
+                const Machines::Machine & m, const fs::path & sdir, const ArgMap & args,
+                const std::string & pool_)
+        : name{name_}, sources{srcs}, machine{m}, subdir{sdir}, arguments{args}, pool{pool_} {};
 };
 
 /**
@@ -91,8 +102,9 @@ class BuildTarget {
 class Executable : public BuildTarget {
   public:
     Executable(const std::string & name_, const std::vector<File> & srcs,
-               const Machines::Machine & m, const ArgMap & args)
-        : BuildTarget{name_, srcs, m, args} {};
+               const Machines::Machine & m, const fs::path & sdir, const ArgMap & args,
+               const std::string & pool_ = "")
+        : BuildTarget{name_, srcs, m, sdir, args, pool_} {};
 };
 
 /**
@@ -101,8 +113,9 @@ class Executable : public BuildTarget {
 class StaticLibrary : public BuildTarget {
   public:
     StaticLibrary(const std::string & name_, const std::vector<File> & srcs,
-                  const Machines::Machine & m, const ArgMap & args)
-        : BuildTarget{name_, srcs, m, args} {};
+                  const Machines::Machine & m, const fs::path & sdir, const ArgMap & args,
+                  const std::string & pool_ = "")
+        : BuildTarget{name_, srcs, m, sdir, args, pool_} {};
 };
 
 } // namespace MIR::Objects
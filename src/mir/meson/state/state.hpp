@@ -4,9 +4,13 @@
 #pragma once
 
 #include <filesystem>
+#include <future>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "machines.hpp"
+#include "toolchains/cache.hpp"
 #include "toolchains/toolchain.hpp"
 
 namespace MIR::State {
@@ -19,15 +23,27 @@ namespace MIR::State {
 class Persistant {
   public:
     Persistant(const std::filesystem::path & sr_, const std::filesystem::path & br_)
-        : toolchains{}, machines{Machines::detect_build()}, source_root{sr_}, build_root{br_} {};
+        : toolchain_cache{br_}, toolchains{}, speculative{}, machines{Machines::detect_build()},
+          source_root{sr_}, build_root{br_}, options{}, build_files{} {};
     ~Persistant(){};
 
+    /// Tools found by previous configurations, which must outlive the toolchains
+    Toolchain::Cache toolchain_cache;
+
     // This must be mutable because of `add_language`
     /// A mapping of language : machine : toolchain
     std::unordered_map<Toolchain::Language,
                        Machines::PerMachine<std::shared_ptr<Toolchain::Toolchain>>>
         toolchains;
 
+    /**
+     * Detection started before it was needed, waited for on destruction
+     *
+     * These never hold an error, a failed detection is reported to whatever
+     * asks for the tool next.
+     */
+    std::vector<std::future<void>> speculative;
+
     /// The information on each machine
     /// XXX: currently only handle host == build configurations, as we don't have
     /// a machine file
@@ -41,6 +57,17 @@ class Persistant {
 
     /// The name of the project
     std::string name;
+
+    /// Options set on the command line with -D, as option : value
+    std::unordered_map<std::string, std::string> options;
+
+    /**
+     * The files the configuration was read from
+     *
+     * Such as every meson.build file, if any of them change the build
+     * directory needs to be configured again.
+     */
+    std::vector<std::filesystem::path> build_files;
 };
 
 } // namespace MIR::State
@@ -61,4 +61,7 @@ class Gnu : public Archiver {
 std::unique_ptr<Archiver> detect_archiver(const Machines::Machine &,
                                           const std::vector<std::string> & bins = {});
 
+/// The binaries detect_archiver tries, in order, when none are given
+const std::vector<std::string> & default_binaries();
+
 } // namespace MIR::Toolchain::Archiver
@@ -0,0 +1,356 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <charconv>
+#include <cstdlib>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "compilers/cpp/cpp.hpp"
+#include "exceptions.hpp"
+#include "files.hpp"
+
+namespace MIR::Toolchain {
+
+namespace {
+
+/// Change this whenever the format changes, so old caches are ignored
+const std::string HEADER = "meson++ toolchain cache 6";
+
+/// Find a binary in the path, the same way that execvp does
+std::filesystem::path find_program(const std::string & name, const std::string & path) {
+    if (name.find('/') != std::string::npos) {
+        return name;
+    }
+
+    std::string::size_type start = 0;
+    while (start <= path.size()) {
+        auto end = path.find(':', start);
+        if (end == std::string::npos) {
+            end = path.size();
+        }
+        std::filesystem::path dir = path.substr(start, end - start);
+        if (dir.empty()) {
+            dir = ".";
+        }
+        const auto candidate = dir / name;
+        if (access(candidate.c_str(), X_OK) == 0) {
+            return candidate;
+        }
+        start = end + 1;
+    }
+
+    return {};
+}
+
+/**
+ * The environment variables that can change what detection finds
+ *
+ * This is those that pick the tools and their arguments, and those that the
+ * compiler reads to find the rest of the toolchain, such as its linker.
+ */
+std::vector<std::string> environment(const Language & lang) {
+    std::vector<std::string> vars{"PATH",          "AR",
+                                  "CPPFLAGS",      "LDFLAGS",
+                                  "COMPILER_PATH", "GCC_EXEC_PREFIX",
+                                  "LIBRARY_PATH"};
+    switch (lang) {
+        case Language::CPP:
+            vars.insert(vars.end(), {"CXX", "CXXFLAGS", "CXX_LD"});
+            break;
+    }
+    return vars;
+}
+
+/**
+ * Describe everything detection depends on
+ *
+ * Each candidate is described by what it resolves to, so that installing,
+ * removing, or upgrading any of them changes the key, even one that wasn't
+ * picked last time.
+ */
+std::vector<std::string> make_key(const Language & lang) {
+    std::vector<std::string> key{};
+    for (const auto & var : environment(lang)) {
+        // An empty variable and an unset one are treated differently by some tools
+        const char * env = std::getenv(var.c_str());
+        if (env == nullptr) {
+            key.emplace_back(var);
+            continue;
+        }
+        // Each part of the key is stored on its own line
+        std::string value = env;
+        for (auto pos = value.find('\n'); pos != std::string::npos; pos = value.find('\n', pos)) {
+            value.replace(pos, 1, "\\n");
+        }
+        key.emplace_back(var + "=" + value);
+    }
+
+    const char * env = std::getenv("PATH");
+    const std::string path = env != nullptr ? env : "";
+
+    std::vector<std::string> bins = Compiler::default_binaries(lang);
+    const auto & archivers = Archiver::default_binaries();
+    bins.insert(bins.end(), archivers.begin(), archivers.end());
+    // The compiler finds the linker itself, but this catches it being upgraded
+    bins.emplace_back("ld");
+
+    for (const auto & b : bins) {
+        std::string desc = b;
+
+        std::error_code ec;
+        const auto found = find_program(b, path);
+        const auto resolved = found.empty() ? found : std::filesystem::canonical(found, ec);
+
+        struct stat st;
+        if (!resolved.empty() && !ec && stat(resolved.c_str(), &st) == 0) {
+            desc += " " + resolved.string() + " " + std::to_string(st.st_ino) + " " +
+                    std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec) +
+                    " " + std::to_string(st.st_size);
+        } else {
+            desc += " (not found)";
+        }
+        key.emplace_back(desc);
+    }
+
+    return key;
+}
+
+std::vector<std::string> identity_to_list(const Compiler::Identity & ident) {
+    return {
+        ident.id,
+        ident.version,
+        ident.cpu_family,
+        ident.kernel == Machines::Kernel::LINUX ? "linux" : "",
+        ident.endian == Machines::Endian::LITTLE ? "little" : "big",
+        std::to_string(ident.pointer_size),
+        ident.default_std,
+    };
+}
+
+/// Is this a version made of numbers separated by dots, such as 11.2.0?
+bool is_version(const std::string & ver) {
+    const char * ptr = ver.data();
+    const char * const last = ver.data() + ver.size();
+    while (true) {
+        unsigned number;
+        const auto [end, ec] = std::from_chars(ptr, last, number);
+        if (ec != std::errc{}) {
+            return false;
+        }
+        if (end == last) {
+            return true;
+        }
+        if (*end != '.') {
+            return false;
+        }
+        ptr = end + 1;
+    }
+}
+
+/// Returns std::nullopt if the cache is damaged, so the compiler is found again
+std::optional<Compiler::Identity> identity_from_list(const std::vector<std::string> & list) {
+    if (list.size() != 7 || list[0].empty() || !is_version(list[1]) || list[3] != "linux" ||
+        (list[4] != "little" && list[4] != "big")) {
+        return std::nullopt;
+    }
+
+    unsigned pointer_size;
+    const auto & ptr = list[5];
+    const auto [end, ec] = std::from_chars(ptr.data(), ptr.data() + ptr.size(), pointer_size);
+    if (ec != std::errc{} || end != ptr.data() + ptr.size()) {
+        return std::nullopt;
+    }
+
+    Compiler::Identity ident{};
+    ident.id = list[0];
+    ident.version = list[1];
+    ident.cpu_family = list[2];
+    ident.kernel = Machines::Kernel::LINUX;
+    ident.endian = list[4] == "little" ? Machines::Endian::LITTLE : Machines::Endian::BIG;
+    ident.pointer_size = pointer_size;
+    ident.default_std = list[6];
+    return ident;
+}
+
+void write_list(std::ostream & out, const std::vector<std::string> & list) {
+    out << list.size() << "\n";
+    for (const auto & l : list) {
+        out << l << "\n";
+    }
+}
+
+bool read_list(std::istream & in, std::vector<std::string> & list) {
+    std::size_t size;
+    in >> size;
+    in.ignore();
+    for (std::size_t i = 0; i < size && in; ++i) {
+        std::getline(in, list.emplace_back());
+    }
+    return static_cast<bool>(in);
+}
+
+} // namespace
+
+Cache::Cache(const std::filesystem::path & build_root)
+    : file{build_root / "meson-private" / "toolchains.cache"}, entries{}, dirty{false}, lock{} {
+    load();
+};
+
+void Cache::load() {
+    std::ifstream in{file};
+    std::string line;
+    if (!std::getline(in, line) || line != HEADER) {
+        return;
+    }
+
+    std::string name;
+    while (std::getline(in, name)) {
+        Entry e{};
+        std::getline(in, e.compiler);
+        std::getline(in, e.linker);
+        std::getline(in, e.archiver);
+        if (!read_list(in, e.key) || !read_list(in, e.compiler_command) ||
+            !read_list(in, e.identity) || !read_list(in, e.linker_command) ||
+            !read_list(in, e.archiver_command)) {
+            // The cache is damaged, so don't trust any of it
+            entries.clear();
+            return;
+        }
+        entries[name] = std::move(e);
+    }
+}
+
+void Cache::save() const {
+    std::lock_guard l{lock};
+    if (!dirty) {
+        return;
+    }
+
+    std::stringstream out{};
+    out << HEADER << "\n";
+    for (const auto & [name, e] : entries) {
+        out << name << "\n" << e.compiler << "\n" << e.linker << "\n" << e.archiver << "\n";
+        write_list(out, e.key);
+        write_list(out, e.compiler_command);
+        write_list(out, e.identity);
+        write_list(out, e.linker_command);
+        write_list(out, e.archiver_command);
+    }
+
+    try {
+        Util::write_if_changed(file, out.str());
+    } catch (Util::Exceptions::MesonException &) {
+        // The cache is only an optimization, so failing to write it isn't an error
+    }
+}
+
+std::shared_ptr<Toolchain> Cache::get(const Language & lang, const Machines::Machine & machine) {
+    const auto name = to_string(lang) + ":" + Machines::to_string(machine);
+    auto key = make_key(lang);
+
+    {
+        std::lock_guard l{lock};
+        auto & e = entries[name];
+        if (e.key != key) {
+            // Something has changed, so nothing in the entry can be trusted
+            e = Entry{std::move(key)};
+            dirty = true;
+        }
+    }
+
+    return std::make_shared<Toolchain>(
+        lang, machine,
+        Toolchain::Detectors{
+            [this, lang, machine, name]() { return compiler(lang, machine, name); },
+            [this, machine, name](const std::unique_ptr<Compiler::Compiler> & c) {
+                return linker(c, machine, name);
+            },
+            [this, machine, name]() { return archiver(machine, name); },
+        });
+}
+
+std::unique_ptr<Compiler::Compiler> Cache::compiler(const Language & lang,
+                                                    const Machines::Machine & machine,
+                                                    const std::string & name) {
+    {
+        std::lock_guard l{lock};
+        const auto & e = entries.at(name);
+        const auto ident = identity_from_list(e.identity);
+        if (ident) {
+            switch (lang) {
+                case Language::CPP:
+                    if (e.compiler == "gcc") {
+                        return std::make_unique<Compiler::CPP::Gnu>(e.compiler_command,
+                                                                    ident.value());
+                    } else if (e.compiler == "clang") {
+                        return std::make_unique<Compiler::CPP::Clang>(e.compiler_command,
+                                                                      ident.value());
+                    }
+                    break;
+            }
+        }
+    }
+
+    auto comp = Compiler::detect_compiler(lang, machine);
+    if (comp != nullptr) {
+        std::lock_guard l{lock};
+        auto & e = entries.at(name);
+        e.compiler = comp->id();
+        e.compiler_command = comp->command;
+        e.identity = identity_to_list(comp->identity);
+        dirty = true;
+    }
+    return comp;
+}
+
+std::unique_ptr<Linker::Linker> Cache::linker(const std::unique_ptr<Compiler::Compiler> & comp,
+                                              const Machines::Machine & machine,
+                                              const std::string & name) {
+    {
+        std::lock_guard l{lock};
+        const auto & e = entries.at(name);
+        // The linker is run through the compiler, so it has to be the same one
+        if (e.linker == "ld.bfd" && e.linker_command == comp->command) {
+            return std::make_unique<Linker::Drivers::Gnu>(Linker::GnuBFD{e.linker_command},
+                                                          comp.get());
+        }
+    }
+
+    auto link = Linker::detect_linker(comp, machine);
+    if (link != nullptr) {
+        std::lock_guard l{lock};
+        auto & e = entries.at(name);
+        e.linker = link->id();
+        e.linker_command = link->command();
+        dirty = true;
+    }
+    return link;
+}
+
+std::unique_ptr<Archiver::Archiver> Cache::archiver(const Machines::Machine & machine,
+                                                    const std::string & name) {
+    {
+        std::lock_guard l{lock};
+        const auto & e = entries.at(name);
+        if (e.archiver == "gnu") {
+            return std::make_unique<Archiver::Gnu>(e.archiver_command);
+        }
+    }
+
+    auto ar = Archiver::detect_archiver(machine);
+    if (ar != nullptr) {
+        std::lock_guard l{lock};
+        auto & e = entries.at(name);
+        e.archiver = ar->id();
+        e.archiver_command = ar->command();
+        dirty = true;
+    }
+    return ar;
+}
+
+} // namespace MIR::Toolchain
@@ -0,0 +1,84 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+/* A cache of detected toolchains, stored in the build directory
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common.hpp"
+#include "machines.hpp"
+#include "toolchain.hpp"
+
+namespace MIR::Toolchain {
+
+/**
+ * Toolchains detected by a previous configuration
+ *
+ * Detecting a toolchain runs each candidate binary at least once. Instead the
+ * result is stored along with the resolved path, inode, modification time, and
+ * size of each candidate binary, and the environment variables that affect
+ * detection, such as PATH, CXX, and CXXFLAGS. As long as none of those have
+ * changed, reconfiguring rebuilds the toolchain from the cache without running
+ * anything.
+ *
+ * Each tool is stored separately, as toolchains only find the tools that are
+ * used. The cache must outlive the toolchains it creates.
+ */
+class Cache {
+  public:
+    Cache(const std::filesystem::path & build_root);
+    ~Cache(){};
+
+    /**
+     * Get a toolchain whose tools come from the cache when it is still valid,
+     * and are otherwise detected
+     */
+    std::shared_ptr<Toolchain> get(const Language &, const Machines::Machine &);
+
+    /// Write the cache back to the build directory, if anything has changed
+    void save() const;
+
+  private:
+    /// What is needed to recreate each detected tool, empty if it hasn't been
+    struct Entry {
+        std::vector<std::string> key;
+        std::string compiler;
+        std::vector<std::string> compiler_command;
+        std::vector<std::string> identity;
+        std::string linker;
+        std::vector<std::string> linker_command;
+        std::string archiver;
+        std::vector<std::string> archiver_command;
+    };
+
+    void load();
+
+    std::unique_ptr<Compiler::Compiler> compiler(const Language &, const Machines::Machine &,
+                                                 const std::string & name);
+    std::unique_ptr<Linker::Linker> linker(const std::unique_ptr<Compiler::Compiler> &,
+                                           const Machines::Machine &, const std::string & name);
+    std::unique_ptr<Archiver::Archiver> archiver(const Machines::Machine &,
+                                                 const std::string & name);
+
+    /// Where the cache is stored
+    const std::filesystem::path file;
+
+    /// Entries by language and machine
+    std::unordered_map<std::string, Entry> entries;
+
+    /// Whether there are any entries that have not been saved
+    bool dirty;
+
+    /// Tools are found on demand, which may be from multiple threads
+    mutable std::mutex lock;
+};
+
+} // namespace MIR::Toolchain
@@ -0,0 +1,189 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "cache.hpp"
+
+namespace {
+
+std::filesystem::path make_build_dir() {
+    std::string templ = std::filesystem::temp_directory_path() / "meson++-cache-XXXXXX";
+    return mkdtemp(templ.data());
+}
+
+std::string read(const std::filesystem::path & p) {
+    std::ifstream in{p};
+    std::stringstream ss{};
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+} // namespace
+
+TEST(toolchain_cache, reused) {
+    // Skip if we don't have g++ or ld.bfd
+    if (system("g++") == 127 || system("ld.bfd") == 127) {
+        GTEST_SKIP();
+    }
+    const auto build_dir = make_build_dir();
+    const auto file = build_dir / "meson-private" / "toolchains.cache";
+
+    std::string bin{};
+    {
+        MIR::Toolchain::Cache cache{build_dir};
+        const auto tc = cache.get(MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD);
+        bin = tc->compiler()->command.front();
+        (void)tc->linker();
+        (void)tc->archiver();
+        cache.save();
+    }
+    ASSERT_TRUE(std::filesystem::exists(file));
+
+    // Change the stored commands of the compiler and the linker it drives, if
+    // the cache is used this is what we'll get back, if detection is run
+    // again it won't be.
+    auto contents = read(file);
+    auto pos = contents.find("\n" + bin + "\n");
+    ASSERT_NE(pos, std::string::npos);
+    while (pos != std::string::npos) {
+        contents.replace(pos, bin.size() + 2, "\nfrom-the-cache\n");
+        pos = contents.find("\n" + bin + "\n");
+    }
+    std::ofstream{file} << contents;
+
+    MIR::Toolchain::Cache cache{build_dir};
+    const auto tc = cache.get(MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD);
+    ASSERT_EQ(tc->compiler()->command, std::vector<std::string>{"from-the-cache"});
+    ASSERT_EQ(tc->linker()->id(), "ld.bfd");
+    ASSERT_EQ(tc->linker()->command(), std::vector<std::string>{"from-the-cache"});
+    ASSERT_EQ(tc->archiver()->id(), "gnu");
+
+    std::filesystem::remove_all(build_dir);
+}
+
+TEST(toolchain_cache, environment_changed) {
+    // Skip if we don't have g++
+    if (system("g++") == 127) {
+        GTEST_SKIP();
+    }
+    const auto build_dir = make_build_dir();
+    const auto file = build_dir / "meson-private" / "toolchains.cache";
+    const char * old = std::getenv("CXXFLAGS");
+    const std::string saved = old != nullptr ? old : "";
+
+    setenv("CXXFLAGS", "-O1", 1);
+    std::string bin{};
+    {
+        MIR::Toolchain::Cache cache{build_dir};
+        const auto tc = cache.get(MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD);
+        bin = tc->compiler()->command.front();
+        cache.save();
+    }
+
+    // Change the command, as in the reused test, then change the flags
+    auto contents = read(file);
+    const auto pos = contents.find("\n" + bin + "\n");
+    ASSERT_NE(pos, std::string::npos);
+    contents.replace(pos, bin.size() + 2, "\nfrom-the-cache\n");
+    std::ofstream{file} << contents;
+    setenv("CXXFLAGS", "-O2", 1);
+
+    // The compiler is found again, rather than coming from the cache
+    MIR::Toolchain::Cache cache{build_dir};
+    const auto tc = cache.get(MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD);
+    const auto command = tc->compiler()->command;
+
+    if (old != nullptr) {
+        setenv("CXXFLAGS", saved.c_str(), 1);
+    } else {
+        unsetenv("CXXFLAGS");
+    }
+    ASSERT_EQ(command.front(), bin);
+
+    std::filesystem::remove_all(build_dir);
+}
+
+TEST(toolchain_cache, damaged) {
+    // Skip if we don't have g++ or ld.bfd
+    if (system("g++") == 127 || system("ld.bfd") == 127) {
+        GTEST_SKIP();
+    }
+    const auto build_dir = make_build_dir();
+    std::filesystem::create_directories(build_dir / "meson-private");
+    std::ofstream{build_dir / "meson-private" / "toolchains.cache"}
+        << "meson++ toolchain cache 6\ncpp:build\ngcc\n";
+
+    MIR::Toolchain::Cache cache{build_dir};
+    const auto tc = cache.get(MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD);
+    ASSERT_NE(tc->compiler()->command.front(), "");
+
+    std::filesystem::remove_all(build_dir);
+}
+
+TEST(toolchain_cache, garbled_identity) {
+    // Skip if we don't have g++
+    if (system("g++") == 127) {
+        GTEST_SKIP();
+    }
+    const auto build_dir = make_build_dir();
+    const auto file = build_dir / "meson-private" / "toolchains.cache";
+
+    std::string bin{}, version{};
+    {
+        MIR::Toolchain::Cache cache{build_dir};
+        const auto tc = cache.get(MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD);
+        bin = tc->compiler()->command.front();
+        version = tc->compiler()->identity.version;
+        cache.save();
+    }
+
+    // Change the command, as in the reused test, and damage the version
+    auto contents = read(file);
+    auto pos = contents.find("\n" + bin + "\n");
+    ASSERT_NE(pos, std::string::npos);
+    contents.replace(pos, bin.size() + 2, "\nfrom-the-cache\n");
+    pos = contents.find("\n" + version + "\n");
+    ASSERT_NE(pos, std::string::npos);
+    contents.replace(pos, version.size() + 2, "\nnot a number\n");
+    std::ofstream{file} << contents;
+
+    // The damaged entry is ignored, and the compiler is found again
+    MIR::Toolchain::Cache cache{build_dir};
+    const auto tc = cache.get(MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD);
+    ASSERT_EQ(tc->compiler()->command.front(), bin);
+
+    std::filesystem::remove_all(build_dir);
+}
+
+TEST(toolchain_cache, only_used_tools) {
+    // Skip if we don't have g++
+    if (system("g++") == 127) {
+        GTEST_SKIP();
+    }
+    const auto build_dir = make_build_dir();
+    {
+        MIR::Toolchain::Cache cache{build_dir};
+        const auto tc = cache.get(MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD);
+        (void)tc->compiler();
+        cache.save();
+    }
+
+    // Neither the linker nor the archiver were needed, so neither were found
+    std::ifstream in{build_dir / "meson-private" / "toolchains.cache"};
+    std::string header, name, compiler, linker, archiver;
+    std::getline(in, header);
+    std::getline(in, name);
+    std::getline(in, compiler);
+    std::getline(in, linker);
+    std::getline(in, archiver);
+    ASSERT_EQ(name, "cpp:build");
+    ASSERT_NE(compiler, "");
+    ASSERT_EQ(linker, "");
+    ASSERT_EQ(archiver, "");
+
+    std::filesystem::remove_all(build_dir);
+}
@@ -0,0 +1,353 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <future>
+#include <regex>
+#include <unistd.h>
+
+#include "checks.hpp"
+#include "exceptions.hpp"
+#include "process.hpp"
+
+namespace MIR::Toolchain {
+
+namespace {
+
+/// Checks of large headers can be slow, so be more patient than usual
+constexpr std::chrono::milliseconds CHECK_TIMEOUT{30000};
+
+/// Stay below the number of errors a compiler reports before giving up
+constexpr std::size_t SIZE_BATCH = 16;
+
+/// A program that every compiler can build
+const std::string TRIVIAL = "int main(void) { return 0; }\n";
+
+std::vector<std::string> base_command(const Compiler::Compiler & comp,
+                                      const std::vector<std::string> & args) {
+    auto cmd = comp.command;
+    const auto always = comp.always_args();
+    cmd.insert(cmd.end(), always.begin(), always.end());
+    cmd.insert(cmd.end(), args.begin(), args.end());
+    return cmd;
+}
+
+void extend(std::vector<std::string> & cmd, const std::vector<std::string> & more) {
+    cmd.insert(cmd.end(), more.begin(), more.end());
+}
+
+std::future<Util::Result> submit(const std::vector<std::string> & cmd) {
+    return Util::process_pool().submit(cmd, CHECK_TIMEOUT);
+}
+
+/// The part of a cache key shared by every check in one call
+std::string make_key(const std::string & kind, const std::string & prefix,
+                     const std::vector<std::string> & args) {
+    std::string key = kind + "\n" + prefix + "\n";
+    for (const auto & a : args) {
+        key += a + " ";
+    }
+    return key + "\n";
+}
+
+/**
+ * The argument to test in place of the one asked about
+ *
+ * GCC silently accepts -Wno-foo for any foo, so check for -Wfoo instead.
+ */
+std::string argument_to_test(const std::string & arg) {
+    if (arg.compare(0, 5, "-Wno-") == 0) {
+        return "-W" + arg.substr(5);
+    }
+    return arg;
+}
+
+} // namespace
+
+Checker::Checker(const Compiler::Compiler & c)
+    : compiler{c}, scratch{}, scratch_once{}, counter{0}, results{}, results_lock{} {};
+
+Checker::~Checker() {
+    if (!scratch.empty()) {
+        std::error_code ec;
+        std::filesystem::remove_all(scratch, ec);
+    }
+};
+
+std::filesystem::path Checker::write_source(const std::string & code) {
+    std::call_once(scratch_once, [this]() {
+        std::error_code ec;
+        std::filesystem::path base = "/dev/shm";
+        if (!std::filesystem::is_directory(base, ec) || access(base.c_str(), W_OK) != 0) {
+            base = std::filesystem::temp_directory_path();
+        }
+        std::string templ = base / "meson++-checks-XXXXXX";
+        if (mkdtemp(templ.data()) == nullptr) {
+            throw Util::Exceptions::MesonException{
+                "Could not create a scratch directory for compiler checks"};
+        }
+        scratch = templ;
+    });
+
+    const auto path = scratch / ("check" + std::to_string(counter++) + ".cpp");
+    std::ofstream{path} << code;
+    return path;
+}
+
+bool Checker::lookup(const std::string & key, int64_t & value) {
+    std::lock_guard l{results_lock};
+    const auto found = results.find(key);
+    if (found == results.end()) {
+        return false;
+    }
+    value = found->second;
+    return true;
+}
+
+void Checker::store(const std::string & key, const int64_t & value) {
+    std::lock_guard l{results_lock};
+    results[key] = value;
+}
+
+bool Checker::has_results(const std::string & kind, const std::vector<std::string> & what,
+                          const std::string & prefix, const std::vector<std::string> & args) {
+    const auto key = make_key(kind, prefix, args);
+    std::lock_guard l{results_lock};
+    return std::all_of(what.begin(), what.end(), [&](const std::string & w) {
+        return results.find(key + w) != results.end();
+    });
+}
+
+std::vector<bool> Checker::has_headers(const std::vector<std::string> & headers,
+                                       const std::string & prefix,
+                                       const std::vector<std::string> & args) {
+    const auto key = make_key("has_header", prefix, args);
+
+    std::vector<bool> found(headers.size(), false);
+    std::vector<std::size_t> unknown{};
+    for (std::size_t i = 0; i < headers.size(); ++i) {
+        int64_t v;
+        if (lookup(key + headers[i], v)) {
+            found[i] = v != 0;
+        } else {
+            unknown.emplace_back(i);
+        }
+    }
+
+    // Every header is checked with __has_include in the same file, and each
+    // one that is missing produces an error naming it. Anything that fails
+    // without naming a header is checked again without the missing ones.
+    auto pending = unknown;
+    while (!pending.empty()) {
+        std::string code = prefix + "\n";
+        for (const auto & i : pending) {
+            code += "#if !__has_include(<" + headers[i] + ">)\n#error \"meson-missing-header " +
+                    std::to_string(i) + "\"\n#endif\n";
+        }
+        const auto src = write_source(code);
+
+        auto cmd = base_command(compiler, args);
+        extend(cmd, compiler.preprocess_only_command());
+        extend(cmd, compiler.output_command("/dev/null"));
+        cmd.emplace_back(src);
+
+        const auto & [ret, out, err] = submit(cmd).get();
+        std::filesystem::remove(src);
+
+        if (ret == 0) {
+            for (const auto & i : pending) {
+                found[i] = true;
+            }
+            break;
+        }
+
+        std::vector<std::size_t> next{};
+        for (const auto & i : pending) {
+            if (err.find("\"meson-missing-header " + std::to_string(i) + "\"") ==
+                std::string::npos) {
+                next.emplace_back(i);
+            }
+        }
+        // If no header was missing, the failure was something else, and none
+        // of the remaining headers are usable
+        if (next.size() == pending.size()) {
+            break;
+        }
+        pending = std::move(next);
+    }
+
+    for (const auto & i : unknown) {
+        store(key + headers[i], found[i]);
+    }
+    return found;
+}
+
+std::vector<bool> Checker::has_arguments(const std::vector<std::string> & arguments) {
+    const auto key = make_key("has_argument", "", {});
+
+    std::vector<bool> found(arguments.size(), false);
+    std::vector<std::size_t> unknown{};
+    for (std::size_t i = 0; i < arguments.size(); ++i) {
+        int64_t v;
+        if (lookup(key + arguments[i], v)) {
+            found[i] = v != 0;
+        } else {
+            unknown.emplace_back(i);
+        }
+    }
+    if (unknown.empty()) {
+        return found;
+    }
+
+    const auto src = write_source(TRIVIAL);
+
+    // Try every argument at once, and split any set that fails in half until
+    // the unsupported arguments are found. Each round runs all of its
+    // compiles at the same time.
+    std::vector<std::pair<std::size_t, std::size_t>> ranges{{0, unknown.size()}};
+    while (!ranges.empty()) {
+        std::vector<std::future<Util::Result>> running{};
+        for (const auto & [begin, end] : ranges) {
+            auto cmd = base_command(compiler, compiler.unknown_argument_errors());
+            for (auto i = begin; i < end; ++i) {
+                cmd.emplace_back(argument_to_test(arguments[unknown[i]]));
+            }
+            extend(cmd, compiler.compile_only_command());
+            extend(cmd, compiler.output_command("/dev/null"));
+            cmd.emplace_back(src);
+            running.emplace_back(submit(cmd));
+        }
+
+        std::vector<std::pair<std::size_t, std::size_t>> next{};
+        for (std::size_t r = 0; r < ranges.size(); ++r) {
+            const auto & [begin, end] = ranges[r];
+            const auto & [ret, out, err] = running[r].get();
+            if (ret == 0) {
+                for (auto i = begin; i < end; ++i) {
+                    found[unknown[i]] = true;
+                }
+            } else if (end - begin > 1) {
+                const auto mid = begin + (end - begin) / 2;
+                next.emplace_back(begin, mid);
+                next.emplace_back(mid, end);
+            }
+        }
+        ranges = std::move(next);
+    }
+
+    std::filesystem::remove(src);
+
+    for (const auto & i : unknown) {
+        store(key + arguments[i], found[i]);
+    }
+    return found;
+}
+
+bool Checker::compiles(const std::string & code, const std::vector<std::string> & args) {
+    const auto key = make_key("compiles", "", args) + code;
+    int64_t v;
+    if (lookup(key, v)) {
+        return v != 0;
+    }
+
+    const auto src = write_source(code);
+    auto cmd = base_command(compiler, args);
+    extend(cmd, compiler.compile_only_command());
+    extend(cmd, compiler.output_command("/dev/null"));
+    cmd.emplace_back(src);
+
+    const auto & [ret, out, err] = submit(cmd).get();
+    std::filesystem::remove(src);
+
+    store(key, ret == 0);
+    return ret == 0;
+}
+
+bool Checker::links(const std::string & code, const std::vector<std::string> & args) {
+    const auto key = make_key("links", "", args) + code;
+    int64_t v;
+    if (lookup(key, v)) {
+        return v != 0;
+    }
+
+    const auto src = write_source(code);
+    auto exe = src;
+    exe.replace_extension();
+
+    auto cmd = base_command(compiler, args);
+    extend(cmd, compiler.output_command(exe));
+    cmd.emplace_back(src);
+
+    const auto & [ret, out, err] = submit(cmd).get();
+    std::filesystem::remove(src);
+    std::error_code ec;
+    std::filesystem::remove(exe, ec);
+
+    store(key, ret == 0);
+    return ret == 0;
+}
+
+std::vector<std::optional<uint64_t>> Checker::sizes(const std::vector<std::string> & types,
+                                                    const std::string & prefix,
+                                                    const std::vector<std::string> & args) {
+    const auto key = make_key("sizeof", prefix, args);
+
+    std::vector<std::optional<uint64_t>> found(types.size(), std::nullopt);
+    std::vector<std::size_t> unknown{};
+    for (std::size_t i = 0; i < types.size(); ++i) {
+        int64_t v;
+        if (lookup(key + types[i], v)) {
+            if (v >= 0) {
+                found[i] = v;
+            }
+        } else {
+            unknown.emplace_back(i);
+        }
+    }
+
+    // Each type is used to instantiate a template that is never defined, so
+    // the error for each one contains its index and its size. This doesn't
+    // require running anything, so it works for cross compilers too.
+    std::vector<std::filesystem::path> sources{};
+    std::vector<std::future<Util::Result>> running{};
+    for (std::size_t b = 0; b < unknown.size(); b += SIZE_BATCH) {
+        std::string code = prefix + "\ntemplate <unsigned I, unsigned long long N> struct "
+                                    "meson_sizeof;\n";
+        for (auto j = b; j < std::min(b + SIZE_BATCH, unknown.size()); ++j) {
+            const auto i = std::to_string(unknown[j]);
+            code += "meson_sizeof<" + i + ", sizeof(" + types[unknown[j]] + ")> meson_sizeof_" +
+                    i + ";\n";
+        }
+        const auto & src = sources.emplace_back(write_source(code));
+
+        auto cmd = base_command(compiler, args);
+        extend(cmd, compiler.compile_only_command());
+        extend(cmd, compiler.output_command("/dev/null"));
+        cmd.emplace_back(src);
+        running.emplace_back(submit(cmd));
+    }
+
+    const std::regex marker{R"(meson_sizeof<(\d+), (\d+))"};
+    for (auto & r : running) {
+        const auto & [ret, out, err] = r.get();
+        for (std::sregex_iterator it{err.begin(), err.end(), marker}, end{}; it != end; ++it) {
+            const auto i = std::stoul((*it)[1]);
+            if (i < found.size()) {
+                found[i] = std::stoull((*it)[2]);
+            }
+        }
+    }
+    for (const auto & src : sources) {
+        std::filesystem::remove(src);
+    }
+
+    for (const auto & i : unknown) {
+        store(key + types[i], found[i] ? static_cast<int64_t>(found[i].value()) : -1);
+    }
+    return found;
+}
+
+} // namespace MIR::Toolchain
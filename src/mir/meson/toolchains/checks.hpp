@@ -0,0 +1,97 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+/* Feature checks run against a compiler, such as has_header
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "compiler.hpp"
+
+namespace MIR::Toolchain {
+
+/**
+ * Runs feature checks for one compiler, and remembers the results
+ *
+ * Projects make hundreds of checks, so independent checks are batched into as
+ * few compiler invocations as possible. Header and size checks each share a
+ * single translation unit, written so that every failure names the check it
+ * belongs to. Argument checks test every argument in one compile, and only
+ * split the arguments in half when that fails. The DSL methods are called one
+ * at a time, so MIR lowering sends every such check in a block here together,
+ * through MIR::Compiler::prepare.
+ *
+ * Sources are written to a scratch directory, in /dev/shm when it is
+ * available. All methods are safe to call from multiple threads.
+ */
+class Checker {
+  public:
+    Checker(const Compiler::Compiler & c);
+    ~Checker();
+
+    Checker(const Checker &) = delete;
+    Checker & operator=(const Checker &) = delete;
+
+    /// Can each header be included, after the prefix?
+    std::vector<bool> has_headers(const std::vector<std::string> & headers,
+                                  const std::string & prefix = "",
+                                  const std::vector<std::string> & args = {});
+
+    /// Does the compiler accept each argument?
+    std::vector<bool> has_arguments(const std::vector<std::string> & arguments);
+
+    /// Does the code compile?
+    bool compiles(const std::string & code, const std::vector<std::string> & args = {});
+
+    /// Does the code compile and link into an executable?
+    bool links(const std::string & code, const std::vector<std::string> & args = {});
+
+    /// The size of each type, or nullopt if the type isn't valid
+    std::vector<std::optional<uint64_t>> sizes(const std::vector<std::string> & types,
+                                               const std::string & prefix = "",
+                                               const std::vector<std::string> & args = {});
+
+    /**
+     * Have these checks all been made already?
+     *
+     * kind is the name of the method that makes them, such as has_header or
+     * sizeof, and what holds the headers, arguments, code, or types checked.
+     * When this is true, making the checks again only looks up their results,
+     * so it never waits for the compiler.
+     */
+    bool has_results(const std::string & kind, const std::vector<std::string> & what,
+                     const std::string & prefix = "", const std::vector<std::string> & args = {});
+
+  private:
+    /// Write a source file into the scratch directory, and return its path
+    std::filesystem::path write_source(const std::string & code);
+
+    /// Look up a result, returns true if it was found
+    bool lookup(const std::string & key, int64_t & value);
+
+    void store(const std::string & key, const int64_t & value);
+
+    const Compiler::Compiler & compiler;
+
+    /// Created the first time a check needs it
+    std::filesystem::path scratch;
+    std::once_flag scratch_once;
+
+    /// Used to give each source file a unique name
+    std::atomic_uint counter;
+
+    /// Results by the kind of check, its arguments, and what was checked
+    std::unordered_map<std::string, int64_t> results;
+    std::mutex results_lock;
+};
+
+} // namespace MIR::Toolchain
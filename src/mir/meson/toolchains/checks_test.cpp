@@ -0,0 +1,104 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include "checks.hpp"
+#include "compilers/cpp/cpp.hpp"
+
+namespace {
+
+bool have_gcc() { return system("g++ --version > /dev/null 2>&1") == 0; }
+
+const MIR::Toolchain::Compiler::CPP::Gnu GCC{{"g++"}};
+
+} // namespace
+
+TEST(checks, has_headers) {
+    if (!have_gcc()) {
+        GTEST_SKIP();
+    }
+    MIR::Toolchain::Checker checker{GCC};
+    const auto found = checker.has_headers({"cstdio", "not-a-real-header.h", "vector"});
+    ASSERT_EQ(found, (std::vector<bool>{true, false, true}));
+}
+
+TEST(checks, has_headers_broken_prefix) {
+    if (!have_gcc()) {
+        GTEST_SKIP();
+    }
+    MIR::Toolchain::Checker checker{GCC};
+    const auto found = checker.has_headers({"cstdio"}, "#error broken");
+    ASSERT_EQ(found, (std::vector<bool>{false}));
+}
+
+TEST(checks, has_arguments) {
+    if (!have_gcc()) {
+        GTEST_SKIP();
+    }
+    MIR::Toolchain::Checker checker{GCC};
+    const auto found = checker.has_arguments(
+        {"-Wall", "-fnot-a-real-argument", "-Wno-shadow", "-Wno-not-a-real-warning", "-O2"});
+    ASSERT_EQ(found, (std::vector<bool>{true, false, true, false, true}));
+}
+
+TEST(checks, compiles_and_links) {
+    if (!have_gcc()) {
+        GTEST_SKIP();
+    }
+    MIR::Toolchain::Checker checker{GCC};
+    ASSERT_TRUE(checker.compiles("int foo(void) { return 0; }"));
+    ASSERT_FALSE(checker.compiles("int foo(void) { return bar; }"));
+    ASSERT_FALSE(checker.links("int foo(void); int main(void) { return foo(); }"));
+    ASSERT_TRUE(checker.links("int main(void) { return 0; }"));
+}
+
+TEST(checks, sizes) {
+    if (!have_gcc()) {
+        GTEST_SKIP();
+    }
+    MIR::Toolchain::Checker checker{GCC};
+    std::vector<std::string> types{"char", "not_a_type", "struct foo", "char[1000]"};
+    // More than fit in a single batch
+    for (unsigned i = 1; i <= 20; ++i) {
+        types.emplace_back("char[" + std::to_string(i) + "]");
+    }
+    const auto found = checker.sizes(types, "struct foo { char x[3]; };");
+    ASSERT_EQ(found[0], 1);
+    ASSERT_EQ(found[1], std::nullopt);
+    ASSERT_EQ(found[2], 3);
+    ASSERT_EQ(found[3], 1000);
+    for (unsigned i = 1; i <= 20; ++i) {
+        ASSERT_EQ(found[3 + i], i);
+    }
+}
+
+TEST(checks, cached) {
+    if (!have_gcc()) {
+        GTEST_SKIP();
+    }
+    // Wrap g++ in a script that records each time it is run
+    std::string log = std::filesystem::temp_directory_path() / "meson++-checks-log-XXXXXX";
+    close(mkstemp(log.data()));
+    const MIR::Toolchain::Compiler::CPP::Gnu counting{
+        {"sh", "-c", "echo >> " + log + "; exec g++ \"$@\"", "sh"}};
+
+    MIR::Toolchain::Checker checker{counting};
+    ASSERT_TRUE(checker.compiles("int x;"));
+    ASSERT_TRUE(checker.compiles("int x;"));
+    ASSERT_EQ(checker.has_arguments({"-Wall", "-fnot-a-real-argument"}),
+              (std::vector<bool>{true, false}));
+    ASSERT_EQ(checker.has_arguments({"-fnot-a-real-argument", "-Wall"}),
+              (std::vector<bool>{false, true}));
+
+    // One compile, then all the arguments together, then each one alone
+    std::ifstream in{log};
+    const auto runs = std::count(std::istreambuf_iterator<char>{in}, {}, '\n');
+    ASSERT_EQ(runs, 4);
+
+    std::filesystem::remove(log);
+}
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -16,6 +17,46 @@
 
 namespace MIR::Toolchain::Compiler {
 
+/**
+ * What a compiler reports about itself, and the machine it targets
+ *
+ * All of this comes from the compiler's predefined macros, so it can be read
+ * from a single run of the preprocessor.
+ */
+class Identity {
+  public:
+    Identity()
+        : id{}, version{}, cpu_family{}, kernel{Machines::Kernel::LINUX},
+          endian{Machines::Endian::LITTLE}, pointer_size{0}, default_std{} {};
+
+    /**
+     * Read the output of running the preprocessor with `-dM`
+     *
+     * Returns nullopt if the compiler or its target isn't recognized, or if a
+     * value that should be a number isn't one.
+     */
+    static std::optional<Identity> from_defines(const std::string & defines);
+
+    /// Information about the machine this compiler targets
+    Machines::Info machine_info(const Machines::Machine &) const;
+
+    /// The compiler's id, such as gcc or clang
+    std::string id;
+
+    /// The full version, such as 11.2.0
+    std::string version;
+
+    std::string cpu_family;
+    Machines::Kernel kernel;
+    Machines::Endian endian;
+
+    /// The size of a pointer, in bytes
+    unsigned pointer_size;
+
+    /// The language standard used if none is given, such as gnu++17
+    std::string default_std;
+};
+
 /**
  * Abstract base for all Compilers.
  */
@@ -31,6 +72,27 @@ class Compiler {
     /// Get the command line arguments to compile only, without linking
     virtual std::vector<std::string> compile_only_command() const = 0;
 
+    /// Get the command line arguments to run the preprocessor only
+    virtual std::vector<std::string> preprocess_only_command() const = 0;
+
+    /**
+     * Get the command line arguments to write the headers used into a depfile
+     *
+     * The depfile is in the Makefile format. Returns nothing if the compiler
+     * can't write one.
+     *
+     * @param depfile The name of the depfile to write
+     */
+    virtual std::vector<std::string> depfile_command(const std::string & depfile) const = 0;
+
+    /**
+     * Arguments that turn unknown command line arguments into errors
+     *
+     * Some compilers only warn about arguments they don't understand, which
+     * would make every argument look supported.
+     */
+    virtual std::vector<std::string> unknown_argument_errors() const = 0;
+
     /// Arguments that should always be used by this langauge/compiler
     virtual std::vector<std::string> always_args() const = 0;
 
@@ -58,11 +120,17 @@ class Compiler {
     /// Command to invoke this compiler, as a vector
     const std::vector<std::string> command;
 
+    /// What the compiler reported about itself when it was detected
+    const Identity identity;
+
   protected:
-    Compiler(const std::vector<std::string> & c) : command{c} {};
+    Compiler(const std::vector<std::string> & c, const Identity & i) : command{c}, identity{i} {};
 };
 
 std::unique_ptr<Compiler> detect_compiler(const Language &, const Machines::Machine &,
                                           const std::vector<std::string> & bins = {});
 
+/// The binaries detect_compiler tries, in order, when none are given
+const std::vector<std::string> & default_binaries(const Language &);
+
 } // namespace MIR::Toolchain::Compiler
@@ -3,4 +3,14 @@
 
 #include "toolchains/compilers/cpp/cpp.hpp"
 
-namespace MIR::Toolchain::Compiler::CPP {} // namespace MIR::Toolchain::Compiler::CPP
+namespace MIR::Toolchain::Compiler::CPP {
+
+std::vector<std::string> Clang::unknown_argument_errors() const {
+    return {
+        "-Werror=unknown-warning-option",
+        "-Werror=unused-command-line-argument",
+        "-Werror=ignored-optimization-argument",
+    };
+}
+
+} // namespace MIR::Toolchain::Compiler::CPP
@@ -15,31 +15,35 @@ class GnuLike : public Compiler {
   public:
     RSPFileSupport rsp_support() const final;
     std::vector<std::string> compile_only_command() const final;
+    std::vector<std::string> preprocess_only_command() const final;
+    std::vector<std::string> depfile_command(const std::string &) const final;
     std::vector<std::string> output_command(const std::string &) const final;
     Arguments::Argument generalize_argument(const std::string &) const final;
     std::string specialize_argument(const Arguments::Argument & arg) const final;
     std::vector<std::string> always_args() const final;
 
   protected:
-    GnuLike(const std::vector<std::string> & c) : Compiler{c} {};
+    GnuLike(const std::vector<std::string> & c, const Identity & i) : Compiler{c, i} {};
 };
 
 class Gnu : public GnuLike {
   public:
-    Gnu(const std::vector<std::string> & c) : GnuLike{c} {};
+    Gnu(const std::vector<std::string> & c, const Identity & i = {}) : GnuLike{c, i} {};
     ~Gnu(){};
 
     std::string id() const override { return "gcc"; };
     std::string language() const override { return "C++"; };
+    std::vector<std::string> unknown_argument_errors() const override { return {}; };
 };
 
 class Clang : public GnuLike {
   public:
-    Clang(const std::vector<std::string> & c) : GnuLike{c} {};
+    Clang(const std::vector<std::string> & c, const Identity & i = {}) : GnuLike{c, i} {};
     ~Clang(){};
 
     std::string id() const override { return "clang"; };
     std::string language() const override { return "C++"; };
+    std::vector<std::string> unknown_argument_errors() const override;
 };
 
 } // namespace MIR::Toolchain::Compiler::CPP
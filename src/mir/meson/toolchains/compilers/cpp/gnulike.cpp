@@ -10,6 +10,10 @@ std::vector<std::string> GnuLike::output_command(const std::string & output) con
     return {"-o", output};
 }
 std::vector<std::string> GnuLike::compile_only_command() const { return {"-c"}; }
+std::vector<std::string> GnuLike::preprocess_only_command() const { return {"-E"}; }
+std::vector<std::string> GnuLike::depfile_command(const std::string & depfile) const {
+    return {"-MD", "-MF", depfile};
+}
 
 Arguments::Argument GnuLike::generalize_argument(const std::string & arg) const {
     if (arg.substr(0, 2) == "-L") {
@@ -6,6 +6,7 @@
  */
 
 #include <cassert>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -24,8 +25,17 @@ const std::vector<std::string> DEFAULT{"ar"};
 std::unique_ptr<Archiver> detect_archiver(const Machines::Machine & machine,
                                           const std::vector<std::string> & bins) {
     // TODO: handle the machine switch, and the cross/native file
-    for (const auto & c : bins.empty() ? DEFAULT : bins) {
-        auto const & [ret, out, err] = Util::process(std::vector<std::string>{c, "--version"});
+    const auto & candidates = bins.empty() ? DEFAULT : bins;
+
+    // Run every candidate at once, then look at the results in order of preference
+    std::vector<std::future<Util::Result>> probes{};
+    for (const auto & c : candidates) {
+        probes.emplace_back(Util::process_pool().submit(std::vector<std::string>{c, "--version"}));
+    }
+
+    for (unsigned i = 0; i < candidates.size(); ++i) {
+        const auto & c = candidates[i];
+        auto const & [ret, out, err] = probes[i].get();
         if (ret != 0) {
             continue;
         }
@@ -37,4 +47,6 @@ std::unique_ptr<Archiver> detect_archiver(const Machines::Machine & machine,
     return nullptr;
 };
 
+const std::vector<std::string> & default_binaries() { return DEFAULT; };
+
 } // namespace MIR::Toolchain::Archiver
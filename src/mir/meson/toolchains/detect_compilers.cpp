@@ -6,6 +6,7 @@
  */
 
 #include <cassert>
+#include <future>
 #include <memory>
 #include <string>
 #include <vector>
@@ -22,16 +23,34 @@ const std::vector<std::string> DEFAULT_CPP{"c++", "g++", "clang++"};
 std::unique_ptr<Compiler> detect_cpp_compiler(const Machines::Machine & m,
                                               const std::vector<std::string> & bins) {
     // TODO: handle the machine switch, and the cross/native file
+
+    // Run every candidate at once, then look at the results in order of
+    // preference.
+    //
+    // Each probe dumps the predefined macros for an empty file, which is
+    // enough to identify the compiler and its target all at once.
+    std::vector<std::future<Util::Result>> probes{};
     for (const auto & c : bins) {
-        auto const & [ret, out, err] = Util::process(std::vector<std::string>{c, "--version"});
+        probes.emplace_back(Util::process_pool().submit(
+            std::vector<std::string>{c, "-E", "-dM", "-x", "c++", "/dev/null"}));
+    }
+
+    for (unsigned i = 0; i < bins.size(); ++i) {
+        const auto & c = bins[i];
+        auto const & [ret, out, err] = probes[i].get();
         if (ret != 0) {
             continue;
         }
 
-        if (out.find("Free Software Foundation") != std::string::npos) {
-            return std::make_unique<CPP::Gnu>(std::vector<std::string>{c});
-        } else if (out.find("clang version") != std::string::npos) {
-            return std::make_unique<CPP::Clang>(std::vector<std::string>{c});
+        const auto ident = Identity::from_defines(out);
+        if (!ident) {
+            continue;
+        }
+
+        if (ident->id == "gcc") {
+            return std::make_unique<CPP::Gnu>(std::vector<std::string>{c}, ident.value());
+        } else if (ident->id == "clang") {
+            return std::make_unique<CPP::Clang>(std::vector<std::string>{c}, ident.value());
         }
     }
     return nullptr;
@@ -48,4 +67,12 @@ std::unique_ptr<Compiler> detect_compiler(const Language & lang, const Machines:
     assert(false);
 };
 
+const std::vector<std::string> & default_binaries(const Language & lang) {
+    switch (lang) {
+        case Language::CPP:
+            return DEFAULT_CPP;
+    }
+    assert(false);
+};
+
 } // namespace MIR::Toolchain::Compiler
@@ -15,6 +15,7 @@ TEST(detect_compilers, g_plus_plus) {
         MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD, {"g++"});
     ASSERT_NE(comp, nullptr);
     ASSERT_EQ(comp->id(), "gcc");
+    ASSERT_NE(comp->identity.version, "");
 }
 
 TEST(detect_compilers, clang_plus_plus) {
@@ -27,3 +28,59 @@ TEST(detect_compilers, clang_plus_plus) {
     ASSERT_NE(comp, nullptr);
     ASSERT_EQ(comp->id(), "clang");
 }
+
+TEST(compiler_identity, gcc) {
+    const auto ident = MIR::Toolchain::Compiler::Identity::from_defines(
+        "#define __GNUC__ 11\n#define __GNUC_MINOR__ 2\n#define __GNUC_PATCHLEVEL__ 0\n"
+        "#define __x86_64__ 1\n#define __linux__ 1\n"
+        "#define __BYTE_ORDER__ __ORDER_LITTLE_ENDIAN__\n#define __SIZEOF_POINTER__ 8\n"
+        "#define __cplusplus 201703L\n");
+    ASSERT_TRUE(ident.has_value());
+    ASSERT_EQ(ident->id, "gcc");
+    ASSERT_EQ(ident->version, "11.2.0");
+    ASSERT_EQ(ident->cpu_family, "x86_64");
+    ASSERT_EQ(ident->endian, MIR::Machines::Endian::LITTLE);
+    ASSERT_EQ(ident->pointer_size, 8);
+    ASSERT_EQ(ident->default_std, "gnu++17");
+}
+
+TEST(compiler_identity, clang) {
+    const auto ident = MIR::Toolchain::Compiler::Identity::from_defines(
+        "#define __GNUC__ 4\n#define __clang__ 1\n#define __clang_major__ 13\n"
+        "#define __clang_minor__ 0\n#define __clang_patchlevel__ 1\n#define __aarch64__ 1\n"
+        "#define __linux__ 1\n#define __BYTE_ORDER__ __ORDER_BIG_ENDIAN__\n"
+        "#define __SIZEOF_POINTER__ 8\n#define __STRICT_ANSI__ 1\n#define __cplusplus 201402L\n");
+    ASSERT_TRUE(ident.has_value());
+    ASSERT_EQ(ident->id, "clang");
+    ASSERT_EQ(ident->version, "13.0.1");
+    ASSERT_EQ(ident->cpu_family, "aarch64");
+    ASSERT_EQ(ident->endian, MIR::Machines::Endian::BIG);
+    ASSERT_EQ(ident->default_std, "c++14");
+
+    const auto info = ident->machine_info(MIR::Machines::Machine::BUILD);
+    ASSERT_EQ(info.cpu_family, "aarch64");
+    ASSERT_EQ(info.endian, MIR::Machines::Endian::BIG);
+}
+
+TEST(compiler_identity, unknown) {
+    ASSERT_FALSE(MIR::Toolchain::Compiler::Identity::from_defines("#define __linux__ 1\n"));
+}
+
+TEST(compiler_identity, bad_pointer_size) {
+    ASSERT_FALSE(MIR::Toolchain::Compiler::Identity::from_defines(
+        "#define __GNUC__ 11\n#define __GNUC_MINOR__ 2\n#define __GNUC_PATCHLEVEL__ 0\n"
+        "#define __x86_64__ 1\n#define __linux__ 1\n"
+        "#define __BYTE_ORDER__ __ORDER_LITTLE_ENDIAN__\n#define __SIZEOF_POINTER__ eight\n"));
+}
+
+TEST(compiler_identity, bad_version) {
+    // Everything but the version is fine
+    const std::string target = "#define __x86_64__ 1\n#define __linux__ 1\n"
+                               "#define __BYTE_ORDER__ __ORDER_LITTLE_ENDIAN__\n"
+                               "#define __SIZEOF_POINTER__ 8\n";
+    ASSERT_FALSE(MIR::Toolchain::Compiler::Identity::from_defines(
+        "#define __GNUC__ 11\n#define __GNUC_MINOR__ two\n#define __GNUC_PATCHLEVEL__ 0\n" +
+        target));
+    ASSERT_FALSE(MIR::Toolchain::Compiler::Identity::from_defines(
+        "#define __clang__ 1\n#define __clang_major__ 13\n#define __clang_minor__ 0\n" + target));
+}
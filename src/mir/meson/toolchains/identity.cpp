@@ -0,0 +1,176 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+/**
+ * Compiler identification from predefined macros
+ */
+
+#include <charconv>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "compiler.hpp"
+
+namespace MIR::Toolchain::Compiler {
+
+namespace {
+
+using Defines = std::unordered_map<std::string, std::string>;
+
+/// Split `#define NAME VALUE` lines into a mapping of NAME : VALUE
+Defines parse(const std::string & in) {
+    Defines defines{};
+    std::istringstream stream{in};
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (line.compare(0, 8, "#define ") != 0) {
+            continue;
+        }
+        const auto name_end = line.find(' ', 8);
+        if (name_end == std::string::npos) {
+            defines[line.substr(8)] = "";
+        } else {
+            defines[line.substr(8, name_end - 8)] = line.substr(name_end + 1);
+        }
+    }
+    return defines;
+}
+
+std::string get(const Defines & defines, const std::string & name) {
+    const auto found = defines.find(name);
+    return found != defines.end() ? found->second : "";
+}
+
+std::optional<std::string> find_cpu_family(const Defines & defines) {
+    if (defines.count("__x86_64__")) {
+        return "x86_64";
+    } else if (defines.count("__i386__")) {
+        return "x86";
+    } else if (defines.count("__aarch64__")) {
+        return "aarch64";
+    } else if (defines.count("__arm__")) {
+        return "arm";
+    } else if (defines.count("__powerpc64__")) {
+        return "ppc64";
+    } else if (defines.count("__riscv")) {
+        return get(defines, "__riscv_xlen") == "64" ? "riscv64" : "riscv32";
+    }
+    return std::nullopt;
+}
+
+/// Turn the value of __cplusplus into the name of the standard
+std::string cpp_std(const Defines & defines) {
+    const auto value = get(defines, "__cplusplus");
+    std::string std;
+    if (value == "199711L") {
+        std = "98";
+    } else if (value == "201103L") {
+        std = "11";
+    } else if (value == "201402L") {
+        std = "14";
+    } else if (value == "201703L") {
+        std = "17";
+    } else if (value == "202002L") {
+        std = "20";
+    } else if (!value.empty() && value > "202002L") {
+        std = "23";
+    } else {
+        return "";
+    }
+    // Without GNU extensions __STRICT_ANSI__ is defined
+    return (defines.count("__STRICT_ANSI__") ? "c++" : "gnu++") + std;
+}
+
+/// Read a macro whose value is a number, nullopt if it is missing or isn't one
+std::optional<unsigned> number(const Defines & defines, const std::string & name) {
+    const auto value = get(defines, name);
+    unsigned n;
+    const auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), n);
+    if (ec != std::errc{} || end != value.data() + value.size()) {
+        return std::nullopt;
+    }
+    return n;
+}
+
+/**
+ * Join the values of the macros that make up a version with dots
+ *
+ * Returns nullopt if any of them is missing or isn't a number.
+ */
+std::optional<std::string> join_version(const Defines & defines,
+                                        const std::vector<std::string> & names) {
+    std::string joined{};
+    for (const auto & name : names) {
+        const auto n = number(defines, name);
+        if (!n) {
+            return std::nullopt;
+        }
+        joined += (joined.empty() ? "" : ".") + std::to_string(n.value());
+    }
+    return joined;
+}
+
+} // namespace
+
+std::optional<Identity> Identity::from_defines(const std::string & in) {
+    const auto defines = parse(in);
+
+    // Clang defines the GCC macros as well, so it must be checked first
+    std::string id;
+    std::optional<std::string> ver;
+    if (defines.count("__clang__")) {
+        id = "clang";
+        ver = join_version(defines,
+                           {"__clang_major__", "__clang_minor__", "__clang_patchlevel__"});
+    } else if (defines.count("__GNUC__")) {
+        id = "gcc";
+        ver = join_version(defines, {"__GNUC__", "__GNUC_MINOR__", "__GNUC_PATCHLEVEL__"});
+    } else {
+        return std::nullopt;
+    }
+    if (!ver) {
+        return std::nullopt;
+    }
+
+    Identity ident{};
+    ident.id = id;
+    ident.version = ver.value();
+
+    const auto family = find_cpu_family(defines);
+    if (!family) {
+        return std::nullopt;
+    }
+    ident.cpu_family = family.value();
+
+    if (defines.count("__linux__")) {
+        ident.kernel = Machines::Kernel::LINUX;
+    } else {
+        return std::nullopt;
+    }
+
+    const auto order = get(defines, "__BYTE_ORDER__");
+    if (order == "__ORDER_LITTLE_ENDIAN__") {
+        ident.endian = Machines::Endian::LITTLE;
+    } else if (order == "__ORDER_BIG_ENDIAN__") {
+        ident.endian = Machines::Endian::BIG;
+    } else {
+        return std::nullopt;
+    }
+
+    const auto ptr = number(defines, "__SIZEOF_POINTER__");
+    if (!ptr) {
+        return std::nullopt;
+    }
+    ident.pointer_size = ptr.value();
+
+    ident.default_std = cpp_std(defines);
+
+    return ident;
+}
+
+Machines::Info Identity::machine_info(const Machines::Machine & m) const {
+    return Machines::Info{m, kernel, endian, cpu_family};
+}
+
+} // namespace MIR::Toolchain::Compiler
@@ -2,18 +2,113 @@
 // Copyright © 2021 Intel Corporation
 
 #include "toolchain.hpp"
-#include "archiver.hpp"
-#include "compiler.hpp"
-#include "linker.hpp"
+#include "exceptions.hpp"
+#include "log.hpp"
 
 namespace MIR::Toolchain {
 
-Toolchain get_toolchain(const Language & lang, const Machines::Machine & for_machine) {
+namespace {
+
+Toolchain::Detectors search(const Language & lang, const Machines::Machine & machine) {
     // TODO: handle passing in explicit binary name
-    auto compiler = Compiler::detect_compiler(lang, for_machine);
-    auto archiver = Archiver::detect_archiver(for_machine);
-    auto linker = Linker::detect_linker(compiler, for_machine);
-    return Toolchain{std::move(compiler), std::move(linker), std::move(archiver)};
+    return Toolchain::Detectors{
+        [lang, machine]() { return Compiler::detect_compiler(lang, machine); },
+        [machine](const std::unique_ptr<Compiler::Compiler> & c) {
+            return Linker::detect_linker(c, machine);
+        },
+        [machine]() { return Archiver::detect_archiver(machine); },
+    };
+}
+
+} // namespace
+
+Toolchain::Toolchain(const Language & l, const Machines::Machine & m)
+    : Toolchain{l, m, search(l, m)} {};
+
+Toolchain::Toolchain(const Language & l, const Machines::Machine & m, Detectors && d)
+    : lang{l}, machine{m}, detectors{std::move(d)}, _compiler{nullptr}, compiler_found{false},
+      compiler_reported{false}, _linker{nullptr}, linker_found{false}, linker_reported{false},
+      _archiver{nullptr}, archiver_found{false}, archiver_reported{false}, _checker{nullptr} {};
+
+Toolchain::Toolchain(std::unique_ptr<Compiler::Compiler> && c,
+                     std::unique_ptr<Linker::Linker> && l,
+                     std::unique_ptr<Archiver::Archiver> && a)
+    : lang{Language::CPP}, machine{Machines::Machine::BUILD}, detectors{},
+      _compiler{std::move(c)}, compiler_found{true}, compiler_reported{false},
+      _linker{std::move(l)}, linker_found{true}, linker_reported{false}, _archiver{std::move(a)},
+      archiver_found{true}, archiver_reported{false}, _checker{nullptr} {
+    // Nothing is left to find
+    std::call_once(compiler_once, []() {});
+    std::call_once(linker_once, []() {});
+    std::call_once(archiver_once, []() {});
+};
+
+const std::unique_ptr<Compiler::Compiler> & Toolchain::compiler() const {
+    std::call_once(compiler_once, [this]() {
+        _compiler = detectors.compiler();
+        if (_compiler == nullptr) {
+            throw Util::Exceptions::MesonException{"Could not find a " + to_string(lang) +
+                                                   " compiler for the " +
+                                                   Machines::to_string(machine) + " machine"};
+        }
+        compiler_found = true;
+    });
+    return _compiler;
+};
+
+bool Toolchain::has_compiler() const { return compiler_found; };
+
+const std::unique_ptr<Linker::Linker> & Toolchain::linker() const {
+    const auto & c = compiler();
+    std::call_once(linker_once, [&]() {
+        _linker = detectors.linker(c);
+        if (_linker == nullptr) {
+            throw Util::Exceptions::MesonException{"Could not find a " + to_string(lang) +
+                                                   " linker for the " +
+                                                   Machines::to_string(machine) + " machine"};
+        }
+        linker_found = true;
+    });
+    return _linker;
+};
+
+const std::unique_ptr<Archiver::Archiver> & Toolchain::archiver() const {
+    std::call_once(archiver_once, [this]() {
+        _archiver = detectors.archiver();
+        if (_archiver == nullptr) {
+            throw Util::Exceptions::MesonException{"Could not find a static archiver for the " +
+                                                   Machines::to_string(machine) + " machine"};
+        }
+        archiver_found = true;
+    });
+    return _archiver;
+};
+
+Checker & Toolchain::checker() const {
+    const auto & c = compiler();
+    std::call_once(checker_once, [&]() { _checker = std::make_unique<Checker>(*c); });
+    return *_checker;
+};
+
+void Toolchain::report(std::ostream & out) {
+    if (compiler_found && !compiler_reported) {
+        out << _compiler->language() << " compiler for the " << Machines::to_string(machine)
+            << " machine: " << Util::Log::bold(_compiler->id()) << " ("
+            << _compiler->identity.version << ")" << std::endl;
+        compiler_reported = true;
+    }
+    // The linker is only found after the compiler, so it's never printed first
+    if (linker_found && compiler_reported && !linker_reported) {
+        // TODO: print the print the full version
+        out << _compiler->language() << " linker for the " << Machines::to_string(machine)
+            << " machine: " << Util::Log::bold(_linker->id()) << std::endl;
+        linker_reported = true;
+    }
+    if (archiver_found && !archiver_reported) {
+        out << "Static archiver for the " << Machines::to_string(machine)
+            << " machine: " << Util::Log::bold(_archiver->id()) << std::endl;
+        archiver_reported = true;
+    }
 };
 
 } // namespace MIR::Toolchain
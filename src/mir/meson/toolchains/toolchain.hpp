@@ -3,38 +3,101 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <ostream>
 
 #include "archiver.hpp"
+#include "checks.hpp"
 #include "common.hpp"
 #include "compiler.hpp"
 #include "linker.hpp"
+#include "machines.hpp"
 
 namespace MIR::Toolchain {
 
 /**
  * Holds the tool chain for one language, for one machine
+ *
+ * Each tool is found the first time it is asked for, and then kept, so a
+ * project that never links doesn't pay for finding a linker, and a language
+ * that is never used doesn't have anything found at all. It is safe to ask for
+ * the same tool from multiple threads.
+ *
+ * Finding a tool doesn't print anything, as it may happen on any thread. The
+ * main thread calls report() to print what has been found.
  */
 class Toolchain {
   public:
-    Toolchain() : compiler{nullptr}, linker{nullptr}, archiver{nullptr} {};
-    Toolchain(std::unique_ptr<Compiler::Compiler> && c, std::unique_ptr<Linker::Linker> && l)
-        : compiler{std::move(c)}, linker{std::move(l)}, archiver{nullptr} {};
+    /// Functions to find each tool, each is called at most once
+    class Detectors {
+      public:
+        std::function<std::unique_ptr<Compiler::Compiler>()> compiler;
+        std::function<std::unique_ptr<Linker::Linker>(const std::unique_ptr<Compiler::Compiler> &)>
+            linker;
+        std::function<std::unique_ptr<Archiver::Archiver>()> archiver;
+    };
+
+    /// Search for each tool for the language and machine
+    Toolchain(const Language &, const Machines::Machine &);
+
+    /// Find each tool with the given functions
+    Toolchain(const Language &, const Machines::Machine &, Detectors &&);
+
+    /// Use tools that have already been found
     Toolchain(std::unique_ptr<Compiler::Compiler> && c, std::unique_ptr<Linker::Linker> && l,
-              std::unique_ptr<Archiver::Archiver> && a)
-        : compiler{std::move(c)}, linker{std::move(l)}, archiver{std::move(a)} {};
-    Toolchain(Toolchain && t)
-        : compiler{std::move(t.compiler)}, linker{std::move(t.linker)}, archiver{std::move(
-                                                                            t.archiver)} {};
+              std::unique_ptr<Archiver::Archiver> && a);
+
     ~Toolchain(){};
 
-    Toolchain & operator=(Toolchain &&) = default;
+    Toolchain(const Toolchain &) = delete;
+    Toolchain & operator=(const Toolchain &) = delete;
 
-    std::unique_ptr<Compiler::Compiler> compiler;
-    std::unique_ptr<Linker::Linker> linker;
-    std::unique_ptr<Archiver::Archiver> archiver;
-};
+    const std::unique_ptr<Compiler::Compiler> & compiler() const;
+
+    /// Has the compiler been found, so that compiler() won't block?
+    bool has_compiler() const;
+
+    const std::unique_ptr<Linker::Linker> & linker() const;
+    const std::unique_ptr<Archiver::Archiver> & archiver() const;
+
+    /// Feature checks for the compiler, with their results
+    Checker & checker() const;
 
-Toolchain get_toolchain(const Language & l, const Machines::Machine &);
+    /**
+     * Print each tool that has been found since the last report
+     *
+     * Within one report tools are printed in the order compiler, linker,
+     * archiver, no matter which thread found them first. Only call this from
+     * the main thread.
+     */
+    void report(std::ostream &);
+
+    const Language lang;
+    const Machines::Machine machine;
+
+  private:
+    const Detectors detectors;
+
+    mutable std::unique_ptr<Compiler::Compiler> _compiler;
+    mutable std::once_flag compiler_once;
+    mutable std::atomic_bool compiler_found;
+    bool compiler_reported;
+
+    mutable std::unique_ptr<Linker::Linker> _linker;
+    mutable std::once_flag linker_once;
+    mutable std::atomic_bool linker_found;
+    bool linker_reported;
+
+    mutable std::unique_ptr<Archiver::Archiver> _archiver;
+    mutable std::once_flag archiver_once;
+    mutable std::atomic_bool archiver_found;
+    bool archiver_reported;
+
+    mutable std::unique_ptr<Checker> _checker;
+    mutable std::once_flag checker_once;
+};
 
 } // namespace MIR::Toolchain
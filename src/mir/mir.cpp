@@ -1,13 +1,17 @@
 // SPDX-license-identifier: Apache-2.0
 // Copyright © 2021 Intel Corporation
 
+#include <algorithm>
+#include <map>
+
 #include "mir.hpp"
 #include "exceptions.hpp"
 
 namespace MIR {
 
-const Object Compiler::get_id(const std::vector<Object> & args,
-                              const std::unordered_map<std::string, Object> & kwargs) const {
+const Object Compiler::get_id(const std::pmr::vector<Object> & args,
+                              const std::pmr::unordered_map<std::string, Object> & kwargs,
+                              BlockArena & arena) const {
     if (!args.empty()) {
         throw Util::Exceptions::InvalidArguments(
             "compiler.get_id(): takes no positional arguments");
@@ -16,9 +20,306 @@ const Object Compiler::get_id(const std::vector<Object> & args,
         throw Util::Exceptions::InvalidArguments("compiler.get_id(): takes no keyword arguments");
     }
 
-    return std::make_unique<String>(toolchain->compiler->id());
+    return arena.make<String>(toolchain->compiler()->id());
+};
+
+namespace {
+
+/// Get the single string positional argument of a compiler method
+const std::string & single_string(const std::string & name, const std::pmr::vector<Object> & args) {
+    if (args.size() != 1 || !std::holds_alternative<Ptr<String>>(args[0])) {
+        throw Util::Exceptions::InvalidArguments("compiler." + name +
+                                                 "(): takes exactly one string argument");
+    }
+    return std::get<Ptr<String>>(args[0])->value;
+}
+
+std::vector<std::string> string_list(const std::string & name,
+                                     const std::pmr::vector<Object> & args) {
+    std::vector<std::string> list{};
+    for (const auto & a : args) {
+        if (!std::holds_alternative<Ptr<String>>(a)) {
+            throw Util::Exceptions::InvalidArguments("compiler." + name +
+                                                     "(): arguments must be strings");
+        }
+        list.emplace_back(std::get<Ptr<String>>(a)->value);
+    }
+    return list;
+}
+
+/// Get the `prefix` keyword argument, if there is one
+std::string prefix_kwarg(const std::string & name,
+                         const std::pmr::unordered_map<std::string, Object> & kwargs) {
+    const auto found = kwargs.find("prefix");
+    if (found == kwargs.end()) {
+        return "";
+    }
+    if (!std::holds_alternative<Ptr<String>>(found->second)) {
+        throw Util::Exceptions::InvalidArguments("compiler." + name +
+                                                 "(): 'prefix' must be a string");
+    }
+    return std::get<Ptr<String>>(found->second)->value;
+}
+
+/// Get the `args` keyword argument, if there is one
+std::vector<std::string> args_kwarg(const std::string & name,
+                                    const std::pmr::unordered_map<std::string, Object> & kwargs) {
+    const auto found = kwargs.find("args");
+    if (found == kwargs.end()) {
+        return {};
+    }
+    if (std::holds_alternative<Ptr<String>>(found->second)) {
+        return {std::get<Ptr<String>>(found->second)->value};
+    }
+    if (!std::holds_alternative<Ptr<Array>>(found->second)) {
+        throw Util::Exceptions::InvalidArguments("compiler." + name +
+                                                 "(): 'args' must be an array of strings");
+    }
+    return string_list(name, std::get<Ptr<Array>>(found->second)->value);
+}
+
+void check_kwargs(const std::string & name,
+                  const std::pmr::unordered_map<std::string, Object> & kwargs,
+                  const std::vector<std::string> & allowed) {
+    for (const auto & [k, _] : kwargs) {
+        if (std::find(allowed.begin(), allowed.end(), k) == allowed.end()) {
+            throw Util::Exceptions::InvalidArguments("compiler." + name +
+                                                     "(): unknown keyword argument " + k);
+        }
+    }
+}
+
+} // namespace
+
+const Object Compiler::has_header(const std::pmr::vector<Object> & args,
+                                  const std::pmr::unordered_map<std::string, Object> & kwargs,
+                                  BlockArena & arena) const {
+    check_kwargs("has_header", kwargs, {"prefix", "args"});
+    const auto & header = single_string("has_header", args);
+    const auto found = toolchain->checker().has_headers(
+        {header}, prefix_kwarg("has_header", kwargs), args_kwarg("has_header", kwargs));
+    return arena.make<Boolean>(found[0]);
+};
+
+const Object Compiler::has_argument(const std::pmr::vector<Object> & args,
+                                    const std::pmr::unordered_map<std::string, Object> & kwargs,
+                                    BlockArena & arena) const {
+    check_kwargs("has_argument", kwargs, {});
+    const auto & arg = single_string("has_argument", args);
+    return arena.make<Boolean>(toolchain->checker().has_arguments({arg})[0]);
+};
+
+const Object
+Compiler::get_supported_arguments(const std::pmr::vector<Object> & args,
+                                  const std::pmr::unordered_map<std::string, Object> & kwargs,
+                                  BlockArena & arena) const {
+    check_kwargs("get_supported_arguments", kwargs, {});
+    const auto list = string_list("get_supported_arguments", args);
+
+    // All of the arguments are checked together
+    const auto found = toolchain->checker().has_arguments(list);
+
+    auto arr = arena.make<Array>();
+    for (std::size_t i = 0; i < list.size(); ++i) {
+        if (found[i]) {
+            arr->value.emplace_back(arena.make<String>(list[i]));
+        }
+    }
+    return arr;
+};
+
+const Object Compiler::compiles(const std::pmr::vector<Object> & args,
+                                const std::pmr::unordered_map<std::string, Object> & kwargs,
+                                BlockArena & arena) const {
+    check_kwargs("compiles", kwargs, {"args"});
+    const auto & code = single_string("compiles", args);
+    return arena.make<Boolean>(
+        toolchain->checker().compiles(code, args_kwarg("compiles", kwargs)));
+};
+
+const Object Compiler::links(const std::pmr::vector<Object> & args,
+                             const std::pmr::unordered_map<std::string, Object> & kwargs,
+                             BlockArena & arena) const {
+    check_kwargs("links", kwargs, {"args"});
+    const auto & code = single_string("links", args);
+    return arena.make<Boolean>(toolchain->checker().links(code, args_kwarg("links", kwargs)));
+};
+
+const Object Compiler::size_of(const std::pmr::vector<Object> & args,
+                               const std::pmr::unordered_map<std::string, Object> & kwargs,
+                               BlockArena & arena) const {
+    check_kwargs("sizeof", kwargs, {"prefix", "args"});
+    const auto & type = single_string("sizeof", args);
+    const auto found = toolchain->checker().sizes({type}, prefix_kwarg("sizeof", kwargs),
+                                                 args_kwarg("sizeof", kwargs));
+    // Meson reports -1 for a type that doesn't exist
+    return arena.make<Number>(found[0] ? static_cast<int64_t>(found[0].value()) : -1);
+};
+
+std::function<void()> Compiler::prepare(const std::vector<const FunctionCall *> & calls) const {
+    // Checks can only share a batch if they have the same prefix and
+    // arguments. Each kind of check has its batches, by the name of the
+    // method that makes them.
+    using Batches = std::map<std::pair<std::string, std::vector<std::string>>,
+                             std::vector<std::string>>;
+    std::map<std::string, Batches> checks{};
+
+    for (const auto * f : calls) {
+        const auto & name = f->name;
+        if (name == "has_header" || name == "sizeof") {
+            check_kwargs(name, f->kw_args, {"prefix", "args"});
+            checks[name][{prefix_kwarg(name, f->kw_args), args_kwarg(name, f->kw_args)}]
+                .emplace_back(single_string(name, f->pos_args));
+        } else if (name == "compiles" || name == "links") {
+            check_kwargs(name, f->kw_args, {"args"});
+            checks[name][{"", args_kwarg(name, f->kw_args)}].emplace_back(
+                single_string(name, f->pos_args));
+        } else if (name == "has_argument") {
+            checks[name][{}].emplace_back(single_string("has_argument", f->pos_args));
+        } else if (name == "get_supported_arguments") {
+            const auto list = string_list("get_supported_arguments", f->pos_args);
+            auto & batch = checks["has_argument"][{}];
+            batch.insert(batch.end(), list.begin(), list.end());
+        }
+    }
+
+    // Only the batches with something that hasn't been checked need to run
+    auto & checker = toolchain->checker();
+    for (auto kind = checks.begin(); kind != checks.end();) {
+        auto & batches = kind->second;
+        for (auto b = batches.begin(); b != batches.end();) {
+            const auto & [opts, batch] = *b;
+            if (checker.has_results(kind->first, batch, opts.first, opts.second)) {
+                b = batches.erase(b);
+            } else {
+                ++b;
+            }
+        }
+        kind = batches.empty() ? checks.erase(kind) : std::next(kind);
+    }
+    if (checks.empty()) {
+        return nullptr;
+    }
+
+    return [tc = toolchain, checks = std::move(checks)]() {
+        auto & checker = tc->checker();
+        for (const auto & [kind, batches] : checks) {
+            for (const auto & [opts, batch] : batches) {
+                const auto & [prefix, args] = opts;
+                if (kind == "has_header") {
+                    (void)checker.has_headers(batch, prefix, args);
+                } else if (kind == "sizeof") {
+                    (void)checker.sizes(batch, prefix, args);
+                } else if (kind == "has_argument") {
+                    (void)checker.has_arguments(batch);
+                } else {
+                    for (const auto & code : batch) {
+                        (void)(kind == "compiles" ? checker.compiles(code, args)
+                                                  : checker.links(code, args));
+                    }
+                }
+            }
+        }
+    };
 };
 
 Variable::operator bool() const { return !name.empty(); };
 
+namespace {
+
+/**
+ * Follow the bases of a persistent collection back to its first version
+ *
+ * Returns each version, newest first.
+ */
+template <typename T>
+std::optional<std::vector<const T *>> versions(const T * newest, const Definitions & lookup,
+                                               const std::string & kind) {
+    std::vector<const T *> chain{newest};
+    while (chain.back()->base) {
+        const auto & base = chain.back()->base;
+        const auto * obj = lookup(base);
+        if (obj == nullptr) {
+            return std::nullopt;
+        }
+        if (const auto * v = std::get_if<Ptr<T>>(obj)) {
+            chain.emplace_back(v->get());
+            continue;
+        }
+        // Anything else that could still be lowered may yet turn into one
+        if (std::holds_alternative<Ptr<FunctionCall>>(*obj) ||
+            std::holds_alternative<Ptr<Identifier>>(*obj) ||
+            std::holds_alternative<Ptr<PlusAssignment>>(*obj)) {
+            return std::nullopt;
+        }
+        throw Util::Exceptions::InvalidArguments{"Cannot add " + kind + " to " + base.name +
+                                                 ", which is not " + kind};
+    }
+    return chain;
+}
+
+} // namespace
+
+std::optional<std::vector<const Object *>> Array::elements(const Definitions & lookup) const {
+    const auto chain = versions(this, lookup, "an array");
+    if (!chain) {
+        return std::nullopt;
+    }
+
+    std::vector<const Object *> elems{};
+    for (auto it = chain->rbegin(); it != chain->rend(); ++it) {
+        for (const auto & e : (*it)->value) {
+            elems.emplace_back(&e);
+        }
+    }
+    return elems;
+};
+
+std::optional<std::unordered_map<std::string, const Object *>>
+Dict::elements(const Definitions & lookup) const {
+    const auto chain = versions(this, lookup, "a dictionary");
+    if (!chain) {
+        return std::nullopt;
+    }
+
+    // Newer versions replace the keys of older ones
+    std::unordered_map<std::string, const Object *> elems{};
+    for (auto it = chain->rbegin(); it != chain->rend(); ++it) {
+        for (const auto & [k, v] : (*it)->value) {
+            elems[k] = &v;
+        }
+    }
+    return elems;
+};
+
+Condition::Condition(Object && o, BlockArena & arena)
+    : condition{std::move(o)}, if_true{arena.new_block()}, if_false{arena.new_block()} {};
+
+Condition::Condition(Object && o, BasicBlock * t, BasicBlock * f)
+    : condition{std::move(o)}, if_true{t}, if_false{f} {};
+
+BlockArena::BlockArena() : contents{std::make_unique<Contents>()} {};
+
+BasicBlock * BlockArena::new_block() { return &contents->blocks.emplace_back(); };
+
+size_t BlockArena::size() const { return contents->blocks.size(); };
+
+Allocator BlockArena::allocator() const { return Allocator{&contents->memory}; };
+
+void * BlockArena::Memory::do_allocate(std::size_t bytes, std::size_t align) {
+    std::lock_guard l{lock};
+    return buffer.allocate(bytes, align);
+};
+
+bool BlockArena::Memory::do_is_equal(const std::pmr::memory_resource & other) const noexcept {
+    return this == &other;
+};
+
+Program::~Program() {
+    // The instructions of this block live in the arena, so they have to go
+    // before it does
+    instructions.clear();
+    condition.reset();
+};
+
 } // namespace MIR
@@ -12,9 +12,13 @@
 #pragma once
 
 #include <cstdint>
+#include <deque>
 #include <filesystem>
+#include <functional>
 #include <list>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <sys/types.h>
@@ -80,12 +84,40 @@ class Number;
 class String;
 class Compiler;
 class File;
+class Foreach;
+class PlusAssignment;
 
-using Object =
-    std::variant<std::unique_ptr<FunctionCall>, std::unique_ptr<String>, std::unique_ptr<Boolean>,
-                 std::unique_ptr<Number>, std::unique_ptr<Identifier>, std::unique_ptr<Array>,
-                 std::unique_ptr<Dict>, std::unique_ptr<Compiler>, std::unique_ptr<File>,
-                 std::unique_ptr<Executable>, std::unique_ptr<StaticLibrary>>;
+class BlockArena;
+
+/**
+ * Destroys an object made by a BlockArena
+ *
+ * The memory it was made in is only freed with the arena.
+ */
+template <typename T> struct ArenaDelete {
+    void operator()(T * obj) const { obj->~T(); }
+};
+
+/// An object made by a BlockArena
+template <typename T> using Ptr = std::unique_ptr<T, ArenaDelete<T>>;
+
+/**
+ * The allocator for what MIR objects hold
+ *
+ * This points into the BlockArena that made the object.
+ */
+using Allocator = std::pmr::polymorphic_allocator<std::byte>;
+
+using Object = std::variant<Ptr<FunctionCall>, Ptr<String>, Ptr<Boolean>, Ptr<Number>,
+                            Ptr<Identifier>, Ptr<Array>, Ptr<Dict>, Ptr<Compiler>, Ptr<File>,
+                            Ptr<Executable>, Ptr<StaticLibrary>, Ptr<Foreach>, Ptr<PlusAssignment>>;
+
+/**
+ * Find the definition of a variable by its name and version
+ *
+ * Returns nullptr if that definition isn't known.
+ */
+using Definitions = std::function<const Object *(const Variable &)>;
 
 /**
  * Holds a toolchain
@@ -98,8 +130,49 @@ class Compiler {
 
     const std::shared_ptr<MIR::Toolchain::Toolchain> toolchain;
 
-    const Object get_id(const std::vector<Object> &,
-                        const std::unordered_map<std::string, Object> &) const;
+    const Object get_id(const std::pmr::vector<Object> &,
+                        const std::pmr::unordered_map<std::string, Object> &,
+                        BlockArena &) const;
+
+    const Object has_header(const std::pmr::vector<Object> &,
+                            const std::pmr::unordered_map<std::string, Object> &,
+                            BlockArena &) const;
+
+    const Object has_argument(const std::pmr::vector<Object> &,
+                              const std::pmr::unordered_map<std::string, Object> &,
+                              BlockArena &) const;
+
+    const Object get_supported_arguments(const std::pmr::vector<Object> &,
+                                         const std::pmr::unordered_map<std::string, Object> &,
+                                         BlockArena &) const;
+
+    const Object compiles(const std::pmr::vector<Object> &,
+                          const std::pmr::unordered_map<std::string, Object> &,
+                          BlockArena &) const;
+
+    const Object links(const std::pmr::vector<Object> &,
+                       const std::pmr::unordered_map<std::string, Object> &,
+                       BlockArena &) const;
+
+    /// compiler.sizeof()
+    const Object size_of(const std::pmr::vector<Object> &,
+                         const std::pmr::unordered_map<std::string, Object> &,
+                         BlockArena &) const;
+
+    /**
+     * The checks for many calls to this compiler's methods, run together
+     *
+     * Header, size, and argument checks that can share a compiler invocation
+     * are batched. Running the returned function makes every check that
+     * hasn't already been made, and the Checker caches the results, so the
+     * methods called for each of these calls afterwards don't run the
+     * compiler. The function only holds copies of what it needs from the
+     * calls, so it can be run on another thread.
+     *
+     * Returns nullptr when every check has been made, so the methods can be
+     * called without waiting.
+     */
+    std::function<void()> prepare(const std::vector<const FunctionCall *> &) const;
 
     Variable var;
 };
@@ -121,18 +194,21 @@ class File {
 /// A function call object
 class FunctionCall {
   public:
-    FunctionCall(const std::string & _name, std::vector<Object> && _pos,
-                 std::unordered_map<std::string, Object> && _kw, const std::filesystem::path & _sd)
-        : name{_name}, pos_args{std::move(_pos)}, kw_args{std::move(_kw)}, holder{std::nullopt},
-          source_dir{_sd}, var{} {};
+    using allocator_type = Allocator;
+
+    FunctionCall(const std::string & _name, std::pmr::vector<Object> && _pos,
+                 std::pmr::unordered_map<std::string, Object> && _kw,
+                 const std::filesystem::path & _sd, const allocator_type & alloc)
+        : name{_name}, pos_args{std::move(_pos), alloc}, kw_args{std::move(_kw), alloc},
+          holder{std::nullopt}, source_dir{_sd}, var{} {};
 
     const std::string name;
 
     /// Ordered container of positional argument objects
-    std::vector<Object> pos_args;
+    std::pmr::vector<Object> pos_args;
 
     /// Unordered container mapping keyword arguments to their values
-    std::unordered_map<std::string, Object> kw_args;
+    std::pmr::unordered_map<std::string, Object> kw_args;
 
     /// name of object holding this function, if it's a method.
     std::optional<std::string> holder;
@@ -180,48 +256,148 @@ class Identifier {
     Variable var;
 };
 
+/**
+ * An array, or the elements added to one
+ *
+ * Arrays are persistent, `x += [...]` does not copy the elements of x, instead
+ * the new version of x holds only the new elements, and points back at the
+ * version it extends through base. Anything that needs the whole value of a
+ * variable must use elements(), as value alone may only be the end of it.
+ */
 class Array {
   public:
-    Array() : value{}, var{} {};
-    Array(std::vector<Object> && a) : value{std::move(a)} {};
+    using allocator_type = Allocator;
 
-    std::vector<Object> value;
+    Array(const allocator_type & alloc) : value{alloc}, var{}, base{} {};
+    Array(std::pmr::vector<Object> && a, const allocator_type & alloc)
+        : value{std::move(a), alloc}, var{}, base{} {};
+
+    /**
+     * Every element of this version, starting with those of the versions it extends
+     *
+     * Returns std::nullopt if one of those versions isn't known yet, and
+     * throws if one is known not to be an array.
+     */
+    std::optional<std::vector<const Object *>> elements(const Definitions &) const;
+
+    std::pmr::vector<Object> value;
     Variable var;
+
+    /// The variable whose elements come before these, if any
+    Variable base;
 };
 
+/**
+ * A dictionary, or the elements added to one
+ *
+ * Like Array, a new version made by `x += {...}` holds only the new elements,
+ * which take precedence over those of base.
+ */
 class Dict {
   public:
-    Dict() : value{}, var{} {};
+    using allocator_type = Allocator;
+
+    Dict(const allocator_type & alloc) : value{alloc}, var{}, base{} {};
+
+    /**
+     * Every element of this version, including those of the versions it extends
+     *
+     * Returns std::nullopt if one of those versions isn't known yet, and
+     * throws if one is known not to be a dictionary.
+     */
+    std::optional<std::unordered_map<std::string, const Object *>>
+    elements(const Definitions &) const;
 
     // TODO: the key is allowed to be a string or an expression that evaluates
     // to a string, we need to enforce that somewhere.
-    std::unordered_map<std::string, Object> value;
+    std::pmr::unordered_map<std::string, Object> value;
+    Variable var;
+
+    /// The variable whose elements these are added to, if any
+    Variable base;
+};
+
+/**
+ * `name += value`, until what name holds is known
+ *
+ * What adding does depends on the value of name, and on the value being
+ * added. Adding an array to an array appends each of its elements, adding
+ * anything else to an array appends the value itself, and strings, numbers,
+ * and dictionaries each have their own meaning. Neither may be known when the
+ * AST is lowered, so this is kept until constant propagation knows both, and
+ * replaces it with a new version of name.
+ */
+class PlusAssignment {
+  public:
+    PlusAssignment(Object && v, const std::string & b) : value{std::move(v)}, base{}, var{} {
+        base.name = b;
+    };
+
+    /// The right hand side
+    Object value;
+
+    /// The variable being added to
+    Variable base;
+
     Variable var;
 };
 
 class BasicBlock;
 
+/**
+ * A foreach loop that can't be unrolled until its iterable is known
+ *
+ * The body is lowered once, into blocks that are never reachable from the
+ * program. Once the iterable has been lowered to an array, the loop is
+ * replaced by a copy of the body for each element. In the body, next stands
+ * in for the start of the next iteration, and exit for the block after the
+ * loop; neither is ever used itself.
+ */
+class Foreach {
+  public:
+    Foreach(Object && it, const std::string & i, BasicBlock * b, BasicBlock * n, BasicBlock * e)
+        : iterable{std::move(it)}, id{i}, body{b}, next{n}, exit{e}, var{} {};
+
+    /// The value being iterated over
+    Object iterable;
+
+    /// The name of the loop variable
+    const std::string id;
+
+    /// The first block of the body
+    BasicBlock * const body;
+
+    /// Where the end of the body, and continue, jump to
+    BasicBlock * const next;
+
+    /// Where break jumps to
+    BasicBlock * const exit;
+
+    Variable var;
+};
+
 /**
  * A sort of phi-like thing that holds a condition and two branches
  *
- * We use shared ptrs as it's possible for the
+ * The branches are owned by the BlockArena, the condition only points at them.
  */
 class Condition {
   public:
-    Condition(Object && o)
-        : condition{std::move(o)}, if_true{std::make_unique<BasicBlock>()},
-          // We could save a bit of memory here by not initializing if_false, but
-          // that means more manual tracking for a tiny savings…
-          if_false{std::make_unique<BasicBlock>()} {};
+    // We could save a bit of memory here by not initializing if_false, but
+    // that means more manual tracking for a tiny savings…
+    Condition(Object && o, BlockArena & arena);
+
+    /// A condition between two blocks that already exist
+    Condition(Object && o, BasicBlock * t, BasicBlock * f);
 
     /// An object that is the condition
     Object condition;
 
     /// The branch to take if the condition is true
-    std::shared_ptr<BasicBlock> if_true;
+    BasicBlock * if_true;
 
     /// The branch to take if the condition is false
-    std::shared_ptr<BasicBlock> if_false;
+    BasicBlock * if_false;
 };
 
 /**
@@ -239,6 +415,9 @@ class Condition {
  * On the other hand 1 does not make any unconditional jumps, and it uses the
  * condition node to set a condition as to whether it goes to 2 or 3.
  *
+ * BasicBlocks do not own each other, all of the links are plain pointers into
+ * a BlockArena.
+ *
  * TOOD: maybe it's better to use a variant/union?
  *
  */
@@ -253,7 +432,103 @@ class BasicBlock {
     std::optional<Condition> condition;
 
     /// The next basic block to go to.
-    std::shared_ptr<BasicBlock> next;
+    BasicBlock * next;
+};
+
+/**
+ * Owns every BasicBlock and MIR object created for one configure run
+ *
+ * Blocks and objects are created in chunks of memory that never move, so
+ * other blocks can safely point at them. The containers that objects hold,
+ * like the arguments of a function call, take their memory from the arena as
+ * well. Nothing is freed until the arena itself is destroyed, at which point
+ * the whole graph goes at once, instead of piece by piece.
+ */
+class BlockArena {
+  public:
+    BlockArena();
+    BlockArena(BlockArena &&) = default;
+    BlockArena(const BlockArena &) = delete;
+    ~BlockArena(){};
+
+    BlockArena & operator=(BlockArena &&) = delete;
+
+    /// Create a new, empty, BasicBlock owned by this arena
+    BasicBlock * new_block();
+
+    /// The number of blocks this arena has created
+    size_t size() const;
+
+    /**
+     * Create a new object owned by this arena
+     *
+     * Objects that hold containers are given the arena's allocator for them.
+     */
+    template <typename T, typename... Args> Ptr<T> make(Args &&... args) {
+        void * mem = contents->memory.allocate(sizeof(T), alignof(T));
+        if constexpr (std::uses_allocator_v<T, Allocator>) {
+            return Ptr<T>{new (mem) T(std::forward<Args>(args)..., allocator())};
+        } else {
+            return Ptr<T>{new (mem) T(std::forward<Args>(args)...)};
+        }
+    }
+
+    /// An allocator for containers that belong in this arena
+    Allocator allocator() const;
+
+  private:
+    /**
+     * The memory everything in the arena is made in
+     *
+     * Memory is only ever handed out, never given back, until it is all
+     * released at once. Passes may create objects from multiple threads, so
+     * handing it out is locked.
+     */
+    class Memory : public std::pmr::memory_resource {
+      public:
+        Memory() : lock{}, buffer{} {};
+
+      private:
+        void * do_allocate(std::size_t, std::size_t) override;
+        void do_deallocate(void *, std::size_t, std::size_t) override{};
+        bool do_is_equal(const std::pmr::memory_resource &) const noexcept override;
+
+        std::mutex lock;
+        std::pmr::monotonic_buffer_resource buffer;
+    };
+
+    /**
+     * Everything the arena holds
+     *
+     * This is kept behind a pointer so that nothing in it moves with the
+     * arena, as objects point back at the memory.
+     */
+    class Contents {
+      public:
+        Contents() : memory{}, blocks{&memory} {};
+
+        /// This must outlive the blocks
+        Memory memory;
+
+        std::pmr::deque<BasicBlock> blocks;
+    };
+
+    std::unique_ptr<Contents> contents;
+};
+
+/**
+ * The entry BasicBlock of a lowered program
+ *
+ * This owns the arena that all of the other blocks in the program live in, so
+ * it must outlive any pointers to those blocks.
+ */
+class Program : public BasicBlock {
+  public:
+    Program() : BasicBlock{}, arena{} {};
+    Program(Program &&) = default;
+    ~Program();
+
+    BlockArena arena;
 };
 
 } // namespace MIR
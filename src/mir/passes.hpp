@@ -7,6 +7,15 @@
 
 #pragma once
 
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
 #include "machines.hpp"
 #include "mir.hpp"
 #include "state/state.hpp"
@@ -15,44 +24,152 @@
 namespace MIR::Passes {
 
 /**
- * Prune dead condition branches
+ * Work outside of the MIR that lowering is waiting on
+ *
+ * Lowering an instruction may need a result that takes time to produce, like
+ * running the compiler. Instead of blocking a walker, a pass starts that work
+ * here, on the global thread pool, and leaves the instruction alone. When no
+ * pass can make progress, MIR::lower waits for the next piece of work to
+ * finish, and then only the instructions that were waiting on it are lowered
+ * again, so any number of them can be running at once without sweeping the
+ * IR while nothing has changed.
+ */
+class Pending {
+  public:
+    Pending() : finished{}, waiting{}, resumed{std::nullopt}, lock{}, cond{}, running{} {};
+    ~Pending();
+
+    Pending(const Pending &) = delete;
+    Pending & operator=(const Pending &) = delete;
+
+    /**
+     * Run work in the background, unless work with the same key is running
+     *
+     * The instruction is lowered again once the work finishes. Safe to call
+     * from multiple threads.
+     */
+    void start(const void * key, std::function<void()> && work, const Object & instruction);
+
+    /**
+     * Wait for at least one piece of work to finish
+     *
+     * Afterwards, only the instructions that were waiting on the work that
+     * finished are ready, until resume_all() is called. Rethrows any exception
+     * that the work threw. Returns false without waiting if nothing is
+     * running.
+     */
+    bool wait();
+
+    /// Make every instruction ready again, once the program has changed
+    void resume_all();
+
+    /// Should the passes lower this instruction?
+    bool ready(const Object & instruction) const;
+
+  private:
+    std::vector<const void *> finished;
+
+    /// The instructions waiting on each piece of work
+    std::unordered_map<const void *, std::vector<const Object *>> waiting;
+
+    /// If set, the only instructions that are ready
+    std::optional<std::unordered_set<const Object *>> resumed;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::unordered_map<const void *, std::future<void>> running;
+};
+
+/**
+ * Simplify the control flow graph in one sweep
  *
- * Once we've been able to lower away conditions in the condition ndoes we want
- * to trim away dead branches and join the ir lists together so we end up with a
- * single flat list of Objects.
+ * Once conditions have been lowered to booleans we want to trim away dead
+ * branches and join the blocks together, so we end up with as few blocks as
+ * possible. Each condition that has been lowered to a boolean is replaced with
+ * the branch it takes, and each straight line chain of blocks reachable from
+ * the root is merged into one. Blocks that more than one live block jump to
+ * are left alone.
  */
-bool branch_pruning(BasicBlock *);
+bool simplify_cfg(BasicBlock *);
 
 /**
- * Join basic blocks together
+ * Give each definition of a variable its own version
  *
- * Specifically for use after branch_pruning, when we have two continguous
- * blocks with no condition to move between thme
+ * Also records which version each `+=` extends. That is only known for
+ * versions defined earlier in the same block, the rest are filled in once
+ * simplify_cfg has joined the block to the ones before it.
  */
-bool join_blocks(BasicBlock *);
+bool value_numbering(BasicBlock *);
+
+/**
+ * Replace uses of variables with a copy of their value
+ *
+ * This only happens once the value is completely lowered, and once its
+ * definition is in the same block as the use, with no foreach loop that
+ * hasn't been unrolled in between. Arrays and dictionaries built
+ * with `+=` are copied whole.
+ *
+ * Each `+=` is also replaced by the new version of its variable, once the
+ * version it extends and the value being added are both known.
+ */
+bool constant_propagation(BasicBlock *, BlockArena &);
+
+/**
+ * Unroll foreach loops once their iterable is known
+ *
+ * Each loop that iterates over an array is replaced with a copy of its body
+ * for each element, in new blocks from the arena, which simplify_cfg then
+ * joins back together.
+ */
+bool unroll_foreach(BasicBlock *, BlockArena &);
 
 /**
  * Lower away machine related information.
  *
  * This replaces function calls to `host_machine`, `build_machine`, and
- * `target_machine` methods with their values.
+ * `target_machine` methods with their values. The build machine is described
+ * by the compiler for the project's language, so the calls wait for it to be
+ * found in the background. Without a language, the machine meson++ was built
+ * for is used.
  */
-bool machine_lower(BasicBlock *, const MIR::Machines::PerMachine<MIR::Machines::Info> &);
+bool machine_lower(BasicBlock *, BlockArena &, MIR::Machines::PerMachine<MIR::Machines::Info> &,
+                   const std::unordered_map<
+                       MIR::Toolchain::Language,
+                       MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>> &,
+                   Pending &);
 
 /**
  * Run complier detection code and replace variables with compiler objects.
+ *
+ * A compiler that hasn't been found yet is searched for in the background,
+ * and the call is replaced once it has been.
  */
-bool insert_compilers(BasicBlock *,
+bool insert_compilers(BasicBlock *, BlockArena &,
                       const std::unordered_map<
                           MIR::Toolchain::Language,
-                          MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>> &);
+                          MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>> &,
+                      Pending &);
+
+/**
+ * Lower calls to the methods of compiler objects
+ *
+ * Each call is lowered once its arguments are, and the compiler it is called
+ * on is defined earlier in the same block. The checks made by all of the
+ * calls in the block, such as has_header, sizeof, and has_argument, are sent
+ * to the compiler together, so that independent checks share invocations.
+ * Checks that haven't been made yet are run in the background, and the calls
+ * are lowered once they have finished.
+ */
+bool lower_compiler_methods(BasicBlock *, BlockArena &, Pending &);
 
 /**
  * Lowering for free functions
  *
  * This lowers free standing functions (those not part of an object/namespace).
+ * A target that needs a compiler which hasn't been found yet waits for it to
+ * be found in the background.
  */
-bool lower_free_functions(BasicBlock *, const State::Persistant &);
+bool lower_free_functions(BasicBlock *, BlockArena &, const State::Persistant &, Pending &);
 
 /**
  * Flatten array arguments to functions.
@@ -74,6 +191,6 @@ bool lower_free_functions(BasicBlock *, const State::Persistant &);
  * Meson++ uses this pass to flatten arguments, building an idealized set of
  * arguments for each function.
  */
-bool flatten(BasicBlock *, const State::Persistant &);
+bool flatten(BasicBlock *, BlockArena &, const State::Persistant &);
 
 } // namespace MIR::Passes
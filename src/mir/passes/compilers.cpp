@@ -1,6 +1,8 @@
 // SPDX-license-identifier: Apache-2.0
 // Copyright © 2021 Dylan Baker
 
+#include <algorithm>
+#include <functional>
 #include <stdexcept>
 
 #include "exceptions.hpp"
@@ -15,11 +17,13 @@ using ToolchainMap =
     std::unordered_map<MIR::Toolchain::Language,
                        MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>>;
 
-std::optional<Object> replace_compiler(const Object & obj, const ToolchainMap & tc) {
-    if (!std::holds_alternative<std::unique_ptr<FunctionCall>>(obj)) {
+std::optional<Object> replace_compiler(const Object & obj, const Object & instr,
+                                       BlockArena & arena, const ToolchainMap & tc,
+                                       Pending & pending) {
+    if (!std::holds_alternative<Ptr<FunctionCall>>(obj)) {
         return std::nullopt;
     }
-    const auto & f = std::get<std::unique_ptr<FunctionCall>>(obj);
+    const auto & f = std::get<Ptr<FunctionCall>>(obj);
 
     // XXX: this seems like a bug
     if (f.get() == nullptr) {
@@ -33,39 +37,207 @@ std::optional<Object> replace_compiler(const Object & obj, const ToolchainMap &
     // XXX: if there is no argument here this is going to blow up spectacularly
     const auto & l = f->pos_args[0];
     // If we haven't reduced this to a string then we need to wait and try again later
-    if (!std::holds_alternative<std::unique_ptr<String>>(l)) {
+    if (!std::holds_alternative<Ptr<String>>(l)) {
         return std::nullopt;
     }
 
-    const auto lang = MIR::Toolchain::from_string(std::get<std::unique_ptr<String>>(l)->value);
+    const auto lang = MIR::Toolchain::from_string(std::get<Ptr<String>>(l)->value);
 
     MIR::Machines::Machine m;
     try {
         const auto & n = f->kw_args.at("native");
         // If we haven't lowered this away yet, then we can't reduce this.
-        if (!std::holds_alternative<std::unique_ptr<Boolean>>(n)) {
+        if (!std::holds_alternative<Ptr<Boolean>>(n)) {
             return std::nullopt;
         }
-        const auto & native = std::get<std::unique_ptr<Boolean>>(n)->value;
+        const auto & native = std::get<Ptr<Boolean>>(n)->value;
 
         m = native ? MIR::Machines::Machine::BUILD : MIR::Machines::Machine::HOST;
     } catch (std::out_of_range &) {
         m = MIR::Machines::Machine::HOST;
     }
 
+    std::shared_ptr<MIR::Toolchain::Toolchain> toolchain;
     try {
-        return std::make_unique<Compiler>(tc.at(lang).get(m));
+        toolchain = tc.at(lang).get(m);
     } catch (std::out_of_range &) {
         // TODO: add a better error message
         throw Util::Exceptions::MesonException{"No compiler for language"};
     }
+
+    // Don't block the walker while the compiler is found, come back to this
+    // call once it has been.
+    if (!toolchain->has_compiler()) {
+        pending.start(
+            toolchain.get(), [toolchain]() { (void)toolchain->compiler(); }, instr);
+        return std::nullopt;
+    }
+
+    return arena.make<Compiler>(toolchain);
+}
+
+using Method = const Object (Compiler::*)(const std::pmr::vector<Object> &,
+                                          const std::pmr::unordered_map<std::string, Object> &,
+                                          BlockArena &) const;
+
+const std::unordered_map<std::string, Method> METHODS{
+    {"get_id", &Compiler::get_id},
+    {"has_header", &Compiler::has_header},
+    {"has_argument", &Compiler::has_argument},
+    {"get_supported_arguments", &Compiler::get_supported_arguments},
+    {"compiles", &Compiler::compiles},
+    {"links", &Compiler::links},
+    {"sizeof", &Compiler::size_of},
+};
+
+/// Can this be passed to a compiler method, or does it still need lowering?
+bool is_lowered(const Object & obj) {
+    if (const auto * arr = std::get_if<Ptr<Array>>(&obj)) {
+        return std::all_of((*arr)->value.begin(), (*arr)->value.end(), is_lowered);
+    }
+    if (const auto * dict = std::get_if<Ptr<Dict>>(&obj)) {
+        return std::all_of((*dict)->value.begin(), (*dict)->value.end(),
+                           [](const auto & kv) { return is_lowered(kv.second); });
+    }
+    return !(std::holds_alternative<Ptr<FunctionCall>>(obj) ||
+             std::holds_alternative<Ptr<Identifier>>(obj) ||
+             std::holds_alternative<Ptr<Foreach>>(obj) ||
+             std::holds_alternative<Ptr<PlusAssignment>>(obj));
+}
+
+/// A call to a method of a compiler, which is ready to be lowered
+struct MethodCall {
+    Object * call;
+    const Compiler * compiler;
+
+    /// The instruction the call is in
+    const Object * instruction;
+};
+
+using Compilers = std::unordered_map<std::string, const Compiler *>;
+
+/// Find the calls to compiler methods in an object, including in its arguments
+void find_calls(Object & obj, const Object & instr, const Compilers & compilers,
+                std::vector<MethodCall> & calls) {
+    if (auto * arr = std::get_if<Ptr<Array>>(&obj)) {
+        for (auto & e : (*arr)->value) {
+            find_calls(e, instr, compilers, calls);
+        }
+    } else if (auto * dict = std::get_if<Ptr<Dict>>(&obj)) {
+        for (auto & [_, v] : (*dict)->value) {
+            find_calls(v, instr, compilers, calls);
+        }
+    } else if (auto * loop = std::get_if<Ptr<Foreach>>(&obj)) {
+        find_calls((*loop)->iterable, instr, compilers, calls);
+    } else if (auto * add = std::get_if<Ptr<PlusAssignment>>(&obj)) {
+        find_calls((*add)->value, instr, compilers, calls);
+    } else if (auto * func = std::get_if<Ptr<FunctionCall>>(&obj)) {
+        auto & f = **func;
+        for (auto & a : f.pos_args) {
+            find_calls(a, instr, compilers, calls);
+        }
+        for (auto & [_, a] : f.kw_args) {
+            find_calls(a, instr, compilers, calls);
+        }
+
+        const auto found = compilers.find(f.holder.value_or(""));
+        if (found == compilers.end() || !std::all_of(f.pos_args.begin(), f.pos_args.end(),
+                                                     is_lowered)) {
+            return;
+        }
+        if (!std::all_of(f.kw_args.begin(), f.kw_args.end(),
+                         [](const auto & kv) { return is_lowered(kv.second); })) {
+            return;
+        }
+        calls.emplace_back(MethodCall{&obj, found->second, &instr});
+    }
+}
+
+/// Replace a call to a compiler method with its result, keeping the variable it's stored to
+void lower_call(const MethodCall & mc, BlockArena & arena) {
+    const auto & f = std::get<Ptr<FunctionCall>>(*mc.call);
+    const auto method = METHODS.find(f->name);
+    if (method == METHODS.end()) {
+        throw Util::Exceptions::MesonException{f->holder.value() + " has no method " + f->name};
+    }
+
+    const auto var = f->var;
+    auto result = (mc.compiler->*method->second)(f->pos_args, f->kw_args, arena);
+    std::visit([&](const auto & o) { o->var = var; }, result);
+    *mc.call = std::move(result);
 }
 
 } // namespace
 
-bool insert_compilers(BasicBlock * block, const ToolchainMap & toolchains) {
-    auto cb = [&](const Object & obj) { return replace_compiler(obj, toolchains); };
-    return function_walker(block, cb);
+bool insert_compilers(BasicBlock * block, BlockArena & arena, const ToolchainMap & toolchains,
+                      Pending & pending) {
+    auto cb = [&](const Object & obj, const Object & instr) {
+        return replace_compiler(obj, instr, arena, toolchains, pending);
+    };
+    return function_walker(block, cb, pending);
+};
+
+bool lower_compiler_methods(BasicBlock * block, BlockArena & arena, Pending & pending) {
+    // Calls can only be lowered once the compiler they are called on is
+    // defined before them in the same block
+    Compilers compilers{};
+    std::vector<MethodCall> calls{};
+    for (auto & i : block->instructions) {
+        // Only the calls that are ready are lowered, but the compilers are
+        // still needed from every instruction
+        if (pending.ready(i)) {
+            find_calls(i, i, compilers, calls);
+        }
+
+        const auto var = std::visit([](const auto & o) { return o->var; }, i);
+        if (!var) {
+            continue;
+        }
+        if (const auto * c = std::get_if<Ptr<Compiler>>(&i)) {
+            compilers[var.name] = c->get();
+        } else {
+            compilers.erase(var.name);
+        }
+    }
+    if (block->condition.has_value() && pending.ready(block->condition->condition)) {
+        auto & con = block->condition->condition;
+        find_calls(con, con, compilers, calls);
+    }
+    if (calls.empty()) {
+        return false;
+    }
+
+    // Run the checks of every call to each compiler together, so that lowering
+    // each call only has to look up its result
+    std::unordered_map<const Compiler *, std::vector<const FunctionCall *>> by_compiler{};
+    for (const auto & mc : calls) {
+        by_compiler[mc.compiler].emplace_back(
+            std::get<Ptr<FunctionCall>>(*mc.call).get());
+    }
+
+    // Checks that haven't been made yet are run in the background, and the
+    // calls that need them are lowered once they are finished
+    std::unordered_map<const Compiler *, std::function<void()>> waiting{};
+    for (const auto & [compiler, funcs] : by_compiler) {
+        auto work = compiler->prepare(funcs);
+        if (work != nullptr) {
+            waiting.emplace(compiler, std::move(work));
+        }
+    }
+
+    bool progress = false;
+    for (const auto & mc : calls) {
+        const auto w = waiting.find(mc.compiler);
+        if (w == waiting.end()) {
+            lower_call(mc, arena);
+            progress = true;
+            continue;
+        }
+        // Only the first call starts the work, the rest just wait on it
+        pending.start(&mc.compiler->toolchain->checker(), std::move(w->second),
+                      *mc.instruction);
+    }
+    return progress;
 };
 
 } // namespace MIR::Passes
@@ -2,6 +2,8 @@
 // SPDX-license-identifier: Apache-2.0
 // Copyright © 2021 Dylan Baker
 
+#include <algorithm>
+
 #include "passes.hpp"
 #include "private.hpp"
 
@@ -10,10 +12,10 @@ namespace MIR::Passes {
 namespace {
 
 /// Recursively call this to flatten nested arrays to function calls
-void do_flatten(const std::unique_ptr<Array> & arr, std::vector<Object> & newarr) {
+void do_flatten(const Ptr<Array> & arr, std::pmr::vector<Object> & newarr) {
     for (auto & e : arr->value) {
-        if (std::holds_alternative<std::unique_ptr<Array>>(e)) {
-            do_flatten(std::get<std::unique_ptr<Array>>(e), newarr);
+        if (std::holds_alternative<Ptr<Array>>(e)) {
+            do_flatten(std::get<Ptr<Array>>(e), newarr);
         } else {
             newarr.emplace_back(std::move(e));
         }
@@ -23,24 +25,34 @@ void do_flatten(const std::unique_ptr<Array> & arr, std::vector<Object> & newarr
 /**
  * Flatten arrays when passed as arguments to functions.
  */
-std::optional<Object> flatten_cb(const Object & obj) {
-    if (!std::holds_alternative<std::unique_ptr<Array>>(obj)) {
+std::optional<Object> flatten_cb(const Object & obj, BlockArena & arena) {
+    if (!std::holds_alternative<Ptr<Array>>(obj)) {
+        return std::nullopt;
+    }
+
+    const auto & arr = std::get<Ptr<Array>>(obj);
+
+    // Without any nested arrays there's nothing to do, and no progress made
+    if (std::none_of(arr->value.begin(), arr->value.end(), [](const Object & e) {
+            return std::holds_alternative<Ptr<Array>>(e);
+        })) {
         return std::nullopt;
     }
 
-    const auto & arr = std::get<std::unique_ptr<Array>>(obj);
-    std::vector<Object> newarr{};
-    do_flatten(arr, newarr);
+    auto flat = arena.make<Array>();
+    do_flatten(arr, flat->value);
 
-    return std::make_unique<Array>(std::move(newarr));
+    return flat;
 }
 
 } // namespace
 
-bool flatten(BasicBlock * block, const State::Persistant & pstate) {
+bool flatten(BasicBlock * block, BlockArena & arena, const State::Persistant & pstate) {
+    const auto cb = [&](const Object & obj) { return flatten_cb(obj, arena); };
+
     // TODO: we need to skip this for message, error, and warning
     bool progress = instruction_walker(
-        block, {[&](Object & obj) { return function_argument_walker(obj, flatten_cb); }});
+        block, {[&](Object & obj) { return function_argument_walker(obj, cb); }});
 
     return progress;
 }
@@ -0,0 +1,224 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Dylan Baker
+
+#include <unordered_map>
+
+#include "exceptions.hpp"
+#include "passes.hpp"
+#include "private.hpp"
+
+namespace MIR::Passes {
+
+namespace {
+
+/// A copy of a variable, without the version, as the copy is a new definition
+Variable clone(const Variable & var) {
+    Variable v{};
+    v.name = var.name;
+    return v;
+}
+
+Object clone(const Object & obj, BlockArena & arena);
+
+std::pmr::vector<Object> clone(const std::pmr::vector<Object> & objs, BlockArena & arena) {
+    std::pmr::vector<Object> copy{arena.allocator()};
+    copy.reserve(objs.size());
+    for (const auto & o : objs) {
+        copy.emplace_back(clone(o, arena));
+    }
+    return copy;
+}
+
+std::pmr::unordered_map<std::string, Object>
+clone(const std::pmr::unordered_map<std::string, Object> & objs, BlockArena & arena) {
+    std::pmr::unordered_map<std::string, Object> copy{arena.allocator()};
+    for (const auto & [k, o] : objs) {
+        copy[k] = clone(o, arena);
+    }
+    return copy;
+}
+
+/// Make a deep copy of an instruction
+Object clone(const Object & obj, BlockArena & arena) {
+    if (const auto * v = std::get_if<Ptr<FunctionCall>>(&obj)) {
+        auto f = arena.make<FunctionCall>((*v)->name, clone((*v)->pos_args, arena),
+                                          clone((*v)->kw_args, arena), (*v)->source_dir);
+        f->holder = (*v)->holder;
+        f->var = clone((*v)->var);
+        return f;
+    }
+    if (const auto * v = std::get_if<Ptr<String>>(&obj)) {
+        auto s = arena.make<String>((*v)->value);
+        s->var = clone((*v)->var);
+        return s;
+    }
+    if (const auto * v = std::get_if<Ptr<Boolean>>(&obj)) {
+        auto b = arena.make<Boolean>((*v)->value);
+        b->var = clone((*v)->var);
+        return b;
+    }
+    if (const auto * v = std::get_if<Ptr<Number>>(&obj)) {
+        auto n = arena.make<Number>((*v)->value);
+        n->var = clone((*v)->var);
+        return n;
+    }
+    if (const auto * v = std::get_if<Ptr<Identifier>>(&obj)) {
+        auto i = arena.make<Identifier>((*v)->value);
+        i->var = clone((*v)->var);
+        return i;
+    }
+    if (const auto * v = std::get_if<Ptr<Array>>(&obj)) {
+        auto a = arena.make<Array>(clone((*v)->value, arena));
+        a->var = clone((*v)->var);
+        a->base = clone((*v)->base);
+        return a;
+    }
+    if (const auto * v = std::get_if<Ptr<Dict>>(&obj)) {
+        auto d = arena.make<Dict>();
+        d->value = clone((*v)->value, arena);
+        d->var = clone((*v)->var);
+        d->base = clone((*v)->base);
+        return d;
+    }
+    if (const auto * v = std::get_if<Ptr<Compiler>>(&obj)) {
+        auto c = arena.make<Compiler>((*v)->toolchain);
+        c->var = clone((*v)->var);
+        return c;
+    }
+    if (const auto * v = std::get_if<Ptr<File>>(&obj)) {
+        auto f = arena.make<File>((*v)->file);
+        f->var = clone((*v)->var);
+        return f;
+    }
+    if (const auto * v = std::get_if<Ptr<Executable>>(&obj)) {
+        auto e = arena.make<Executable>((*v)->value);
+        e->var = clone((*v)->var);
+        return e;
+    }
+    if (const auto * v = std::get_if<Ptr<StaticLibrary>>(&obj)) {
+        auto s = arena.make<StaticLibrary>((*v)->value);
+        s->var = clone((*v)->var);
+        return s;
+    }
+    if (const auto * v = std::get_if<Ptr<PlusAssignment>>(&obj)) {
+        auto p = arena.make<PlusAssignment>(clone((*v)->value, arena), (*v)->base.name);
+        p->var = clone((*v)->var);
+        return p;
+    }
+    // The body of a nested loop is never changed, so the copies can share it
+    const auto & f = std::get<Ptr<Foreach>>(obj);
+    auto copy = arena.make<Foreach>(clone(f->iterable, arena), f->id, f->body, f->next, f->exit);
+    copy->var = clone(f->var);
+    return copy;
+}
+
+/**
+ * Copy the blocks of a loop body
+ *
+ * The placeholders of the loop are replaced by the blocks given, every
+ * other block reachable from the body is copied. Returns the copy of the
+ * first block.
+ */
+BasicBlock * clone_body(const Foreach & loop, BasicBlock * next, BasicBlock * exit,
+                        BlockArena & arena) {
+    std::unordered_map<const BasicBlock *, BasicBlock *> copies{{loop.next, next},
+                                                                {loop.exit, exit}};
+    std::vector<std::pair<const BasicBlock *, BasicBlock *>> todo{};
+
+    const auto copy_of = [&](const BasicBlock * block) {
+        auto [it, inserted] = copies.emplace(block, nullptr);
+        if (inserted) {
+            it->second = arena.new_block();
+            todo.emplace_back(block, it->second);
+        }
+        return it->second;
+    };
+
+    auto * entry = copy_of(loop.body);
+    while (!todo.empty()) {
+        const auto [from, to] = todo.back();
+        todo.pop_back();
+
+        for (const auto & i : from->instructions) {
+            to->instructions.emplace_back(clone(i, arena));
+        }
+        if (from->condition.has_value()) {
+            const auto & con = from->condition.value();
+            to->condition.emplace(clone(con.condition, arena), copy_of(con.if_true),
+                                  copy_of(con.if_false));
+        }
+        if (from->next != nullptr) {
+            to->next = copy_of(from->next);
+        }
+    }
+
+    return entry;
+}
+
+/**
+ * Replace a loop with a copy of its body for each element
+ *
+ * Everything after the loop is moved into a new block, which the last copy
+ * and any break jump to.
+ */
+void unroll(BasicBlock * block, std::list<Object>::iterator it,
+            const std::vector<const Object *> & elements, BlockArena & arena) {
+    auto * after = arena.new_block();
+    after->instructions.splice(after->instructions.end(), block->instructions, std::next(it),
+                               block->instructions.end());
+    after->condition = std::move(block->condition);
+    block->condition = std::nullopt;
+    after->next = block->next;
+
+    const auto loop = std::move(std::get<Ptr<Foreach>>(*it));
+    block->instructions.erase(it);
+
+    for (const auto * e : elements) {
+        auto value = clone(*e, arena);
+        std::visit([&](const auto & v) { v->var.name = loop->id; }, value);
+        block->instructions.emplace_back(std::move(value));
+
+        auto * next = arena.new_block();
+        block->next = clone_body(*loop, next, after, arena);
+        block = next;
+    }
+    block->next = after;
+}
+
+} // namespace
+
+bool unroll_foreach(BasicBlock * root, BlockArena & arena) {
+    const Definitions no_definitions = [](const Variable &) -> const Object * { return nullptr; };
+
+    bool progress = false;
+    for (auto * block : reachable_blocks(root)) {
+        for (auto it = block->instructions.begin(); it != block->instructions.end(); ++it) {
+            const auto * loop = std::get_if<Ptr<Foreach>>(&*it);
+            if (loop == nullptr) {
+                continue;
+            }
+            const auto & iterable = (*loop)->iterable;
+            if (const auto * arr = std::get_if<Ptr<Array>>(&iterable)) {
+                // The iterable is a literal, or a whole copy made by
+                // constant_propagation, so it never extends another version
+                const auto elements = (*arr)->elements(no_definitions);
+                if (!elements) {
+                    continue;
+                }
+                // The rest of the block has been moved, it will be looked at
+                // the next time this is run
+                unroll(block, it, elements.value(), arena);
+                progress = true;
+                break;
+            }
+            if (!std::holds_alternative<Ptr<FunctionCall>>(iterable) &&
+                !std::holds_alternative<Ptr<Identifier>>(iterable)) {
+                throw Util::Exceptions::InvalidArguments{
+                    "foreach can only iterate over an array"};
+            }
+        }
+    }
+    return progress;
+}
+
+} // namespace MIR::Passes
@@ -1,11 +1,14 @@
 // SPDX-license-identifier: Apache-2.0
 // Copyright © 2021 Dylan Baker
 
+#include <filesystem>
+#include <future>
 #include <iostream>
 #include <vector>
 
 #include "exceptions.hpp"
 #include "log.hpp"
+#include "lower.hpp"
 #include "passes.hpp"
 #include "private.hpp"
 
@@ -14,30 +17,31 @@ namespace MIR::Passes {
 namespace {
 
 // XXX: we probably need access to the source_root and build_root
-std::optional<Object> lower_files(const Object & obj, const State::Persistant & pstate) {
-    if (!std::holds_alternative<std::unique_ptr<FunctionCall>>(obj)) {
+std::optional<Object> lower_files(const Object & obj, BlockArena & arena,
+                                  const State::Persistant & pstate) {
+    if (!std::holds_alternative<Ptr<FunctionCall>>(obj)) {
         return std::nullopt;
     }
-    const auto & f = std::get<std::unique_ptr<FunctionCall>>(obj);
+    const auto & f = std::get<Ptr<FunctionCall>>(obj);
 
     if (f->holder.value_or("") != "" || f->name != "files") {
         return std::nullopt;
     }
 
-    std::vector<Object> files{};
+    auto files = arena.make<Array>();
     for (const auto & arg_h : f->pos_args) {
         // XXX: do something more realistic here
         // This could be Array<STring> and still be valid.
-        if (!std::holds_alternative<std::unique_ptr<String>>(arg_h)) {
+        if (!std::holds_alternative<Ptr<String>>(arg_h)) {
             throw Util::Exceptions::InvalidArguments("Arguments to 'files()' must be strings");
         }
-        auto const & v = std::get<std::unique_ptr<String>>(arg_h);
+        auto const & v = std::get<Ptr<String>>(arg_h);
 
-        files.emplace_back(std::make_unique<File>(
+        files->value.emplace_back(arena.make<File>(
             Objects::File{v->value, f->source_dir, false, pstate.source_root, pstate.build_root}));
     }
 
-    return std::make_unique<Array>(std::move(files));
+    return files;
 }
 
 /**
@@ -55,11 +59,19 @@ std::vector<Objects::File> srclist_to_filelist(const std::vector<Object *> & src
                                                const std::string & subdir) {
     std::vector<Objects::File> filelist{};
     for (const auto & s : srclist) {
-        if (const auto src = std::get_if<std::unique_ptr<String>>(s); src != nullptr) {
+        if (const auto src = std::get_if<Ptr<String>>(s); src != nullptr) {
             filelist.emplace_back(
                 Objects::File{(*src)->value, subdir, false, pstate.source_root, pstate.build_root});
-        } else if (const auto src = std::get_if<std::unique_ptr<File>>(s); s != nullptr) {
+        } else if (const auto src = std::get_if<Ptr<File>>(s); src != nullptr) {
             filelist.emplace_back((*src)->file);
+        } else if (const auto src = std::get_if<Ptr<Array>>(s); src != nullptr) {
+            std::vector<Object *> elements{};
+            for (auto & e : (*src)->value) {
+                elements.emplace_back(&e);
+            }
+            for (const auto & f : srclist_to_filelist(elements, pstate, subdir)) {
+                filelist.emplace_back(f);
+            }
         } else {
             // TODO: there are other valid types here, like generator output and custom targets
             throw Util::Exceptions::InvalidArguments{
@@ -71,26 +83,26 @@ std::vector<Objects::File> srclist_to_filelist(const std::vector<Object *> & src
 }
 
 std::unordered_map<Toolchain::Language, std::vector<Arguments::Argument>>
-target_arguments(const std::unique_ptr<FunctionCall> & f, const State::Persistant & pstate) {
+target_arguments(const Ptr<FunctionCall> & f, const State::Persistant & pstate) {
     std::unordered_map<Toolchain::Language, std::vector<Arguments::Argument>> args{};
 
     // TODO: handle more than just cpp, likely using a loop
     if (f->kw_args.find("cpp_args") != f->kw_args.end()) {
         const auto & args_obj = f->kw_args["cpp_args"];
-        const auto & comp = pstate.toolchains.at(Toolchain::Language::CPP).build()->compiler;
-        if (std::holds_alternative<std::unique_ptr<String>>(args_obj)) {
-            const auto & v = std::get<std::unique_ptr<String>>(args_obj)->value;
+        const auto & comp = pstate.toolchains.at(Toolchain::Language::CPP).build()->compiler();
+        if (std::holds_alternative<Ptr<String>>(args_obj)) {
+            const auto & v = std::get<Ptr<String>>(args_obj)->value;
             args[Toolchain::Language::CPP] =
                 std::vector<Arguments::Argument>{comp->generalize_argument(v)};
-        } else if (std::holds_alternative<std::unique_ptr<Array>>(args_obj)) {
+        } else if (std::holds_alternative<Ptr<Array>>(args_obj)) {
             std::vector<Arguments::Argument> cpp_args{};
-            const auto & raw_args = std::get<std::unique_ptr<Array>>(args_obj)->value;
+            const auto & raw_args = std::get<Ptr<Array>>(args_obj)->value;
             for (const auto & ra : raw_args) {
-                if (!std::holds_alternative<std::unique_ptr<String>>(ra)) {
+                if (!std::holds_alternative<Ptr<String>>(ra)) {
                     throw Util::Exceptions::MesonException{"\"cpp_args\" must be strings"};
                 }
                 // TODO need to lower this
-                const auto & a = std::get<std::unique_ptr<String>>(ra)->value;
+                const auto & a = std::get<Ptr<String>>(ra)->value;
                 cpp_args.emplace_back(comp->generalize_argument(a));
             }
 
@@ -104,11 +116,58 @@ target_arguments(const std::unique_ptr<FunctionCall> & f, const State::Persistan
     return args;
 }
 
-std::optional<Object> lower_executable(const Object & obj, const State::Persistant & pstate) {
-    if (!std::holds_alternative<std::unique_ptr<FunctionCall>>(obj)) {
+/// The directory a function was called from, relative to the source root
+std::filesystem::path source_subdir(const Ptr<FunctionCall> & f,
+                                    const State::Persistant & pstate) {
+    // The source_dir is relative to the build root
+    const auto dir =
+        std::filesystem::relative(pstate.build_root / f->source_dir, pstate.source_root);
+    return dir == "." ? "" : dir;
+}
+
+/// The pool a target asked for with the `pool` keyword, or empty if it didn't
+std::string target_pool(const Ptr<FunctionCall> & f) {
+    const auto found = f->kw_args.find("pool");
+    if (found == f->kw_args.end()) {
+        return "";
+    }
+    if (!std::holds_alternative<Ptr<String>>(found->second)) {
+        throw Util::Exceptions::InvalidArguments{f->name + " pool must be a string"};
+    }
+    const auto & pool = std::get<Ptr<String>>(found->second)->value;
+    // Every link is already in the link pool, so that can't be asked for
+    if (pool != "heavy_compile") {
+        throw Util::Exceptions::InvalidArguments{f->name + " pool must be 'heavy_compile'"};
+    }
+    return pool;
+}
+
+/**
+ * Has the compiler that target_arguments uses been found?
+ *
+ * If it hasn't, it is found in the background rather than blocking the
+ * walker, and the target is lowered once it has been.
+ */
+bool compiler_found(const Ptr<FunctionCall> & f, const Object & instr,
+                    const State::Persistant & pstate, Pending & pending) {
+    if (f->kw_args.find("cpp_args") == f->kw_args.end()) {
+        return true;
+    }
+    const auto & tc = pstate.toolchains.at(Toolchain::Language::CPP).build();
+    if (tc->has_compiler()) {
+        return true;
+    }
+    pending.start(tc.get(), [tc]() { (void)tc->compiler(); }, instr);
+    return false;
+}
+
+std::optional<Object> lower_executable(const Object & obj, const Object & instr,
+                                       BlockArena & arena, const State::Persistant & pstate,
+                                       Pending & pending) {
+    if (!std::holds_alternative<Ptr<FunctionCall>>(obj)) {
         return std::nullopt;
     }
-    const auto & f = std::get<std::unique_ptr<FunctionCall>>(obj);
+    const auto & f = std::get<Ptr<FunctionCall>>(obj);
 
     if (f->holder.value_or("") != "" || f->name != "executable") {
         return std::nullopt;
@@ -118,11 +177,15 @@ std::optional<Object> lower_executable(const Object & obj, const State::Persista
     if (f->pos_args.size() < 2) {
         throw Util::Exceptions::InvalidArguments{"executable requires at least 2 arguments"};
     }
-    if (!std::holds_alternative<std::unique_ptr<String>>(f->pos_args[0])) {
+    if (!std::holds_alternative<Ptr<String>>(f->pos_args[0])) {
         // TODO: it could also be an identifier pointing to a string
         throw Util::Exceptions::InvalidArguments{"executable first argument must be a string"};
     }
-    const auto & name = std::get<std::unique_ptr<String>>(f->pos_args[0])->value;
+    const auto & name = std::get<Ptr<String>>(f->pos_args[0])->value;
+
+    if (!compiler_found(f, instr, pstate, pending)) {
+        return std::nullopt;
+    }
 
     // skip the first argument
     std::vector<Object *> raw_srcs{};
@@ -134,16 +197,23 @@ std::optional<Object> lower_executable(const Object & obj, const State::Persista
     auto args = target_arguments(f, pstate);
 
     // TODO: machien parameter needs to be set from the native kwarg
-    Objects::Executable exe{name, srcs, Machines::Machine::BUILD, args};
-
-    return std::make_unique<Executable>(exe);
+    Objects::Executable exe{name,
+                            srcs,
+                            Machines::Machine::BUILD,
+                            source_subdir(f, pstate),
+                            args,
+                            target_pool(f)};
+
+    return arena.make<Executable>(exe);
 }
 
-std::optional<Object> lower_static_library(const Object & obj, const State::Persistant & pstate) {
-    if (!std::holds_alternative<std::unique_ptr<FunctionCall>>(obj)) {
+std::optional<Object> lower_static_library(const Object & obj, const Object & instr,
+                                           BlockArena & arena, const State::Persistant & pstate,
+                                           Pending & pending) {
+    if (!std::holds_alternative<Ptr<FunctionCall>>(obj)) {
         return std::nullopt;
     }
-    const auto & f = std::get<std::unique_ptr<FunctionCall>>(obj);
+    const auto & f = std::get<Ptr<FunctionCall>>(obj);
 
     if (f->holder.value_or("") != "" || f->name != "static_library") {
         return std::nullopt;
@@ -153,11 +223,15 @@ std::optional<Object> lower_static_library(const Object & obj, const State::Pers
     if (f->pos_args.size() < 2) {
         throw Util::Exceptions::InvalidArguments{"static_library requires at least 2 arguments"};
     }
-    if (!std::holds_alternative<std::unique_ptr<String>>(f->pos_args[0])) {
+    if (!std::holds_alternative<Ptr<String>>(f->pos_args[0])) {
         // TODO: it could also be an identifier pointing to a string
         throw Util::Exceptions::InvalidArguments{"static_library first argument must be a string"};
     }
-    const auto & name = std::get<std::unique_ptr<String>>(f->pos_args[0])->value;
+    const auto & name = std::get<Ptr<String>>(f->pos_args[0])->value;
+
+    if (!compiler_found(f, instr, pstate, pending)) {
+        return std::nullopt;
+    }
 
     // skip the first argument
     std::vector<Object *> raw_srcs{};
@@ -169,21 +243,82 @@ std::optional<Object> lower_static_library(const Object & obj, const State::Pers
     auto args = target_arguments(f, pstate);
 
     // TODO: machien parameter needs to be set from the native kwarg
-    Objects::StaticLibrary lib{name, srcs, Machines::Machine::BUILD, args};
+    Objects::StaticLibrary lib{name,
+                               srcs,
+                               Machines::Machine::BUILD,
+                               source_subdir(f, pstate),
+                               args,
+                               target_pool(f)};
+
+    return arena.make<StaticLibrary>(lib);
+}
 
-    return std::make_unique<StaticLibrary>(lib);
+/// Get the toolchain for a language in project(), creating it the first time
+std::shared_ptr<Toolchain::Toolchain> project_toolchain(State::Persistant & pstate,
+                                                        const Toolchain::Language & l) {
+    // TODO: need to do host as well, when that is relavent
+    auto & tc = pstate.toolchains[l];
+    if (tc.build() == nullptr) {
+        // Nothing is detected until it is used
+        tc.set(Machines::Machine::BUILD, pstate.toolchain_cache.get(l, Machines::Machine::BUILD));
+    }
+    return tc.build();
 }
 
 } // namespace
 
+void speculate_project(const Frontend::AST::StatementV & stmt, State::Persistant & pstate) {
+    const auto * s = std::get_if<std::unique_ptr<Frontend::AST::Statement>>(&stmt);
+    if (s == nullptr) {
+        return;
+    }
+    const auto * f = std::get_if<std::unique_ptr<Frontend::AST::FunctionCall>>(&(*s)->expr);
+    if (f == nullptr) {
+        return;
+    }
+    const auto * id = std::get_if<std::unique_ptr<Frontend::AST::Identifier>>(&(*f)->id);
+    if (id == nullptr || (*id)->value != "project") {
+        return;
+    }
+
+    const auto & pos = (*f)->args->positional;
+    for (auto it = pos.begin() + std::min<std::size_t>(pos.size(), 1); it != pos.end(); ++it) {
+        const auto * str = std::get_if<std::unique_ptr<Frontend::AST::String>>(&*it);
+        if (str == nullptr) {
+            continue;
+        }
+
+        std::shared_ptr<Toolchain::Toolchain> tc;
+        try {
+            tc = project_toolchain(pstate, Toolchain::from_string((*str)->value));
+        } catch (Util::Exceptions::MesonException &) {
+            continue;
+        }
+
+        // Every language that is used needs its compiler, the linker and
+        // archiver are still only found if a target needs them.
+        pstate.speculative.emplace_back(std::async(std::launch::async, [tc]() {
+            try {
+                (void)tc->compiler();
+            } catch (...) {
+                // Dropping the error is safe: call_once doesn't mark a
+                // detection that threw as done, so the next caller of
+                // compiler() detects again and gets the error itself. A
+                // language without a compiler is only an error if something
+                // needs that compiler.
+            }
+        }));
+    }
+}
+
 void lower_project(BasicBlock * block, State::Persistant & pstate) {
     const auto & obj = block->instructions.front();
 
-    if (!std::holds_alternative<std::unique_ptr<FunctionCall>>(obj)) {
+    if (!std::holds_alternative<Ptr<FunctionCall>>(obj)) {
         throw Util::Exceptions::MesonException{
             "First non-whitespace, non-comment must be a call to project()"};
     }
-    const auto & f = std::get<std::unique_ptr<FunctionCall>>(obj);
+    const auto & f = std::get<Ptr<FunctionCall>>(obj);
 
     if (f->name != "project") {
         throw Util::Exceptions::MesonException{
@@ -194,42 +329,25 @@ void lower_project(BasicBlock * block, State::Persistant & pstate) {
     if (f->pos_args.size() < 1) {
         throw Util::Exceptions::InvalidArguments{"project requires at least 1 argument"};
     }
-    if (!std::holds_alternative<std::unique_ptr<String>>(f->pos_args[0])) {
+    if (!std::holds_alternative<Ptr<String>>(f->pos_args[0])) {
         // TODO: it could also be an identifier pointing to a string
         throw Util::Exceptions::InvalidArguments{"project first argument must be a string"};
     }
-    pstate.name = std::get<std::unique_ptr<String>>(f->pos_args[0])->value;
+    pstate.name = std::get<Ptr<String>>(f->pos_args[0])->value;
     std::cout << "Project name: " << Util::Log::bold(pstate.name) << std::endl;
 
     // The rest of the poisitional arguments are languages
     // TODO: and these could be passed as a list as well.
     for (auto it = f->pos_args.begin() + 1; it != f->pos_args.end(); ++it) {
-        if (!std::holds_alternative<std::unique_ptr<String>>(*it)) {
+        if (!std::holds_alternative<Ptr<String>>(*it)) {
             throw Util::Exceptions::MesonException{
                 "All additional arguments to project must be strings"};
         }
-        const auto & f = std::get<std::unique_ptr<String>>(*it);
+        const auto & f = std::get<Ptr<String>>(*it);
         const auto l = Toolchain::from_string(f->value);
 
-        auto & tc = pstate.toolchains[l];
-
-        // TODO: need to do host as well, when that is relavent
-        tc.set(Machines::Machine::BUILD,
-               std::make_shared<Toolchain::Toolchain>(
-                   Toolchain::get_toolchain(l, Machines::Machine::BUILD)));
-        const auto & c = tc.build()->compiler;
-
-        // TODO: print the print the full version
-        std::cout << c->language()
-                  << " compiler for the for build machine: " << Util::Log::bold(c->id()) << " ("
-                  << ")" << std::endl;
-
-        const auto & lnk = tc.build()->linker;
-
-        // TODO: print the print the full version
-        std::cout << c->language()
-                  << " linker for the for build machine: " << Util::Log::bold(lnk->id()) << " ("
-                  << ")" << std::endl;
+        // This may have already been started by speculate_project
+        project_toolchain(pstate, l);
     }
 
     // TODO: handle keyword arguments
@@ -239,12 +357,13 @@ void lower_project(BasicBlock * block, State::Persistant & pstate) {
     block->instructions.pop_front();
 }
 
-bool lower_free_functions(BasicBlock * block, const State::Persistant & pstate) {
+bool lower_free_functions(BasicBlock * block, BlockArena & arena, const State::Persistant & pstate,
+                          Pending & pending) {
     // clang-format off
     return false
-        || function_walker(block, [&](const Object & obj) { return lower_files(obj, pstate); })
-        || function_walker(block, [&](const Object & obj) { return lower_executable(obj, pstate); })
-        || function_walker(block, [&](const Object & obj) { return lower_static_library(obj, pstate); })
+        || function_walker(block, [&](const Object & obj, const Object &) { return lower_files(obj, arena, pstate); }, pending)
+        || function_walker(block, [&](const Object & obj, const Object & instr) { return lower_executable(obj, instr, arena, pstate, pending); }, pending)
+        || function_walker(block, [&](const Object & obj, const Object & instr) { return lower_static_library(obj, instr, arena, pstate, pending); }, pending)
         ;
     // clang-format on
 }
@@ -26,18 +26,18 @@ std::optional<Machine> machine_map(const std::string & func_name) {
 }
 
 MIR::Object lower_function(const std::string & holder, const std::string & name,
-                           const Info & info) {
+                           const Info & info, BlockArena & arena) {
     if (name == "cpu_family") {
         // TODO: it's probably going to be useful to have a helper for this...
-        return MIR::Object{std::make_unique<MIR::String>(info.cpu_family)};
+        return MIR::Object{arena.make<MIR::String>(info.cpu_family)};
     } else if (name == "cpu") {
         // TODO: it's probably going to be useful to have a helper for this...
-        return MIR::Object{std::make_unique<MIR::String>(info.cpu)};
+        return MIR::Object{arena.make<MIR::String>(info.cpu)};
     } else if (name == "system") {
         // TODO: it's probably going to be useful to have a helper for this...
-        return MIR::Object{std::make_unique<MIR::String>(info.system())};
+        return MIR::Object{arena.make<MIR::String>(info.system())};
     } else if (name == "endian") {
-        return MIR::Object{std::make_unique<MIR::String>(
+        return MIR::Object{arena.make<MIR::String>(
             info.endian == MIR::Machines::Endian::LITTLE ? "little" : "big")};
     } else {
         throw Util::Exceptions::MesonException{holder + " has no method " + name};
@@ -45,17 +45,26 @@ MIR::Object lower_function(const std::string & holder, const std::string & name,
 }
 
 using MachineInfo = MIR::Machines::PerMachine<MIR::Machines::Info>;
+using ToolchainMap =
+    std::unordered_map<Toolchain::Language,
+                       Machines::PerMachine<std::shared_ptr<Toolchain::Toolchain>>>;
 
-std::optional<Object> lower_functions(const MachineInfo & machines, const Object & obj) {
-    if (std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(obj)) {
-        const auto & f = std::get<std::unique_ptr<MIR::FunctionCall>>(obj);
+bool is_machine_call(const Object & obj) {
+    const auto * f = std::get_if<MIR::Ptr<MIR::FunctionCall>>(&obj);
+    return f != nullptr && machine_map((*f)->holder.value_or("")).has_value();
+}
+
+std::optional<Object> lower_functions(const MachineInfo & machines, const Object & obj,
+                                      BlockArena & arena) {
+    if (std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(obj)) {
+        const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(obj);
         const auto & holder = f->holder.value_or("");
 
         auto maybe_m = machine_map(holder);
         if (maybe_m.has_value()) {
             const auto & info = machines.get(maybe_m.value());
 
-            return lower_function(holder, f->name, info);
+            return lower_function(holder, f->name, info, arena);
         }
     }
     return std::nullopt;
@@ -63,10 +72,31 @@ std::optional<Object> lower_functions(const MachineInfo & machines, const Object
 
 } // namespace
 
-bool machine_lower(BasicBlock * block, const MachineInfo & machines) {
-    const auto cb = [&](const Object & o) { return lower_functions(machines, o); };
+bool machine_lower(BasicBlock * block, BlockArena & arena, MachineInfo & machines,
+                   const ToolchainMap & toolchains, Pending & pending) {
+    // The compiler knows better than meson++ does what it's building for, so
+    // the build machine comes from it once it has been found
+    // TODO: this needs to pick one if the project has more than one language
+    std::shared_ptr<Toolchain::Toolchain> tc{};
+    for (const auto & [l, tcs] : toolchains) {
+        if (tcs.build() != nullptr && (tc == nullptr || l < tc->lang)) {
+            tc = tcs.build();
+        }
+    }
+    const bool known = tc == nullptr || tc->has_compiler();
+    if (tc != nullptr && known) {
+        machines.set(Machine::BUILD, tc->compiler()->identity.machine_info(Machine::BUILD));
+    }
+
+    const auto cb = [&](const Object & o, const Object & instr) -> std::optional<Object> {
+        if (!known && is_machine_call(o)) {
+            pending.start(tc.get(), [tc]() { (void)tc->compiler(); }, instr);
+            return std::nullopt;
+        }
+        return lower_functions(machines, o, arena);
+    };
 
-    return function_walker(block, cb);
+    return function_walker(block, cb, pending);
 };
 
 } // namespace MIR::Passes
@@ -0,0 +1,81 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <exception>
+
+#include "passes.hpp"
+#include "threads.hpp"
+
+namespace MIR::Passes {
+
+Pending::~Pending() {
+    // The pool's futures don't wait when they are destroyed, and the work
+    // still uses the lock
+    for (auto & [_, r] : running) {
+        r.wait();
+    }
+}
+
+void Pending::start(const void * key, std::function<void()> && work, const Object & instruction) {
+    std::lock_guard l{lock};
+    waiting[key].emplace_back(&instruction);
+    if (running.find(key) != running.end()) {
+        return;
+    }
+
+    running[key] = Util::global_pool().submit([this, key, work = std::move(work)]() {
+        std::exception_ptr error{};
+        try {
+            work();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard l{lock};
+            finished.emplace_back(key);
+        }
+        cond.notify_all();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    });
+}
+
+bool Pending::wait() {
+    std::vector<std::future<void>> done{};
+    std::unordered_set<const Object *> ready{};
+    {
+        std::unique_lock l{lock};
+        if (running.empty()) {
+            return false;
+        }
+        cond.wait(l, [this]() { return !finished.empty(); });
+
+        for (const auto & key : finished) {
+            done.emplace_back(std::move(running.at(key)));
+            running.erase(key);
+
+            const auto w = waiting.find(key);
+            if (w != waiting.end()) {
+                ready.insert(w->second.begin(), w->second.end());
+                waiting.erase(w);
+            }
+        }
+        finished.clear();
+    }
+    resumed = std::move(ready);
+
+    // Rethrow anything that went wrong
+    for (auto & d : done) {
+        d.get();
+    }
+    return true;
+}
+
+void Pending::resume_all() { resumed = std::nullopt; }
+
+bool Pending::ready(const Object & instruction) const {
+    return !resumed || resumed->find(&instruction) != resumed->end();
+}
+
+} // namespace MIR::Passes
@@ -8,6 +8,7 @@
 #pragma once
 
 #include "mir.hpp"
+#include "passes.hpp"
 #include <functional>
 #include <optional>
 
@@ -16,12 +17,24 @@ namespace MIR::Passes {
 /// Callback will return a an optional Object, when it does the original object is replaced
 using ReplacementCallback = std::function<std::optional<Object>(const Object &)>;
 
+/**
+ * Like a ReplacementCallback, but also given the instruction the object is in
+ *
+ * This is the instruction to pass to Pending::start, if the object can't be
+ * lowered until some work is finished.
+ */
+using BlockingCallback = std::function<std::optional<Object>(const Object &, const Object &)>;
+
 /// Callback will return a boolean that progress is mode
 using MutationCallback = std::function<bool(Object &)>;
 
 /**
  * Walks each instruction in a basic block, calling each callback on each instruction
  *
+ * Large blocks are walked on multiple threads, each taking a contiguous range
+ * of instructions. The callbacks must therefore only modify the Object they
+ * are given, and only read any shared state, such as State::Persistant.
+ *
  * Returns true if any changes were made to the block.
  */
 bool instruction_walker(BasicBlock *, const std::vector<MutationCallback> &,
@@ -36,6 +49,22 @@ bool instruction_walker(BasicBlock *, const std::vector<ReplacementCallback> &);
  */
 bool function_walker(BasicBlock *, const ReplacementCallback &);
 
+/**
+ * Walks the functions of the instructions that Pending says are ready
+ *
+ * This is for passes that may start work in the background. After some of
+ * that work finishes only the instructions that were waiting on it are
+ * walked, rather than the whole block.
+ */
+bool function_walker(BasicBlock *, const BlockingCallback &, const Pending &);
+
+/**
+ * Every block reachable from the given one, including itself
+ *
+ * Each block is listed once, in breadth first order.
+ */
+std::vector<BasicBlock *> reachable_blocks(BasicBlock *);
+
 /**
  * Walk each instruction in an array, recursively, calling the callbck on them.
  */
@@ -48,4 +77,18 @@ bool array_walker(Object &, const ReplacementCallback &);
  */
 bool function_argument_walker(Object &, const ReplacementCallback &);
 
+/**
+ * Walk over what a foreach loop iterates over, if it hasn't been unrolled yet
+ *
+ * This will replace the iterable if it is lowered by the callback
+ */
+bool iterable_walker(Object &, const ReplacementCallback &);
+
+/**
+ * Walk over the right hand side of a `+=` that hasn't been resolved yet
+ *
+ * This will replace the value if it is lowered by the callback
+ */
+bool plus_assignment_walker(Object &, const ReplacementCallback &);
+
 } // namespace MIR::Passes
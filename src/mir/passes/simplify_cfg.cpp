@@ -0,0 +1,144 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Dylan Baker
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "passes.hpp"
+
+namespace MIR::Passes {
+
+namespace {
+
+/// How many live blocks jump to each block
+using PredecessorMap = std::unordered_map<const BasicBlock *, unsigned>;
+
+std::vector<BasicBlock *> successors(const BasicBlock * block) {
+    std::vector<BasicBlock *> succ{};
+    if (block->condition.has_value()) {
+        succ.emplace_back(block->condition->if_true);
+        succ.emplace_back(block->condition->if_false);
+    }
+    if (block->next != nullptr) {
+        succ.emplace_back(block->next);
+    }
+    return succ;
+}
+
+PredecessorMap count_predecessors(BasicBlock * root) {
+    PredecessorMap preds{{root, 0}};
+    std::vector<BasicBlock *> todo{root};
+
+    while (!todo.empty()) {
+        const auto * block = todo.back();
+        todo.pop_back();
+        for (auto * s : successors(block)) {
+            auto [it, inserted] = preds.emplace(s, 1);
+            if (inserted) {
+                todo.emplace_back(s);
+            } else {
+                ++it->second;
+            }
+        }
+    }
+
+    return preds;
+}
+
+/**
+ * Drop an edge to a block
+ *
+ * If that was the last edge to the block then it is dead, and so are its edges
+ * to other blocks.
+ */
+void release(BasicBlock * block, PredecessorMap & preds) {
+    std::vector<BasicBlock *> todo{block};
+    while (!todo.empty()) {
+        auto * b = todo.back();
+        todo.pop_back();
+        if (--preds[b] == 0) {
+            const auto succ = successors(b);
+            todo.insert(todo.end(), succ.begin(), succ.end());
+        }
+    }
+}
+
+/**
+ * Move the instructions and exits of `from` into the end of `to`
+ *
+ * `from` must only be reachable from `to`, as it is empty afterwards.
+ */
+void absorb(BasicBlock * to, BasicBlock * from) {
+    to->instructions.splice(to->instructions.end(), from->instructions);
+    // Always do this, as the from condition could be empty, and we want that as well.
+    to->condition = std::move(from->condition);
+    to->next = from->next;
+    from->next = nullptr;
+}
+
+/**
+ * Simplify a single block as far as possible
+ *
+ * Each decidable condition is replaced by the branch taken, and each
+ * unconditional jump to a block with no other predecessors is merged in.
+ */
+bool simplify_block(BasicBlock * block, PredecessorMap & preds) {
+    bool progress = false;
+
+    while (true) {
+        if (block->condition.has_value()) {
+            const auto & con = block->condition.value();
+            const auto * value = std::get_if<Ptr<Boolean>>(&con.condition);
+            if (value == nullptr) {
+                break;
+            }
+
+            auto * taken = (*value)->value ? con.if_true : con.if_false;
+            auto * dropped = (*value)->value ? con.if_false : con.if_true;
+            release(dropped, preds);
+
+            if (preds[taken] == 1) {
+                absorb(block, taken);
+            } else {
+                block->condition = std::nullopt;
+                block->next = taken;
+            }
+            progress = true;
+        } else if (block->next != nullptr && preds[block->next] == 1) {
+            absorb(block, block->next);
+            progress = true;
+        } else {
+            break;
+        }
+    }
+
+    return progress;
+}
+
+} // namespace
+
+bool simplify_cfg(BasicBlock * root) {
+    auto preds = count_predecessors(root);
+
+    bool progress = false;
+    std::unordered_set<const BasicBlock *> seen{root};
+    std::vector<BasicBlock *> todo{root};
+
+    while (!todo.empty()) {
+        auto * block = todo.back();
+        todo.pop_back();
+
+        progress |= simplify_block(block, preds);
+
+        for (auto * s : successors(block)) {
+            if (seen.emplace(s).second) {
+                todo.emplace_back(s);
+            }
+        }
+    }
+
+    return progress;
+}
+
+} // namespace MIR::Passes
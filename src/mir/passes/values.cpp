@@ -0,0 +1,336 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Dylan Baker
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+#include "exceptions.hpp"
+#include "passes.hpp"
+#include "private.hpp"
+
+namespace MIR::Passes {
+
+namespace {
+
+/// The variable an instruction is stored to
+Variable & variable(Object & obj) {
+    return std::visit([](auto & o) -> Variable & { return o->var; }, obj);
+}
+
+/// Record the version that a new version of an array or dictionary extends
+template <typename T>
+bool number_base(Object & obj, const std::unordered_map<std::string, uint> & current) {
+    auto * ptr = std::get_if<Ptr<T>>(&obj);
+    if (ptr == nullptr) {
+        return false;
+    }
+    auto & base = (*ptr)->base;
+    if (!base || base.version != 0) {
+        return false;
+    }
+    const auto found = current.find(base.name);
+    if (found == current.end()) {
+        return false;
+    }
+    base.version = found->second;
+    return true;
+}
+
+/**
+ * Copy a value that has been completely lowered
+ *
+ * Arrays and dictionaries are copied whole, including the versions they
+ * extend. Returns std::nullopt for anything else, or for an array or
+ * dictionary that holds anything else.
+ */
+std::optional<Object> copy_constant(const Object & obj, const Definitions & lookup,
+                                    BlockArena & arena) {
+    if (const auto * v = std::get_if<Ptr<String>>(&obj)) {
+        return arena.make<String>((*v)->value);
+    }
+    if (const auto * v = std::get_if<Ptr<Number>>(&obj)) {
+        return arena.make<Number>((*v)->value);
+    }
+    if (const auto * v = std::get_if<Ptr<Boolean>>(&obj)) {
+        return arena.make<Boolean>((*v)->value);
+    }
+    if (const auto * v = std::get_if<Ptr<File>>(&obj)) {
+        return arena.make<File>((*v)->file);
+    }
+    if (const auto * v = std::get_if<Ptr<Array>>(&obj)) {
+        const auto elems = (*v)->elements(lookup);
+        if (!elems) {
+            return std::nullopt;
+        }
+        auto arr = arena.make<Array>();
+        for (const auto * e : elems.value()) {
+            auto c = copy_constant(*e, lookup, arena);
+            if (!c) {
+                return std::nullopt;
+            }
+            arr->value.emplace_back(std::move(c.value()));
+        }
+        return arr;
+    }
+    if (const auto * v = std::get_if<Ptr<Dict>>(&obj)) {
+        const auto elems = (*v)->elements(lookup);
+        if (!elems) {
+            return std::nullopt;
+        }
+        auto dict = arena.make<Dict>();
+        for (const auto & [k, e] : elems.value()) {
+            auto c = copy_constant(*e, lookup, arena);
+            if (!c) {
+                return std::nullopt;
+            }
+            dict->value[k] = std::move(c.value());
+        }
+        return dict;
+    }
+    return std::nullopt;
+}
+
+/// Has this been lowered far enough to know what kind of value it is?
+bool is_known(const Object & obj) {
+    return !(std::holds_alternative<Ptr<FunctionCall>>(obj) ||
+             std::holds_alternative<Ptr<Identifier>>(obj) ||
+             std::holds_alternative<Ptr<PlusAssignment>>(obj));
+}
+
+/**
+ * Replaces uses of variables with their values, one block at a time
+ *
+ * Only definitions that come earlier in the same block are used, as those
+ * are always the ones that reach the use. Anything that is defined in
+ * another block is left alone until simplify_cfg has joined the blocks.
+ */
+class Propagator {
+  public:
+    Propagator(BlockArena & a) : arena{a}, versions{}, latest{} {};
+
+    /// Replace any uses in obj, then remember it if it is a definition
+    bool instruction(Object & obj) {
+        bool progress = false;
+        if (const auto * id = std::get_if<Ptr<Identifier>>(&obj)) {
+            // The value is stored to the same variable as the identifier was
+            auto value = resolve((*id)->value);
+            if (value) {
+                variable(value.value()) = (*id)->var;
+                obj = std::move(value.value());
+                progress = true;
+            }
+        } else if (auto * add = std::get_if<Ptr<PlusAssignment>>(&obj)) {
+            progress = use((*add)->value);
+            auto value = plus((**add));
+            if (value) {
+                variable(value.value()) = (*add)->var;
+                obj = std::move(value.value());
+                progress = true;
+            }
+        } else {
+            progress = uses(obj);
+        }
+
+        const auto & var = variable(obj);
+        if (var && var.version != 0) {
+            versions[{var.name, var.version}] = &obj;
+            latest[var.name] = &obj;
+        } else if (var) {
+            latest.erase(var.name);
+        }
+        return progress;
+    }
+
+    /// Replace a use in place, if it can be resolved
+    bool use(Object & obj) {
+        if (const auto * id = std::get_if<Ptr<Identifier>>(&obj)) {
+            auto value = resolve((*id)->value);
+            if (value) {
+                obj = std::move(value.value());
+                return true;
+            }
+            return false;
+        }
+        return uses(obj);
+    }
+
+    /// Forget every definition so far
+    void clear() {
+        versions.clear();
+        latest.clear();
+    }
+
+  private:
+    /// Replace the uses inside of obj
+    bool uses(Object & obj) {
+        bool progress = false;
+        if (const auto * f = std::get_if<Ptr<FunctionCall>>(&obj)) {
+            for (auto & a : (*f)->pos_args) {
+                progress |= use(a);
+            }
+            for (auto & [_, a] : (*f)->kw_args) {
+                progress |= use(a);
+            }
+        } else if (const auto * a = std::get_if<Ptr<Array>>(&obj)) {
+            for (auto & e : (*a)->value) {
+                progress |= use(e);
+            }
+        } else if (const auto * d = std::get_if<Ptr<Dict>>(&obj)) {
+            for (auto & [_, e] : (*d)->value) {
+                progress |= use(e);
+            }
+        }
+        return progress;
+    }
+
+    /**
+     * Replace `name += value` with the new version of name
+     *
+     * Returns std::nullopt if either side isn't known yet. The version of an
+     * array or dictionary only holds what is added, with the version it
+     * extends as its base.
+     */
+    std::optional<Object> plus(PlusAssignment & add) const {
+        const auto found = versions.find({add.base.name, add.base.version});
+        if (add.base.version == 0 || found == versions.end() || !is_known(add.value)) {
+            return std::nullopt;
+        }
+        const Object & base = *found->second;
+        auto & value = add.value;
+
+        if (std::holds_alternative<Ptr<Array>>(base)) {
+            // An array adds each of its elements, anything else adds itself
+            auto arr = arena.make<Array>();
+            if (auto * v = std::get_if<Ptr<Array>>(&value)) {
+                arr->value = std::move((*v)->value);
+            } else {
+                arr->value.emplace_back(std::move(value));
+            }
+            arr->base = add.base;
+            return arr;
+        }
+        if (std::holds_alternative<Ptr<Dict>>(base)) {
+            auto * v = std::get_if<Ptr<Dict>>(&value);
+            if (v == nullptr) {
+                throw Util::Exceptions::InvalidArguments{"Only a dictionary can be added to " +
+                                                         add.base.name + ", a dictionary"};
+            }
+            auto dict = arena.make<Dict>();
+            dict->value = std::move((*v)->value);
+            dict->base = add.base;
+            return dict;
+        }
+        if (const auto * b = std::get_if<Ptr<String>>(&base)) {
+            const auto * v = std::get_if<Ptr<String>>(&value);
+            if (v == nullptr) {
+                throw Util::Exceptions::InvalidArguments{"Only a string can be added to " +
+                                                         add.base.name + ", a string"};
+            }
+            return arena.make<String>((*b)->value + (*v)->value);
+        }
+        if (const auto * b = std::get_if<Ptr<Number>>(&base)) {
+            const auto * v = std::get_if<Ptr<Number>>(&value);
+            if (v == nullptr) {
+                throw Util::Exceptions::InvalidArguments{"Only a number can be added to " +
+                                                         add.base.name + ", a number"};
+            }
+            return arena.make<Number>((*b)->value + (*v)->value);
+        }
+        // Anything else that could still be lowered may yet be one of those
+        if (!is_known(base)) {
+            return std::nullopt;
+        }
+        throw Util::Exceptions::InvalidArguments{"Cannot add to " + add.base.name};
+    }
+
+    std::optional<Object> resolve(const std::string & name) const {
+        const auto found = latest.find(name);
+        if (found == latest.end()) {
+            return std::nullopt;
+        }
+        const Definitions lookup = [this](const Variable & v) -> const Object * {
+            const auto def = versions.find({v.name, v.version});
+            return def != versions.end() ? def->second : nullptr;
+        };
+        return copy_constant(*found->second, lookup, arena);
+    }
+
+    BlockArena & arena;
+
+    /// Every definition so far, by name and version
+    std::map<std::pair<std::string, uint>, const Object *> versions;
+
+    /// The last definition of each name so far
+    std::unordered_map<std::string, const Object *> latest;
+};
+
+} // namespace
+
+bool value_numbering(BasicBlock * root) {
+    const auto blocks = reachable_blocks(root);
+
+    // Versions only need to be unique for each name, so new ones start after
+    // the highest one already given out
+    std::unordered_map<std::string, uint> last{};
+    for (auto * block : blocks) {
+        for (auto & i : block->instructions) {
+            const auto & var = variable(i);
+            if (var) {
+                auto & l = last[var.name];
+                l = std::max(l, var.version);
+            }
+        }
+    }
+
+    bool progress = false;
+    for (auto * block : blocks) {
+        // The version of each variable defined so far in this block
+        std::unordered_map<std::string, uint> current{};
+        for (auto & i : block->instructions) {
+            // A loop that hasn't been unrolled could assign to anything
+            if (std::holds_alternative<Ptr<Foreach>>(i)) {
+                current.clear();
+                continue;
+            }
+
+            // The base is read before the new version is written
+            progress |= number_base<Array>(i, current) || number_base<Dict>(i, current) ||
+                        number_base<PlusAssignment>(i, current);
+
+            auto & var = variable(i);
+            if (!var) {
+                continue;
+            }
+            if (var.version == 0) {
+                var.version = ++last[var.name];
+                progress = true;
+            }
+            current[var.name] = var.version;
+        }
+    }
+
+    return progress;
+}
+
+bool constant_propagation(BasicBlock * root, BlockArena & arena) {
+    bool progress = false;
+    for (auto * block : reachable_blocks(root)) {
+        Propagator prop{arena};
+        for (auto & i : block->instructions) {
+            if (auto * loop = std::get_if<Ptr<Foreach>>(&i)) {
+                progress |= prop.use((*loop)->iterable);
+                // The loop could assign to anything, so start again after it
+                prop.clear();
+                continue;
+            }
+            progress |= prop.instruction(i);
+        }
+        if (block->condition.has_value()) {
+            progress |= prop.use(block->condition->condition);
+        }
+    }
+    return progress;
+}
+
+} // namespace MIR::Passes
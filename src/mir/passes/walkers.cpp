@@ -1,14 +1,18 @@
 // SPDX-license-identifier: Apache-2.0
 // Copyright © 2021 Dylan Baker
 
+#include <atomic>
+#include <unordered_set>
+
 #include "exceptions.hpp"
 #include "private.hpp"
+#include "threads.hpp"
 
 namespace MIR::Passes {
 
 namespace {
 
-bool replace_elements(std::vector<Object> & vec, const ReplacementCallback & cb) {
+bool replace_elements(std::pmr::vector<Object> & vec, const ReplacementCallback & cb) {
     bool progress = false;
     for (auto it = vec.begin(); it != vec.end(); ++it) {
         auto rt = cb(*it);
@@ -20,6 +24,51 @@ bool replace_elements(std::vector<Object> & vec, const ReplacementCallback & cb)
     return progress;
 }
 
+/**
+ * Run each callback on a single instruction
+ *
+ * This must not touch anything but the instruction itself, as it may be run
+ * concurrently with other instructions in the same block.
+ */
+bool walk_instruction(Object & obj, const std::vector<MutationCallback> & fc,
+                      const std::vector<ReplacementCallback> & rc) {
+    bool progress = false;
+    for (const auto & cb : rc) {
+        auto rt = cb(obj);
+        if (rt.has_value()) {
+            // The replacement is still stored to the same variable
+            const auto var = std::visit([](const auto & o) { return o->var; }, obj);
+            obj = std::move(rt.value());
+            std::visit([&](const auto & o) { o->var = var; }, obj);
+            progress |= true;
+        }
+    }
+    for (const auto & cb : fc) {
+        progress |= cb(obj);
+    }
+    return progress;
+}
+
+/// Walk the functions in an instruction, and those it holds
+bool walk_functions(Object & obj, const ReplacementCallback & cb) {
+    bool progress = false;
+    auto rt = cb(obj);
+    if (rt.has_value()) {
+        const auto var = std::visit([](const auto & o) { return o->var; }, obj);
+        obj = std::move(rt.value());
+        std::visit([&](const auto & o) { o->var = var; }, obj);
+        progress |= true;
+    }
+    progress |= array_walker(obj, cb);
+    progress |= function_argument_walker(obj, cb);
+    progress |= iterable_walker(obj, cb);
+    progress |= plus_assignment_walker(obj, cb);
+    return progress;
+}
+
+/// Don't bother spreading out blocks smaller than this
+constexpr std::size_t WALKER_GRAIN = 256;
+
 } // namespace
 
 bool instruction_walker(BasicBlock * block, const std::vector<MutationCallback> & fc) {
@@ -32,37 +81,64 @@ bool instruction_walker(BasicBlock * block, const std::vector<ReplacementCallbac
 
 bool instruction_walker(BasicBlock * block, const std::vector<MutationCallback> & fc,
                         const std::vector<ReplacementCallback> & rc) {
-    bool progress = false;
+    // Each instruction is lowered on its own, and is replaced in place, so the
+    // list can be split into chunks and handed out to worker threads. The
+    // order of the list does not change.
+    std::vector<Object *> instructions{};
+    instructions.reserve(block->instructions.size());
+    for (auto & i : block->instructions) {
+        instructions.emplace_back(&i);
+    }
 
-    auto it = block->instructions.begin();
-    while (it != block->instructions.end()) {
-        for (const auto & cb : rc) {
-            auto rt = cb(*it);
-            if (rt.has_value()) {
-                it = block->instructions.erase(it);
-                block->instructions.insert(it, std::move(rt.value()));
-                progress |= true;
-            }
+    std::atomic_bool progress = false;
+
+    Util::parallel_for(instructions.size(), WALKER_GRAIN, [&](std::size_t begin, std::size_t end) {
+        bool p = false;
+        for (std::size_t i = begin; i < end; ++i) {
+            p |= walk_instruction(*instructions[i], fc, rc);
         }
-        for (const auto & cb : fc) {
-            progress |= cb(*it);
+        if (p) {
+            progress = true;
         }
-        ++it;
-    }
+    });
 
     return progress;
 };
 
+std::vector<BasicBlock *> reachable_blocks(BasicBlock * root) {
+    std::vector<BasicBlock *> blocks{root};
+    std::unordered_set<const BasicBlock *> seen{root};
+
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        const auto * block = blocks[i];
+        std::vector<BasicBlock *> succ{};
+        if (block->condition.has_value()) {
+            succ.emplace_back(block->condition->if_true);
+            succ.emplace_back(block->condition->if_false);
+        }
+        if (block->next != nullptr) {
+            succ.emplace_back(block->next);
+        }
+        for (auto * s : succ) {
+            if (seen.emplace(s).second) {
+                blocks.emplace_back(s);
+            }
+        }
+    }
+
+    return blocks;
+}
+
 bool array_walker(Object & obj, const ReplacementCallback & cb) {
     bool progress = false;
 
-    if (!std::holds_alternative<std::unique_ptr<Array>>(obj)) {
+    if (!std::holds_alternative<Ptr<Array>>(obj)) {
         return progress;
     }
-    auto & arr = std::get<std::unique_ptr<Array>>(obj);
+    auto & arr = std::get<Ptr<Array>>(obj);
 
     for (auto it = arr->value.begin(); it != arr->value.end(); ++it) {
-        if (std::holds_alternative<std::unique_ptr<Array>>(*it)) {
+        if (std::holds_alternative<Ptr<Array>>(*it)) {
             progress |= array_walker(*it, cb);
         } else {
             auto rt = cb(*it);
@@ -79,11 +155,11 @@ bool array_walker(Object & obj, const ReplacementCallback & cb) {
 bool function_argument_walker(Object & obj, const ReplacementCallback & cb) {
     bool progress = false;
 
-    if (!std::holds_alternative<std::unique_ptr<FunctionCall>>(obj)) {
+    if (!std::holds_alternative<Ptr<FunctionCall>>(obj)) {
         return progress;
     }
 
-    auto & func = std::get<std::unique_ptr<FunctionCall>>(obj);
+    auto & func = std::get<Ptr<FunctionCall>>(obj);
 
     if (!func->pos_args.empty()) {
         progress |= replace_elements(func->pos_args, cb);
@@ -94,6 +170,36 @@ bool function_argument_walker(Object & obj, const ReplacementCallback & cb) {
     return progress;
 }
 
+bool iterable_walker(Object & obj, const ReplacementCallback & cb) {
+    auto * loop = std::get_if<Ptr<Foreach>>(&obj);
+    if (loop == nullptr) {
+        return false;
+    }
+
+    auto & iterable = (*loop)->iterable;
+    auto rt = cb(iterable);
+    if (rt.has_value()) {
+        iterable = std::move(rt.value());
+        return true;
+    }
+    return array_walker(iterable, cb);
+}
+
+bool plus_assignment_walker(Object & obj, const ReplacementCallback & cb) {
+    auto * add = std::get_if<Ptr<PlusAssignment>>(&obj);
+    if (add == nullptr) {
+        return false;
+    }
+
+    auto & value = (*add)->value;
+    auto rt = cb(value);
+    if (rt.has_value()) {
+        value = std::move(rt.value());
+        return true;
+    }
+    return array_walker(value, cb);
+}
+
 bool function_walker(BasicBlock * block, const ReplacementCallback & cb) {
     bool progress = instruction_walker(
         block,
@@ -101,6 +207,10 @@ bool function_walker(BasicBlock * block, const ReplacementCallback & cb) {
             [&](Object & obj) { return array_walker(obj, cb); }, // look into arrays
             // look into function arguments
             [&](Object & obj) { return function_argument_walker(obj, cb); },
+            // look into what loops that haven't been unrolled iterate over
+            [&](Object & obj) { return iterable_walker(obj, cb); },
+            // look into what is being added with +=
+            [&](Object & obj) { return plus_assignment_walker(obj, cb); },
             // TODO: look into dictionary elements
         },
         {cb});
@@ -118,4 +228,38 @@ bool function_walker(BasicBlock * block, const ReplacementCallback & cb) {
     return progress;
 };
 
+bool function_walker(BasicBlock * block, const BlockingCallback & cb, const Pending & pending) {
+    std::vector<Object *> instructions{};
+    for (auto & i : block->instructions) {
+        if (pending.ready(i)) {
+            instructions.emplace_back(&i);
+        }
+    }
+
+    std::atomic_bool progress = false;
+
+    Util::parallel_for(instructions.size(), WALKER_GRAIN, [&](std::size_t begin, std::size_t end) {
+        bool p = false;
+        for (std::size_t i = begin; i < end; ++i) {
+            const Object & instr = *instructions[i];
+            p |= walk_functions(*instructions[i],
+                                [&](const Object & obj) { return cb(obj, instr); });
+        }
+        if (p) {
+            progress = true;
+        }
+    });
+
+    if (block->condition.has_value() && pending.ready(block->condition->condition)) {
+        auto & con = block->condition.value();
+        auto new_value = cb(con.condition, con.condition);
+        if (new_value.has_value()) {
+            con.condition = std::move(new_value.value());
+            progress = true;
+        }
+    }
+
+    return progress;
+};
+
 } // namespace MIR::Passes
@@ -1,6 +1,9 @@
 // SPDX-license-identifier: Apache-2.0
 // Copyright © 2021 Intel Corporation
 
+#include <atomic>
+#include <fstream>
+#include <future>
 #include <gtest/gtest.h>
 #include <sstream>
 #include <variant>
@@ -13,6 +16,7 @@
 #include "mir.hpp"
 #include "passes.hpp"
 #include "state/state.hpp"
+#include "threads.hpp"
 #include "toolchains/archiver.hpp"
 #include "toolchains/common.hpp"
 #include "toolchains/compilers/cpp/cpp.hpp"
@@ -32,7 +36,7 @@ std::unique_ptr<Frontend::AST::CodeBlock> parse(const std::string & in) {
     return block;
 }
 
-MIR::BasicBlock lower(const std::string & in) {
+MIR::Program lower(const std::string & in) {
     auto block = parse(in);
     const MIR::State::Persistant pstate{src_root, build_root};
     auto ir = MIR::lower_ast(block, pstate);
@@ -44,21 +48,21 @@ MIR::BasicBlock lower(const std::string & in) {
 TEST(flatten, basic) {
     auto irlist = lower("func(['a', ['b', ['c']], 'd'])");
     MIR::State::Persistant pstate{src_root, build_root};
-    bool progress = MIR::Passes::flatten(&irlist, pstate);
+    bool progress = MIR::Passes::flatten(&irlist, irlist.arena, pstate);
 
     ASSERT_TRUE(progress);
     ASSERT_EQ(irlist.instructions.size(), 1);
 
     const auto & r = irlist.instructions.front();
 
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(r));
-    const auto & f = std::get<std::unique_ptr<MIR::FunctionCall>>(r);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(r));
+    const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(r);
     ASSERT_EQ(f->name, "func");
     ASSERT_EQ(f->pos_args.size(), 1);
 
     const auto & arg = f->pos_args.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Array>>(arg));
-    const auto & arr = std::get<std::unique_ptr<MIR::Array>>(arg)->value;
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Array>>(arg));
+    const auto & arr = std::get<MIR::Ptr<MIR::Array>>(arg)->value;
 
     ASSERT_EQ(arr.size(), 4);
 }
@@ -66,103 +70,391 @@ TEST(flatten, basic) {
 TEST(flatten, already_flat) {
     auto irlist = lower("func(['a', 'd'])");
     MIR::State::Persistant pstate{src_root, build_root};
-    bool progress = MIR::Passes::flatten(&irlist, pstate);
+    bool progress = MIR::Passes::flatten(&irlist, irlist.arena, pstate);
 
-    ASSERT_TRUE(progress);
+    // Nothing is nested, so nothing changes
+    ASSERT_FALSE(progress);
     ASSERT_EQ(irlist.instructions.size(), 1);
 
     const auto & r = irlist.instructions.front();
 
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(r));
-    const auto & f = std::get<std::unique_ptr<MIR::FunctionCall>>(r);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(r));
+    const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(r);
     ASSERT_EQ(f->name, "func");
     ASSERT_EQ(f->pos_args.size(), 1);
 
     const auto & arg = f->pos_args.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Array>>(arg));
-    const auto & arr = std::get<std::unique_ptr<MIR::Array>>(arg)->value;
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Array>>(arg));
+    const auto & arr = std::get<MIR::Ptr<MIR::Array>>(arg)->value;
 
     ASSERT_EQ(arr.size(), 2);
 }
 
+TEST(flatten, many_instructions) {
+    // Enough instructions that the walker splits them between threads
+    std::string in{};
+    for (unsigned i = 0; i < 1000; ++i) {
+        in += "func" + std::to_string(i) + "(['a', ['b']])\n";
+    }
+    auto irlist = lower(in);
+    MIR::State::Persistant pstate{src_root, build_root};
+    bool progress = MIR::Passes::flatten(&irlist, irlist.arena, pstate);
+
+    ASSERT_TRUE(progress);
+    ASSERT_EQ(irlist.instructions.size(), 1000);
+
+    unsigned i = 0;
+    for (const auto & r : irlist.instructions) {
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(r));
+        const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(r);
+        ASSERT_EQ(f->name, "func" + std::to_string(i++));
+
+        const auto & arg = f->pos_args.front();
+        ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Array>>(arg));
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::Array>>(arg)->value.size(), 2);
+    }
+}
+
 TEST(flatten, mixed_args) {
     auto irlist = lower("project('foo', ['a', ['d']])");
     MIR::State::Persistant pstate{src_root, build_root};
-    bool progress = MIR::Passes::flatten(&irlist, pstate);
+    bool progress = MIR::Passes::flatten(&irlist, irlist.arena, pstate);
 
     ASSERT_TRUE(progress);
     ASSERT_EQ(irlist.instructions.size(), 1);
 
     const auto & r = irlist.instructions.front();
 
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(r));
-    const auto & f = std::get<std::unique_ptr<MIR::FunctionCall>>(r);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(r));
+    const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(r);
     ASSERT_EQ(f->pos_args.size(), 2);
 
     const auto & arg = f->pos_args.back();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Array>>(arg));
-    const auto & arr = std::get<std::unique_ptr<MIR::Array>>(arg)->value;
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Array>>(arg));
+    const auto & arr = std::get<MIR::Ptr<MIR::Array>>(arg)->value;
 
     ASSERT_EQ(arr.size(), 2);
 }
 
-TEST(branch_pruning, simple) {
-    auto irlist = lower("x = 7\nif true\n x = 8\nendif\n");
-    bool progress = MIR::Passes::branch_pruning(&irlist);
-    ASSERT_TRUE(progress);
-    ASSERT_FALSE(irlist.condition.has_value());
-    ASSERT_EQ(irlist.instructions.size(), 2);
-}
-
-TEST(branch_pruning, next_block) {
-    auto irlist = lower("x = 7\nif true\n x = 8\nendif\ny = x");
-    bool progress = MIR::Passes::branch_pruning(&irlist);
-    ASSERT_TRUE(progress);
-    ASSERT_FALSE(irlist.condition.has_value());
-    ASSERT_NE(irlist.next, nullptr);
-    ASSERT_EQ(irlist.next->instructions.size(), 1);
-}
-
-TEST(branch_pruning, if_else) {
+TEST(simplify_cfg, if_else) {
     auto irlist = lower("x = 7\nif true\n x = 8\nelse\n x = 9\nendif\n");
-    bool progress = MIR::Passes::branch_pruning(&irlist);
+    bool progress = MIR::Passes::simplify_cfg(&irlist);
     ASSERT_TRUE(progress);
     ASSERT_FALSE(irlist.condition.has_value());
     ASSERT_EQ(irlist.instructions.size(), 2);
 }
 
-TEST(branch_pruning, if_false) {
+TEST(simplify_cfg, if_false) {
     auto irlist = lower("x = 7\nif false\n x = 8\nelse\n x = 9\n y = 2\nendif\n");
-    bool progress = MIR::Passes::branch_pruning(&irlist);
+    bool progress = MIR::Passes::simplify_cfg(&irlist);
     ASSERT_TRUE(progress);
     ASSERT_FALSE(irlist.condition.has_value());
     // Using 3 here allows us to know that we went down the right path
     ASSERT_EQ(irlist.instructions.size(), 3);
 
-    const auto & first = std::get<std::unique_ptr<MIR::Number>>(irlist.instructions.front());
+    const auto & first = std::get<MIR::Ptr<MIR::Number>>(irlist.instructions.front());
     ASSERT_EQ(first->value, 7);
     ASSERT_EQ(first->var.name, "x");
 
-    const auto & last = std::get<std::unique_ptr<MIR::Number>>(irlist.instructions.back());
+    const auto & last = std::get<MIR::Ptr<MIR::Number>>(irlist.instructions.back());
     ASSERT_EQ(last->value, 2);
     ASSERT_EQ(last->var.name, "y");
 }
 
-TEST(join_blocks, simple) {
+TEST(simplify_cfg, next_block) {
     auto irlist = lower("x = 7\nif true\n x = 8\nelse\n x = 9\nendif\ny = x");
-    bool progress = MIR::Passes::branch_pruning(&irlist);
+    bool progress = MIR::Passes::simplify_cfg(&irlist);
+    ASSERT_TRUE(progress);
+    ASSERT_FALSE(irlist.condition.has_value());
+    ASSERT_EQ(irlist.instructions.size(), 3);
+    ASSERT_EQ(irlist.next, nullptr);
+}
+
+TEST(simplify_cfg, chain) {
+    auto irlist = lower("x = 1\nif true\n x = 2\nendif\nif false\n x = 3\nelse\n x = 4\nendif\n"
+                        "if true\n x = 5\nendif\ny = x");
+    bool progress = MIR::Passes::simplify_cfg(&irlist);
     ASSERT_TRUE(progress);
     ASSERT_FALSE(irlist.condition.has_value());
+    ASSERT_EQ(irlist.next, nullptr);
+    ASSERT_EQ(irlist.instructions.size(), 5);
+
+    const auto & last = std::get<MIR::Ptr<MIR::Identifier>>(irlist.instructions.back());
+    ASSERT_EQ(last->value, "x");
+    ASSERT_EQ(last->var.name, "y");
+}
+
+TEST(simplify_cfg, if_false_no_else) {
+    auto irlist = lower("x = 7\nif false\n x = 8\nendif\ny = x");
+    bool progress = MIR::Passes::simplify_cfg(&irlist);
+    ASSERT_TRUE(progress);
+    ASSERT_FALSE(irlist.condition.has_value());
+    ASSERT_EQ(irlist.next, nullptr);
     ASSERT_EQ(irlist.instructions.size(), 2);
-    ASSERT_NE(irlist.next, nullptr);
 
-    ASSERT_EQ(irlist.next->instructions.size(), 1);
+    const auto & first = std::get<MIR::Ptr<MIR::Number>>(irlist.instructions.front());
+    ASSERT_EQ(first->value, 7);
+}
 
-    progress = MIR::Passes::join_blocks(&irlist);
+TEST(simplify_cfg, nested_in_unknown) {
+    auto irlist = lower("if x\n if true\n  y = 1\n endif\n z = 2\nelse\n y = 3\nendif\nw = 4");
+    bool progress = MIR::Passes::simplify_cfg(&irlist);
     ASSERT_TRUE(progress);
+
+    // The outer condition can't be decided, so it must be kept
+    ASSERT_TRUE(irlist.condition.has_value());
+    const auto & con = irlist.condition.value();
+
+    // The inner condition is pruned and joined into the true branch
+    ASSERT_FALSE(con.if_true->condition.has_value());
+    ASSERT_EQ(con.if_true->instructions.size(), 2);
+    ASSERT_EQ(con.if_false->instructions.size(), 1);
+
+    // Both branches still jump to the same shared block
+    ASSERT_NE(con.if_true->next, nullptr);
+    ASSERT_EQ(con.if_true->next, con.if_false->next);
+    ASSERT_EQ(con.if_true->next->instructions.size(), 1);
+}
+
+TEST(simplify_cfg, no_progress) {
+    auto irlist = lower("if x\n y = 1\nendif\n");
+    ASSERT_FALSE(MIR::Passes::simplify_cfg(&irlist));
+}
+
+TEST(value_numbering, add_equal) {
+    auto irlist = lower("x = ['a']\nx += ['b']\ny = x");
+    ASSERT_TRUE(MIR::Passes::value_numbering(&irlist));
+    ASSERT_FALSE(MIR::Passes::value_numbering(&irlist));
+
+    auto it = irlist.instructions.begin();
+    const auto & first = std::get<MIR::Ptr<MIR::Array>>(*it);
+    ASSERT_EQ(first->var.version, 1);
+
+    const auto & second = std::get<MIR::Ptr<MIR::PlusAssignment>>(*(++it));
+    ASSERT_EQ(second->var.version, 2);
+    ASSERT_EQ(second->base.name, "x");
+    ASSERT_EQ(second->base.version, 1);
+
+    const auto & third = std::get<MIR::Ptr<MIR::Identifier>>(*(++it));
+    ASSERT_EQ(third->var.name, "y");
+    ASSERT_EQ(third->var.version, 1);
+}
+
+TEST(value_numbering, base_in_other_block) {
+    auto irlist = lower("x = ['a']\nif y\n x += ['b']\nendif\n");
+    MIR::Passes::value_numbering(&irlist);
+
+    // The version being extended isn't known until the blocks are joined
+    const auto & add = std::get<MIR::Ptr<MIR::PlusAssignment>>(
+        irlist.condition->if_true->instructions.front());
+    ASSERT_EQ(add->var.version, 2);
+    ASSERT_EQ(add->base.version, 0);
+}
+
+TEST(constant_propagation, add_equal_array) {
+    auto irlist = lower("x = ['a']\nx += ['b', 'c']\nx += 'd'\nfunc(x)");
+    MIR::Passes::value_numbering(&irlist);
+    ASSERT_TRUE(MIR::Passes::constant_propagation(&irlist, irlist.arena));
+
+    const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(irlist.instructions.back());
+    ASSERT_EQ(f->pos_args.size(), 1);
+    const auto & arr = std::get<MIR::Ptr<MIR::Array>>(f->pos_args.front());
+    ASSERT_FALSE(arr->base);
+
+    // Every version is included, in order
+    ASSERT_EQ(arr->value.size(), 4);
+    unsigned i = 0;
+    for (const auto & v : {"a", "b", "c", "d"}) {
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::String>>(arr->value[i++])->value, v);
+    }
+}
+
+TEST(constant_propagation, add_equal_array_variable) {
+    auto irlist = lower("x = ['a']\ny = ['b', 'c']\nx += y\nfunc(x)");
+    MIR::Passes::value_numbering(&irlist);
+    ASSERT_TRUE(MIR::Passes::constant_propagation(&irlist, irlist.arena));
+
+    // The new version holds the elements of y, not y itself
+    const auto & add =
+        std::get<MIR::Ptr<MIR::Array>>(*std::next(irlist.instructions.begin(), 2));
+    ASSERT_EQ(add->value.size(), 2);
+    ASSERT_EQ(add->base.name, "x");
+
+    const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(irlist.instructions.back());
+    const auto & arr = std::get<MIR::Ptr<MIR::Array>>(f->pos_args.front());
+    ASSERT_EQ(arr->value.size(), 3);
+    unsigned i = 0;
+    for (const auto & v : {"a", "b", "c"}) {
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::String>>(arr->value[i++])->value, v);
+    }
+}
+
+TEST(constant_propagation, add_equal_files) {
+    auto irlist = lower("project('foo')\nsrcs = files('a.cpp')\nsrcs += files('b.cpp')\n"
+                        "func(srcs)");
+    MIR::State::Persistant pstate{src_root, build_root};
+    MIR::Passes::lower_project(&irlist, pstate);
+    MIR::lower(&irlist, pstate);
+
+    const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(irlist.instructions.back());
+    const auto & arr = std::get<MIR::Ptr<MIR::Array>>(f->pos_args.front());
+    ASSERT_EQ(arr->value.size(), 2);
+    unsigned i = 0;
+    for (const auto & v : {"a.cpp", "b.cpp"}) {
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::File>>(arr->value[i++])->file.get_name(), v);
+    }
+}
+
+TEST(constant_propagation, add_equal_string) {
+    auto irlist = lower("x = 'a'\nx += 'b'\ny = x");
+    MIR::Passes::value_numbering(&irlist);
+    ASSERT_TRUE(MIR::Passes::constant_propagation(&irlist, irlist.arena));
+
+    const auto & s = std::get<MIR::Ptr<MIR::String>>(irlist.instructions.back());
+    ASSERT_EQ(s->var.name, "y");
+    ASSERT_EQ(s->value, "ab");
+}
+
+TEST(constant_propagation, add_equal_array_to_string) {
+    auto irlist = lower("x = 'a'\nx += ['b']\n");
+    MIR::Passes::value_numbering(&irlist);
+    ASSERT_THROW(MIR::Passes::constant_propagation(&irlist, irlist.arena),
+                 Util::Exceptions::InvalidArguments);
+}
+
+TEST(constant_propagation, add_equal_dict) {
+    auto irlist = lower("x = {'a' : 1}\nx += {'a' : 2, 'b' : 3}\ny = x");
+    MIR::Passes::value_numbering(&irlist);
+    ASSERT_TRUE(MIR::Passes::constant_propagation(&irlist, irlist.arena));
+
+    const auto & d = std::get<MIR::Ptr<MIR::Dict>>(irlist.instructions.back());
+    ASSERT_EQ(d->var.name, "y");
+    ASSERT_EQ(d->value.size(), 2);
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(d->value.at("a"))->value, 2);
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Number>>(d->value.at("b"))->value, 3);
+}
+
+TEST(constant_propagation, condition) {
+    auto irlist = lower("x = true\nif x\n y = 1\nendif\n");
+    MIR::Passes::value_numbering(&irlist);
+    ASSERT_TRUE(MIR::Passes::constant_propagation(&irlist, irlist.arena));
+    ASSERT_TRUE(MIR::Passes::simplify_cfg(&irlist));
     ASSERT_FALSE(irlist.condition.has_value());
-    ASSERT_EQ(irlist.instructions.size(), 3);
+}
+
+TEST(constant_propagation, not_lowered) {
+    auto irlist = lower("x = func()\ny = x");
+    MIR::Passes::value_numbering(&irlist);
+    ASSERT_FALSE(MIR::Passes::constant_propagation(&irlist, irlist.arena));
+}
+
+TEST(constant_propagation, add_equal_not_array) {
+    auto irlist = lower("if true\n x = 'a'\nelse\n x = ['b']\nendif\nx += ['c']\nfunc(x)");
+    MIR::Passes::simplify_cfg(&irlist);
+    MIR::Passes::value_numbering(&irlist);
+    ASSERT_THROW(MIR::Passes::constant_propagation(&irlist, irlist.arena),
+                 Util::Exceptions::InvalidArguments);
+}
+
+TEST(unroll_foreach, simple) {
+    auto irlist = lower("y = ['a', 'b']\nforeach x : y\n  func(x)\nendforeach\nfunc(2)");
+    MIR::Passes::value_numbering(&irlist);
+    MIR::Passes::constant_propagation(&irlist, irlist.arena);
+    ASSERT_TRUE(MIR::Passes::unroll_foreach(&irlist, irlist.arena));
+    MIR::Passes::simplify_cfg(&irlist);
+
+    // y, then an assignment and a call for each element, then the last call
+    ASSERT_EQ(irlist.instructions.size(), 6);
     ASSERT_EQ(irlist.next, nullptr);
+
+    auto it = std::next(irlist.instructions.begin());
+    for (const auto & v : {"a", "b"}) {
+        const auto & s = std::get<MIR::Ptr<MIR::String>>(*it++);
+        ASSERT_EQ(s->value, v);
+        ASSERT_EQ(s->var.name, "x");
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::FunctionCall>>(*it++)->name, "func");
+    }
+}
+
+TEST(unroll_foreach, not_known) {
+    auto irlist = lower("foreach x : y\n  func(x)\nendforeach\n");
+    ASSERT_FALSE(MIR::Passes::unroll_foreach(&irlist, irlist.arena));
+}
+
+TEST(unroll_foreach, not_array) {
+    auto irlist = lower("y = 'a'\nforeach x : y\n  func(x)\nendforeach\n");
+    MIR::Passes::value_numbering(&irlist);
+    MIR::Passes::constant_propagation(&irlist, irlist.arena);
+    ASSERT_THROW(MIR::Passes::unroll_foreach(&irlist, irlist.arena),
+                 Util::Exceptions::InvalidArguments);
+}
+
+TEST(unroll_foreach, add_equal) {
+    auto irlist = lower("project('foo')\nsrcs = ['a']\nnames = ['b', 'c']\n"
+                        "foreach n : names\n  srcs += n\nendforeach\nfunc(srcs)");
+    MIR::State::Persistant pstate{src_root, build_root};
+    MIR::Passes::lower_project(&irlist, pstate);
+    MIR::lower(&irlist, pstate);
+
+    const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(irlist.instructions.back());
+    const auto & arr = std::get<MIR::Ptr<MIR::Array>>(f->pos_args.front());
+    ASSERT_EQ(arr->value.size(), 3);
+    unsigned i = 0;
+    for (const auto & v : {"a", "b", "c"}) {
+        ASSERT_EQ(std::get<MIR::Ptr<MIR::String>>(arr->value[i++])->value, v);
+    }
+}
+
+TEST(unroll_foreach, add_equal_variable) {
+    auto irlist = lower("project('foo')\nsrcs = ['a.cpp']\nmore = ['b.cpp', 'c.cpp']\n"
+                        "srcs += more\nforeach s : srcs\n  func(s)\nendforeach\n");
+    MIR::State::Persistant pstate{src_root, build_root};
+    MIR::Passes::lower_project(&irlist, pstate);
+    MIR::lower(&irlist, pstate);
+
+    // One iteration for each element, not one for each version of srcs
+    std::vector<std::string> args{};
+    for (const auto & i : irlist.instructions) {
+        if (const auto * f = std::get_if<MIR::Ptr<MIR::FunctionCall>>(&i)) {
+            const auto & arg = (*f)->pos_args.front();
+            args.emplace_back(std::get<MIR::Ptr<MIR::String>>(arg)->value);
+        }
+    }
+    ASSERT_EQ(args, (std::vector<std::string>{"a.cpp", "b.cpp", "c.cpp"}));
+}
+
+TEST(unroll_foreach, break_and_continue) {
+    auto irlist = lower("project('foo')\nnames = ['a', 'b', 'c', 'd']\nforeach n : names\n"
+                        "  if n == 'b'\n    continue\n  endif\n  func(n)\n  break\n"
+                        "endforeach\n");
+    MIR::State::Persistant pstate{src_root, build_root};
+    MIR::Passes::lower_project(&irlist, pstate);
+    MIR::lower(&irlist, pstate);
+
+    // Relational operators aren't lowered yet, so the condition is never known
+    ASSERT_TRUE(irlist.condition.has_value());
+    const auto & con = irlist.condition.value();
+
+    // Without continuing, func is called, and then the loop ends
+    ASSERT_EQ(con.if_false->instructions.size(), 1);
+    const auto & obj = con.if_false->instructions.front();
+    const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(obj);
+    ASSERT_EQ(f->name, "func");
+    const auto * exit = con.if_false->next;
+    ASSERT_NE(exit, nullptr);
+    ASSERT_TRUE(exit->instructions.empty());
+
+    // Continuing goes on to the second element, which breaks to the same place
+    const auto * second = con.if_true->next != nullptr ? con.if_true->next : con.if_true;
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::String>>(second->instructions.front())->value, "b");
+    ASSERT_EQ(second->condition->if_false->next, exit);
+}
+
+TEST(lower, foreach_not_known) {
+    auto irlist = lower("project('foo')\nforeach x : y\n  func(x)\nendforeach\n");
+    MIR::State::Persistant pstate{src_root, build_root};
+    MIR::Passes::lower_project(&irlist, pstate);
+    ASSERT_THROW(MIR::lower(&irlist, pstate), Util::Exceptions::MesonException);
 }
 
 TEST(machine_lower, simple) {
@@ -170,12 +462,13 @@ TEST(machine_lower, simple) {
     auto info = MIR::Machines::PerMachine<MIR::Machines::Info>(
         MIR::Machines::Info{MIR::Machines::Machine::BUILD, MIR::Machines::Kernel::LINUX,
                             MIR::Machines::Endian::LITTLE, "x86_64"});
-    bool progress = MIR::Passes::machine_lower(&irlist, info);
+    MIR::Passes::Pending pending{};
+    bool progress = MIR::Passes::machine_lower(&irlist, irlist.arena, info, {}, pending);
     ASSERT_TRUE(progress);
     ASSERT_EQ(irlist.instructions.size(), 2);
     const auto & r = irlist.instructions.back();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::String>>(r));
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::String>>(r)->value, "x86_64");
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::String>>(r));
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::String>>(r)->value, "x86_64");
 }
 
 TEST(machine_lower, in_array) {
@@ -183,17 +476,18 @@ TEST(machine_lower, in_array) {
     auto info = MIR::Machines::PerMachine<MIR::Machines::Info>(
         MIR::Machines::Info{MIR::Machines::Machine::BUILD, MIR::Machines::Kernel::LINUX,
                             MIR::Machines::Endian::LITTLE, "x86_64"});
-    bool progress = MIR::Passes::machine_lower(&irlist, info);
+    MIR::Passes::Pending pending{};
+    bool progress = MIR::Passes::machine_lower(&irlist, irlist.arena, info, {}, pending);
     ASSERT_TRUE(progress);
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & r = irlist.instructions.front();
 
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Array>>(r));
-    const auto & a = std::get<std::unique_ptr<MIR::Array>>(r)->value;
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Array>>(r));
+    const auto & a = std::get<MIR::Ptr<MIR::Array>>(r)->value;
 
     ASSERT_EQ(a.size(), 1);
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::String>>(a[0]));
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::String>>(a[0])->value, "x86_64");
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::String>>(a[0]));
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::String>>(a[0])->value, "x86_64");
 }
 
 TEST(machine_lower, in_function_args) {
@@ -201,17 +495,18 @@ TEST(machine_lower, in_function_args) {
     auto info = MIR::Machines::PerMachine<MIR::Machines::Info>(
         MIR::Machines::Info{MIR::Machines::Machine::BUILD, MIR::Machines::Kernel::LINUX,
                             MIR::Machines::Endian::LITTLE, "x86_64"});
-    bool progress = MIR::Passes::machine_lower(&irlist, info);
+    MIR::Passes::Pending pending{};
+    bool progress = MIR::Passes::machine_lower(&irlist, irlist.arena, info, {}, pending);
     ASSERT_TRUE(progress);
     ASSERT_EQ(irlist.instructions.size(), 1);
     const auto & r = irlist.instructions.front();
 
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::FunctionCall>>(r));
-    const auto & f = std::get<std::unique_ptr<MIR::FunctionCall>>(r);
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::FunctionCall>>(r));
+    const auto & f = std::get<MIR::Ptr<MIR::FunctionCall>>(r);
 
     ASSERT_EQ(f->pos_args.size(), 1);
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::String>>(f->pos_args[0]));
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::String>>(f->pos_args[0])->value, "little");
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::String>>(f->pos_args[0]));
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::String>>(f->pos_args[0])->value, "little");
 }
 
 TEST(machine_lower, in_condtion) {
@@ -219,15 +514,76 @@ TEST(machine_lower, in_condtion) {
     auto info = MIR::Machines::PerMachine<MIR::Machines::Info>(
         MIR::Machines::Info{MIR::Machines::Machine::BUILD, MIR::Machines::Kernel::LINUX,
                             MIR::Machines::Endian::LITTLE, "x86_64"});
-    bool progress = MIR::Passes::machine_lower(&irlist, info);
+    MIR::Passes::Pending pending{};
+    bool progress = MIR::Passes::machine_lower(&irlist, irlist.arena, info, {}, pending);
     ASSERT_TRUE(progress);
     ASSERT_EQ(irlist.instructions.size(), 0);
 
     const auto & con = irlist.condition;
     ASSERT_TRUE(con.has_value());
     const auto & obj = con.value().condition;
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::String>>(obj));
-    ASSERT_EQ(std::get<std::unique_ptr<MIR::String>>(obj)->value, "x86_64");
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::String>>(obj));
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::String>>(obj)->value, "x86_64");
+}
+
+TEST(machine_lower, from_compiler) {
+    auto irlist = lower("x = build_machine.cpu_family()\ny = host_machine.endian()");
+    auto info = MIR::Machines::PerMachine<MIR::Machines::Info>(
+        MIR::Machines::Info{MIR::Machines::Machine::BUILD, MIR::Machines::Kernel::LINUX,
+                            MIR::Machines::Endian::LITTLE, "x86_64"});
+
+    MIR::Toolchain::Compiler::Identity ident{};
+    ident.cpu_family = "aarch64";
+    ident.endian = MIR::Machines::Endian::BIG;
+    std::unordered_map<MIR::Toolchain::Language,
+                       MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>>
+        tc_map{};
+    tc_map[MIR::Toolchain::Language::CPP] =
+        MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>{
+            std::make_shared<MIR::Toolchain::Toolchain>(
+                MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD,
+                MIR::Toolchain::Toolchain::Detectors{
+                    [=]() {
+                        return std::make_unique<MIR::Toolchain::Compiler::CPP::Gnu>(
+                            std::vector<std::string>{"null"}, ident);
+                    },
+                    [](const std::unique_ptr<MIR::Toolchain::Compiler::Compiler> &) {
+                        return nullptr;
+                    },
+                    []() { return nullptr; },
+                })};
+
+    // The calls wait for the compiler, which describes the machine
+    MIR::Passes::Pending pending{};
+    ASSERT_FALSE(MIR::Passes::machine_lower(&irlist, irlist.arena, info, tc_map, pending));
+    ASSERT_TRUE(pending.wait());
+    ASSERT_TRUE(MIR::Passes::machine_lower(&irlist, irlist.arena, info, tc_map, pending));
+
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::String>>(irlist.instructions.front())->value,
+              "aarch64");
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::String>>(irlist.instructions.back())->value, "big");
+    ASSERT_EQ(info.build().cpu_family, "aarch64");
+}
+
+TEST(pending, resumes_waiting) {
+    auto irlist = lower("x = 'a'\ny = 'b'");
+    const auto & waiting = irlist.instructions.front();
+    const auto & other = irlist.instructions.back();
+
+    MIR::Passes::Pending pending{};
+    std::atomic_bool on_pool = false;
+    pending.start(&waiting, [&]() { on_pool = Util::ThreadPool::in_worker(); }, waiting);
+    ASSERT_TRUE(pending.ready(other));
+
+    // Only the instruction that was waiting is lowered again
+    ASSERT_TRUE(pending.wait());
+    ASSERT_TRUE(on_pool);
+    ASSERT_TRUE(pending.ready(waiting));
+    ASSERT_FALSE(pending.ready(other));
+
+    pending.resume_all();
+    ASSERT_TRUE(pending.ready(other));
+    ASSERT_FALSE(pending.wait());
 }
 
 TEST(insert_compiler, simple) {
@@ -245,15 +601,86 @@ TEST(insert_compiler, simple) {
         MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>{tc};
 
     auto irlist = lower("x = meson.get_compiler('cpp')");
-    bool progress = MIR::Passes::insert_compilers(&irlist, tc_map);
+    MIR::Passes::Pending pending{};
+    bool progress = MIR::Passes::insert_compilers(&irlist, irlist.arena, tc_map, pending);
     ASSERT_TRUE(progress);
     ASSERT_EQ(irlist.instructions.size(), 1);
 
     const auto & e = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Compiler>>(e));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Compiler>>(e));
 
-    const auto & c = std::get<std::unique_ptr<MIR::Compiler>>(e);
-    ASSERT_EQ(c->toolchain->compiler->id(), "clang");
+    const auto & c = std::get<MIR::Ptr<MIR::Compiler>>(e);
+    ASSERT_EQ(c->toolchain->compiler()->id(), "clang");
+}
+
+TEST(insert_compiler, only_finds_compiler) {
+    unsigned compilers = 0, linkers = 0, archivers = 0;
+    // Detection can't finish until the test allows it to
+    std::promise<void> release{};
+    auto released = release.get_future().share();
+    auto tc = std::make_shared<MIR::Toolchain::Toolchain>(
+        MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD,
+        MIR::Toolchain::Toolchain::Detectors{
+            [&]() {
+                ++compilers;
+                released.wait();
+                return std::make_unique<MIR::Toolchain::Compiler::CPP::Clang>(
+                    std::vector<std::string>{"null"});
+            },
+            [&](const std::unique_ptr<MIR::Toolchain::Compiler::Compiler> &) {
+                ++linkers;
+                return nullptr;
+            },
+            [&]() {
+                ++archivers;
+                return nullptr;
+            },
+        });
+    std::unordered_map<MIR::Toolchain::Language,
+                       MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>>
+        tc_map{};
+    tc_map[MIR::Toolchain::Language::CPP] =
+        MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>{tc};
+
+    auto irlist = lower("x = meson.get_compiler('cpp')\ny = meson.get_compiler('cpp')");
+    MIR::Passes::Pending pending{};
+
+    // The compiler is found in the background, then the calls are replaced
+    const bool progress = MIR::Passes::insert_compilers(&irlist, irlist.arena, tc_map, pending);
+    release.set_value();
+    ASSERT_FALSE(progress);
+    ASSERT_TRUE(pending.wait());
+    ASSERT_TRUE(MIR::Passes::insert_compilers(&irlist, irlist.arena, tc_map, pending));
+    ASSERT_FALSE(pending.wait());
+
+    ASSERT_EQ(compilers, 1);
+    ASSERT_EQ(linkers, 0);
+    ASSERT_EQ(archivers, 0);
+}
+
+TEST(insert_compiler, not_found) {
+    auto tc = std::make_shared<MIR::Toolchain::Toolchain>(
+        MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD,
+        MIR::Toolchain::Toolchain::Detectors{
+            []() { return nullptr; },
+            [](const std::unique_ptr<MIR::Toolchain::Compiler::Compiler> &) { return nullptr; },
+            []() { return nullptr; },
+        });
+    std::unordered_map<MIR::Toolchain::Language,
+                       MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>>
+        tc_map{};
+    tc_map[MIR::Toolchain::Language::CPP] =
+        MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>{tc};
+
+    auto irlist = lower("x = meson.get_compiler('cpp')");
+    MIR::Passes::Pending pending{};
+    ASSERT_FALSE(MIR::Passes::insert_compilers(&irlist, irlist.arena, tc_map, pending));
+    try {
+        (void)pending.wait();
+        FAIL();
+    } catch (Util::Exceptions::MesonException & e) {
+        ASSERT_EQ(e.message, "Could not find a cpp compiler for the build machine");
+    }
 }
 
 TEST(insert_compiler, unknown_language) {
@@ -262,32 +689,242 @@ TEST(insert_compiler, unknown_language) {
         tc_map{};
 
     auto irlist = lower("x = meson.get_compiler('cpp')");
+    MIR::Passes::Pending pending{};
     try {
-        (void)MIR::Passes::insert_compilers(&irlist, tc_map);
+        (void)MIR::Passes::insert_compilers(&irlist, irlist.arena, tc_map, pending);
         FAIL();
     } catch (Util::Exceptions::MesonException & e) {
         ASSERT_EQ(e.message, "No compiler for language");
     }
 }
 
+namespace {
+
+using ToolchainMap =
+    std::unordered_map<MIR::Toolchain::Language,
+                       MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>>;
+
+ToolchainMap gnu_toolchain(const std::vector<std::string> & command) {
+    auto comp = std::make_unique<MIR::Toolchain::Compiler::CPP::Gnu>(command);
+    const auto * raw = comp.get();
+    auto tc = std::make_shared<MIR::Toolchain::Toolchain>(
+        std::move(comp),
+        std::make_unique<MIR::Toolchain::Linker::Drivers::Gnu>(
+            MIR::Toolchain::Linker::GnuBFD{command}, raw),
+        std::make_unique<MIR::Toolchain::Archiver::Gnu>(command));
+    ToolchainMap tc_map{};
+    tc_map[MIR::Toolchain::Language::CPP] =
+        MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>{tc};
+    return tc_map;
+}
+
+} // namespace
+
+TEST(toolchain, report_in_order) {
+    auto tc = gnu_toolchain({"null"}).at(MIR::Toolchain::Language::CPP).build();
+
+    std::ostringstream out{};
+    tc->report(out);
+    const auto & lines = out.str();
+    const auto compiler = lines.find("C++ compiler for the build machine: ");
+    const auto linker = lines.find("C++ linker for the build machine: ");
+    const auto archiver = lines.find("Static archiver for the build machine: ");
+    ASSERT_NE(compiler, std::string::npos);
+    ASSERT_NE(linker, std::string::npos);
+    ASSERT_NE(archiver, std::string::npos);
+    ASSERT_LT(compiler, linker);
+    ASSERT_LT(linker, archiver);
+
+    // Each tool is only reported once
+    std::ostringstream again{};
+    tc->report(again);
+    ASSERT_EQ(again.str(), "");
+}
+
+TEST(toolchain, report_from_caller) {
+    auto tc = std::make_shared<MIR::Toolchain::Toolchain>(
+        MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD,
+        MIR::Toolchain::Toolchain::Detectors{
+            []() {
+                return std::make_unique<MIR::Toolchain::Compiler::CPP::Gnu>(
+                    std::vector<std::string>{"null"});
+            },
+            [](const std::unique_ptr<MIR::Toolchain::Compiler::Compiler> &) { return nullptr; },
+            []() { return nullptr; },
+        });
+
+    // Nothing has been found yet
+    std::ostringstream before{};
+    tc->report(before);
+    ASSERT_EQ(before.str(), "");
+
+    // Finding the compiler on another thread leaves printing it to the caller
+    std::async(std::launch::async, [&]() { (void)tc->compiler(); }).get();
+    std::ostringstream after{};
+    tc->report(after);
+    ASSERT_NE(after.str().find("C++ compiler for the build machine: "), std::string::npos);
+    ASSERT_EQ(after.str().find("linker"), std::string::npos);
+}
+
+TEST(lower_compiler_methods, batched) {
+    if (system("g++ --version > /dev/null 2>&1") != 0) {
+        GTEST_SKIP();
+    }
+
+    // Log each time the compiler is run
+    char dir_templ[] = "/tmp/meson++-compiler-methods-XXXXXX";
+    ASSERT_NE(mkdtemp(dir_templ), nullptr);
+    const std::filesystem::path dir{dir_templ};
+    const auto log = dir / "log";
+    const auto wrapper = dir / "g++";
+    std::ofstream{wrapper} << "#!/bin/sh\necho run >> '" << log.string() << "'\nexec g++ \"$@\"\n";
+    std::filesystem::permissions(wrapper, std::filesystem::perms::owner_all);
+
+    auto irlist = lower("cc = meson.get_compiler('cpp')\n"
+                        "a = cc.has_header('cstdio')\n"
+                        "b = cc.sizeof('int')\n"
+                        "c = cc.has_argument('-Wall')\n"
+                        "d = cc.has_header('vector')\n"
+                        "e = cc.sizeof('char')\n"
+                        "f = cc.has_argument('-O2')\n");
+    MIR::Passes::Pending pending{};
+    ASSERT_TRUE(
+        MIR::Passes::insert_compilers(&irlist, irlist.arena, gnu_toolchain({wrapper}), pending));
+
+    // The checks run in the background, and the calls are lowered once they finish
+    ASSERT_FALSE(MIR::Passes::lower_compiler_methods(&irlist, irlist.arena, pending));
+    while (pending.wait()) {
+    }
+    ASSERT_TRUE(MIR::Passes::lower_compiler_methods(&irlist, irlist.arena, pending));
+    ASSERT_FALSE(MIR::Passes::lower_compiler_methods(&irlist, irlist.arena, pending));
+
+    std::vector<std::string> bools{};
+    std::vector<int64_t> numbers{};
+    for (const auto & i : irlist.instructions) {
+        if (const auto * b = std::get_if<MIR::Ptr<MIR::Boolean>>(&i)) {
+            ASSERT_TRUE((*b)->value);
+            bools.emplace_back((*b)->var.name);
+        } else if (const auto * n = std::get_if<MIR::Ptr<MIR::Number>>(&i)) {
+            numbers.emplace_back((*n)->value);
+        }
+    }
+    ASSERT_EQ(bools, (std::vector<std::string>{"a", "c", "d", "f"}));
+    ASSERT_EQ(numbers, (std::vector<int64_t>{4, 1}));
+
+    // One run for the headers, one for the sizes, and one for the arguments
+    std::ifstream in{log};
+    std::string line;
+    unsigned runs = 0;
+    while (std::getline(in, line)) {
+        ++runs;
+    }
+    ASSERT_EQ(runs, 3);
+
+    std::filesystem::remove_all(dir);
+}
+
+TEST(lower_compiler_methods, not_defined_yet) {
+    auto irlist = lower("x = cc.get_id()\ncc = meson.get_compiler('cpp')");
+    MIR::Passes::Pending pending{};
+    ASSERT_TRUE(
+        MIR::Passes::insert_compilers(&irlist, irlist.arena, gnu_toolchain({"null"}), pending));
+    ASSERT_FALSE(MIR::Passes::lower_compiler_methods(&irlist, irlist.arena, pending));
+}
+
+TEST(lower_compiler_methods, unknown_method) {
+    auto irlist = lower("cc = meson.get_compiler('cpp')\nx = cc.not_a_method()");
+    MIR::Passes::Pending pending{};
+    ASSERT_TRUE(
+        MIR::Passes::insert_compilers(&irlist, irlist.arena, gnu_toolchain({"null"}), pending));
+    try {
+        (void)MIR::Passes::lower_compiler_methods(&irlist, irlist.arena, pending);
+        FAIL();
+    } catch (Util::Exceptions::MesonException & e) {
+        ASSERT_EQ(e.message, "cc has no method not_a_method");
+    }
+}
+
+TEST(speculate_project, reused) {
+    auto block = parse("project('foo', 'cpp', 'notalanguage')\nx = 1");
+    MIR::State::Persistant pstate{src_root, build_root};
+
+    MIR::Passes::speculate_project(block->statements.front(), pstate);
+    ASSERT_EQ(pstate.toolchains.size(), 1);
+    ASSERT_EQ(pstate.speculative.size(), 1);
+    const auto tc = pstate.toolchains.at(MIR::Toolchain::Language::CPP).build();
+
+    // project() has to use the toolchain that is already being detected
+    auto irlist = MIR::lower_ast(block, pstate);
+    try {
+        MIR::Passes::lower_project(&irlist, pstate);
+        FAIL();
+    } catch (Util::Exceptions::MesonException & e) {
+        ASSERT_EQ(e.message, "No known language \"notalanguage\"");
+    }
+    ASSERT_EQ(pstate.toolchains.at(MIR::Toolchain::Language::CPP).build(), tc);
+}
+
+TEST(speculate_project, error_rethrown) {
+    auto block = parse("project('foo', 'cpp')");
+    MIR::State::Persistant pstate{src_root, build_root};
+    std::atomic_uint attempts{0};
+    pstate.toolchains[MIR::Toolchain::Language::CPP] =
+        MIR::Machines::PerMachine<std::shared_ptr<MIR::Toolchain::Toolchain>>{
+            std::make_shared<MIR::Toolchain::Toolchain>(
+                MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD,
+                MIR::Toolchain::Toolchain::Detectors{
+                    [&]() {
+                        ++attempts;
+                        return nullptr;
+                    },
+                    [](const std::unique_ptr<MIR::Toolchain::Compiler::Compiler> &) {
+                        return nullptr;
+                    },
+                    []() { return nullptr; },
+                })};
+
+    // The failure in the background doesn't escape the future
+    MIR::Passes::speculate_project(block->statements.front(), pstate);
+    ASSERT_EQ(pstate.speculative.size(), 1);
+    pstate.speculative.front().get();
+    ASSERT_EQ(attempts, 1);
+
+    // It is thrown when the compiler is needed
+    try {
+        (void)pstate.toolchains.at(MIR::Toolchain::Language::CPP).build()->compiler();
+        FAIL();
+    } catch (Util::Exceptions::MesonException & e) {
+        ASSERT_EQ(e.message, "Could not find a cpp compiler for the build machine");
+    }
+    ASSERT_EQ(attempts, 2);
+}
+
+TEST(speculate_project, not_project) {
+    auto block = parse("x = 1");
+    MIR::State::Persistant pstate{src_root, build_root};
+    MIR::Passes::speculate_project(block->statements.front(), pstate);
+    ASSERT_TRUE(pstate.toolchains.empty());
+}
+
 TEST(files, simple) {
     auto irlist = lower("x = files('foo.c')");
 
     const MIR::State::Persistant pstate{src_root, build_root};
+    MIR::Passes::Pending pending{};
 
-    bool progress = MIR::Passes::lower_free_functions(&irlist, pstate);
+    bool progress = MIR::Passes::lower_free_functions(&irlist, irlist.arena, pstate, pending);
     ASSERT_TRUE(progress);
     ASSERT_EQ(irlist.instructions.size(), 1);
 
     const auto & r = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Array>>(r));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Array>>(r));
 
-    const auto & a = std::get<std::unique_ptr<MIR::Array>>(r)->value;
+    const auto & a = std::get<MIR::Ptr<MIR::Array>>(r)->value;
     ASSERT_EQ(a.size(), 1);
 
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::File>>(a[0]));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::File>>(a[0]));
 
-    const auto & f = std::get<std::unique_ptr<MIR::File>>(a[0]);
+    const auto & f = std::get<MIR::Ptr<MIR::File>>(a[0]);
     ASSERT_EQ(f->file.get_name(), "foo.c");
 }
 
@@ -296,17 +933,22 @@ TEST(executable, simple) {
 
     MIR::State::Persistant pstate{src_root, build_root};
     pstate.toolchains[MIR::Toolchain::Language::CPP] =
-        std::make_shared<MIR::Toolchain::Toolchain>(MIR::Toolchain::get_toolchain(
-            MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD));
+        std::make_shared<MIR::Toolchain::Toolchain>(MIR::Toolchain::Language::CPP,
+                                                    MIR::Machines::Machine::BUILD);
 
-    bool progress = MIR::Passes::lower_free_functions(&irlist, pstate);
+    MIR::Passes::Pending pending{};
+
+    // The compiler is found in the background before the target is lowered
+    ASSERT_FALSE(MIR::Passes::lower_free_functions(&irlist, irlist.arena, pstate, pending));
+    ASSERT_TRUE(pending.wait());
+    bool progress = MIR::Passes::lower_free_functions(&irlist, irlist.arena, pstate, pending);
     ASSERT_TRUE(progress);
     ASSERT_EQ(irlist.instructions.size(), 1);
 
     const auto & r = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::Executable>>(r));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Executable>>(r));
 
-    const auto & e = std::get<std::unique_ptr<MIR::Executable>>(r)->value;
+    const auto & e = std::get<MIR::Ptr<MIR::Executable>>(r)->value;
     ASSERT_EQ(e.name, "exe");
     ASSERT_TRUE(e.arguments.find(MIR::Toolchain::Language::CPP) != e.arguments.end());
 
@@ -318,22 +960,73 @@ TEST(executable, simple) {
     ASSERT_EQ(a.value, "foo");
 }
 
+TEST(executable, pool) {
+    auto irlist = lower("x = executable('exe', 'source.c', pool : 'heavy_compile')");
+
+    MIR::State::Persistant pstate{src_root, build_root};
+    pstate.toolchains[MIR::Toolchain::Language::CPP] =
+        std::make_shared<MIR::Toolchain::Toolchain>(MIR::Toolchain::Language::CPP,
+                                                    MIR::Machines::Machine::BUILD);
+
+    MIR::Passes::Pending pending{};
+    ASSERT_TRUE(MIR::Passes::lower_free_functions(&irlist, irlist.arena, pstate, pending));
+    const auto & r = irlist.instructions.front();
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::Executable>>(r));
+    ASSERT_EQ(std::get<MIR::Ptr<MIR::Executable>>(r)->value.pool, "heavy_compile");
+}
+
+TEST(executable, unknown_pool) {
+    auto irlist = lower("x = executable('exe', 'source.c', pool : 'console')");
+
+    MIR::State::Persistant pstate{src_root, build_root};
+    pstate.toolchains[MIR::Toolchain::Language::CPP] =
+        std::make_shared<MIR::Toolchain::Toolchain>(MIR::Toolchain::Language::CPP,
+                                                    MIR::Machines::Machine::BUILD);
+
+    MIR::Passes::Pending pending{};
+    try {
+        (void)MIR::Passes::lower_free_functions(&irlist, irlist.arena, pstate, pending);
+        FAIL();
+    } catch (Util::Exceptions::InvalidArguments & e) {
+        ASSERT_EQ(e.message, "executable pool must be 'heavy_compile'");
+    }
+}
+
+TEST(executable, link_pool) {
+    // Links are always in the link pool, so it can't be asked for
+    auto irlist = lower("x = executable('exe', 'source.c', pool : 'link')");
+
+    MIR::State::Persistant pstate{src_root, build_root};
+    pstate.toolchains[MIR::Toolchain::Language::CPP] =
+        std::make_shared<MIR::Toolchain::Toolchain>(MIR::Toolchain::Language::CPP,
+                                                    MIR::Machines::Machine::BUILD);
+
+    MIR::Passes::Pending pending{};
+    ASSERT_THROW((void)MIR::Passes::lower_free_functions(&irlist, irlist.arena, pstate, pending),
+                 Util::Exceptions::InvalidArguments);
+}
+
 TEST(static_library, simple) {
     auto irlist = lower("x = static_library('exe', 'source.c', cpp_args : '-Dfoo')");
 
     MIR::State::Persistant pstate{src_root, build_root};
     pstate.toolchains[MIR::Toolchain::Language::CPP] =
-        std::make_shared<MIR::Toolchain::Toolchain>(MIR::Toolchain::get_toolchain(
-            MIR::Toolchain::Language::CPP, MIR::Machines::Machine::BUILD));
+        std::make_shared<MIR::Toolchain::Toolchain>(MIR::Toolchain::Language::CPP,
+                                                    MIR::Machines::Machine::BUILD);
+
+    MIR::Passes::Pending pending{};
 
-    bool progress = MIR::Passes::lower_free_functions(&irlist, pstate);
+    // The compiler is found in the background before the target is lowered
+    ASSERT_FALSE(MIR::Passes::lower_free_functions(&irlist, irlist.arena, pstate, pending));
+    ASSERT_TRUE(pending.wait());
+    bool progress = MIR::Passes::lower_free_functions(&irlist, irlist.arena, pstate, pending);
     ASSERT_TRUE(progress);
     ASSERT_EQ(irlist.instructions.size(), 1);
 
     const auto & r = irlist.instructions.front();
-    ASSERT_TRUE(std::holds_alternative<std::unique_ptr<MIR::StaticLibrary>>(r));
+    ASSERT_TRUE(std::holds_alternative<MIR::Ptr<MIR::StaticLibrary>>(r));
 
-    const auto & e = std::get<std::unique_ptr<MIR::StaticLibrary>>(r)->value;
+    const auto & e = std::get<MIR::Ptr<MIR::StaticLibrary>>(r)->value;
     ASSERT_EQ(e.name, "exe");
     ASSERT_TRUE(e.arguments.find(MIR::Toolchain::Language::CPP) != e.arguments.end());
 
@@ -1,11 +1,15 @@
 // SPDX-license-identifier: Apache-2.0
 // Copyright © 2021 Dylan Baker
 
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <sstream>
 
 #include "getopt.h" // XXX: This is probably not permanent
 
 #include "exceptions.hpp"
+#include "files.hpp"
 #include "options.hpp"
 #include "version.hpp"
 
@@ -129,4 +133,45 @@ Options parse_opts(int argc, char * argv[]) {
     return opts;
 }
 
+fs::path saved_options_file(const fs::path & builddir) {
+    return builddir / "meson-private" / "cmd_line.txt";
+}
+
+std::unordered_map<std::string, std::string> load_options(const fs::path & builddir) {
+    std::unordered_map<std::string, std::string> options{};
+    std::ifstream in{saved_options_file(builddir)};
+    std::string line;
+    while (std::getline(in, line)) {
+        const auto n = line.find("=");
+        if (line.empty() || line[0] == '#' || n == std::string::npos) {
+            continue;
+        }
+        options[line.substr(0, n)] = line.substr(n + 1);
+    }
+    return options;
+}
+
+std::unordered_map<std::string, std::string> configured_options(const ConfigureOptions & conf) {
+    auto options = load_options(conf.builddir);
+    for (const auto & [opt, value] : conf.options) {
+        options[opt] = value;
+    }
+    return options;
+}
+
+void save_options(const fs::path & builddir,
+                  const std::unordered_map<std::string, std::string> & options) {
+    // Sort the options, so that the same options always make the same file
+    const std::map<std::string, std::string> sorted{options.begin(), options.end()};
+    std::stringstream ss{};
+    ss << "# Options passed with -D, used again when reconfiguring\n";
+    for (const auto & [opt, value] : sorted) {
+        ss << opt << "=" << value << "\n";
+    }
+
+    // The file is an input of the regeneration edge, so it must only be
+    // touched when it changes
+    Util::write_if_changed(saved_options_file(builddir), ss.str());
+}
+
 } // namespace Options
@@ -45,4 +45,27 @@ struct Options {
 /// Parse options and return an Options object
 Options parse_opts(int argc, char * argv[]);
 
+/// The file the -D options of the last configuration are saved to
+fs::path saved_options_file(const fs::path & builddir);
+
+/**
+ * Read the -D options saved by the last configuration, if any
+ *
+ * Reconfiguring keeps these, so that regenerating the build files doesn't
+ * need the options to be passed again.
+ */
+std::unordered_map<std::string, std::string> load_options(const fs::path & builddir);
+
+/**
+ * The -D options to configure with
+ *
+ * These are the options saved by the last configuration, with any that are
+ * passed on the command line replacing them.
+ */
+std::unordered_map<std::string, std::string> configured_options(const ConfigureOptions &);
+
+/// Save the -D options, if they have changed
+void save_options(const fs::path & builddir,
+                  const std::unordered_map<std::string, std::string> & options);
+
 } // namespace Options
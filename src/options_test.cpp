@@ -0,0 +1,84 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <string>
+
+#include "options.hpp"
+
+namespace {
+
+std::filesystem::path temp_dir() {
+    std::string templ = std::filesystem::temp_directory_path() / "meson++-options-XXXXXX";
+    if (mkdtemp(templ.data()) == nullptr) {
+        throw std::runtime_error{"Could not create a temporary directory"};
+    }
+    return templ;
+}
+
+std::string read(const std::filesystem::path & p) {
+    std::ifstream in{p};
+    std::stringstream ss{};
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+} // namespace
+
+TEST(options, round_trip) {
+    const auto build = temp_dir();
+    const std::unordered_map<std::string, std::string> options{
+        {"b_ndebug", "true"},
+        {"backend_max_links", "4"},
+        {"with_equals", "a=b"},
+    };
+    Options::save_options(build, options);
+    ASSERT_EQ(Options::load_options(build), options);
+    std::filesystem::remove_all(build);
+}
+
+TEST(options, nothing_saved) {
+    const auto build = temp_dir();
+    ASSERT_TRUE(Options::load_options(build).empty());
+    std::filesystem::remove_all(build);
+}
+
+TEST(options, unchanged) {
+    const auto build = temp_dir();
+    const auto file = Options::saved_options_file(build);
+    Options::save_options(build, {{"a", "1"}, {"b", "2"}});
+    const auto contents = read(file);
+
+    // The file is an input of build.ninja, so saving the same options must
+    // leave it alone
+    const auto before = std::filesystem::last_write_time(file) - std::chrono::hours{1};
+    std::filesystem::last_write_time(file, before);
+    Options::save_options(build, {{"b", "2"}, {"a", "1"}});
+    ASSERT_EQ(std::filesystem::last_write_time(file), before);
+    ASSERT_EQ(read(file), contents);
+
+    std::filesystem::remove_all(build);
+}
+
+TEST(options, define_overrides_saved) {
+    const auto build = temp_dir();
+    Options::save_options(build, {{"kept", "old"}, {"replaced", "old"}});
+
+    Options::ConfigureOptions conf{};
+    conf.builddir = build;
+    conf.options = {{"replaced", "new"}, {"added", "new"}};
+
+    const auto options = Options::configured_options(conf);
+    ASSERT_EQ(options, (std::unordered_map<std::string, std::string>{
+                           {"kept", "old"},
+                           {"replaced", "new"},
+                           {"added", "new"},
+                       }));
+
+    std::filesystem::remove_all(build);
+}
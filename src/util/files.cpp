@@ -0,0 +1,72 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+
+#include "exceptions.hpp"
+#include "files.hpp"
+
+namespace Util {
+
+namespace {
+
+/// Does the file already hold exactly these contents?
+bool unchanged(const std::filesystem::path & path, std::string_view contents) {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    if (ec || size != contents.size()) {
+        return false;
+    }
+    std::ifstream in{path, std::ios::binary};
+    std::string existing(size, '\0');
+    in.read(existing.data(), size);
+    return in && existing == contents;
+}
+
+} // namespace
+
+bool write_if_changed(const std::filesystem::path & path, std::string_view contents,
+                      bool force) {
+    if (!force && unchanged(path, contents)) {
+        return false;
+    }
+
+    std::error_code ec;
+    if (path.has_parent_path()) {
+        std::filesystem::create_directories(path.parent_path(), ec);
+    }
+
+    auto tmp = path;
+    tmp += ".tmp";
+    const int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        throw Exceptions::MesonException{"Could not open " + tmp.string() + " for writing"};
+    }
+
+    const char * data = contents.data();
+    std::size_t left = contents.size();
+    while (left > 0) {
+        const auto n = ::write(fd, data, left);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        data += n;
+        left -= n;
+    }
+
+    if (::close(fd) != 0 || left > 0 || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        throw Exceptions::MesonException{"Could not write " + path.string()};
+    }
+    return true;
+}
+
+} // namespace Util
@@ -0,0 +1,31 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+/**
+ * Helpers for writing files in the build directory
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string_view>
+
+namespace Util {
+
+/**
+ * Replace the contents of a file, unless it already has them
+ *
+ * Files that are the inputs or outputs of build edges must only be touched
+ * when they change, or they make ninja do work for nothing, so an unchanged
+ * file is left alone unless force is set. The new contents are written to a
+ * temporary file which is then renamed over the old one, so that an
+ * interrupted configure never leaves a partial file behind. Any missing
+ * parent directories are created.
+ *
+ * Returns true if the file was written, and throws MesonException if it
+ * couldn't be.
+ */
+bool write_if_changed(const std::filesystem::path &, std::string_view contents,
+                      bool force = false);
+
+} // namespace Util
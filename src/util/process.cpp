@@ -1,117 +1,605 @@
 // SPDX-license-identifier: Apache-2.0
 // Copyright © 2021 Intel Corporation
 
+#include <algorithm>
 #include <array>
 #include <cstring>
+#include <string_view>
 #include <iostream>
+#include <list>
+#include <optional>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 // TODO: a windows version of this.
+#include <fcntl.h>
 #include <poll.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "process.hpp"
+#include "exceptions.hpp"
+#include "threads.hpp"
 
 namespace Util {
 
 #define READ 0
 #define WRITE 1
 
-namespace {}
+namespace {
 
-Result process(const std::vector<std::string> & cmd) {
-    std::string out{}, err{};
-    int out_pipes[2];
-    int err_pipes[2];
-    if (pipe(out_pipes) != 0) {
-        // Do something reall
-        throw std::exception{};
+/// Throw an error for a system call that failed, from errno
+[[noreturn]] void system_error(const std::string & what) {
+    throw Exceptions::MesonException{what + ": " + strerror(errno)};
+}
+
+/**
+ * Start cmd, with its stdout and stderr connected to new pipes
+ *
+ * Returns 0 on success, or the errno value that starting the child failed
+ * with, in which case the pipes have already been closed. Throws if the pipes
+ * can't be created, after closing any that were.
+ */
+int spawn(const std::vector<std::string> & cmd, pid_t & pid, int (&out_pipes)[2],
+          int (&err_pipes)[2]) {
+    // Other threads may be starting processes at the same time, make sure
+    // they don't inherit our pipes, or we won't see them close until those
+    // processes exit as well.
+    if (pipe2(out_pipes, O_CLOEXEC) != 0) {
+        system_error("Could not create a pipe for " + cmd.front());
     }
-    if (pipe(err_pipes) != 0) {
-        // Do something reall
-        throw std::exception{};
+    if (pipe2(err_pipes, O_CLOEXEC) != 0) {
+        const int error = errno;
+        close(out_pipes[READ]);
+        close(out_pipes[WRITE]);
+        errno = error;
+        system_error("Could not create a pipe for " + cmd.front());
     }
 
-    pid_t pid = fork();
-    if (pid == 0) {
-        dup2(out_pipes[WRITE], STDOUT_FILENO);
-        dup2(err_pipes[WRITE], STDERR_FILENO);
-        close(out_pipes[READ]);
+    // Everything the child needs is prepared here, in the parent, so that
+    // spawning doesn't need to allocate anything, or copy our address space.
+    std::vector<char *> argv{};
+    argv.reserve(cmd.size() + 1);
+    for (const auto & c : cmd) {
+        argv.emplace_back(const_cast<char *>(c.c_str()));
+    }
+    argv.emplace_back(nullptr);
+
+    // The pipes are close-on-exec, which the copies made here are not, so
+    // the child only ends up with its own end of them.
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out_pipes[WRITE], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_pipes[WRITE], STDERR_FILENO);
+
+    const int spawned = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (spawned != 0) {
+        for (const auto & p : {out_pipes, err_pipes}) {
+            close(p[READ]);
+            close(p[WRITE]);
+        }
+    } else {
         close(out_pipes[WRITE]);
-        close(err_pipes[READ]);
         close(err_pipes[WRITE]);
+    }
+
+    return spawned;
+}
+
+/**
+ * Convert a status from waitpid into a returncode
+ *
+ * A process killed by a signal n is reported as -n.
+ */
+int8_t returncode(const int & status) {
+    if (WIFSIGNALED(status)) {
+        return -WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+/**
+ * Splits one output stream of a process into calls to a Streams::Callback
+ */
+class Reader {
+  public:
+    Reader(const Streams::Callback & cb, std::string & c)
+        : callback{cb}, captured{c}, partial{} {};
 
-        char * c_cmd[cmd.size() + 1];
-        for (unsigned i = 0; i < cmd.size(); ++i) {
-            c_cmd[i] = strdup(cmd[i].c_str());
+    /// Handle a chunk of output, returns false if the process should be stopped
+    bool feed(std::string_view chunk, const Streams & streams) {
+        if (captured.size() < streams.capture) {
+            captured.append(chunk.substr(0, streams.capture - captured.size()));
         }
-        c_cmd[cmd.size()] = NULL;
 
-        execvp(c_cmd[0], c_cmd);
-        std::cerr << "Program failed to execute: " << strerror(errno) << std::endl;
-        _exit(127);
+        if (!callback) {
+            return true;
+        }
+        if (!streams.lines) {
+            return callback(chunk);
+        }
+
+        std::string_view::size_type nl;
+        while ((nl = chunk.find('\n')) != std::string_view::npos) {
+            bool keep_going;
+            if (partial.empty()) {
+                keep_going = callback(chunk.substr(0, nl));
+            } else {
+                partial.append(chunk.substr(0, nl));
+                keep_going = callback(partial);
+                partial.clear();
+            }
+            if (!keep_going) {
+                return false;
+            }
+            chunk.remove_prefix(nl + 1);
+        }
+
+        partial.append(chunk);
+        // Don't let a process that never writes a newline use unbounded memory
+        if (partial.size() >= MAX_LINE) {
+            const bool keep_going = callback(partial);
+            partial.clear();
+            return keep_going;
+        }
+        return true;
     }
 
-    close(out_pipes[WRITE]);
-    close(err_pipes[WRITE]);
+    /// Handle the end of the stream, passing on any unterminated final line
+    bool finish() {
+        if (!callback || partial.empty()) {
+            return true;
+        }
+        const bool keep_going = callback(partial);
+        partial.clear();
+        return keep_going;
+    }
 
-    std::array<char, 16384> buffer{};
-    int status;
-    int count = 0;
+  private:
+    /// Longer lines than this are passed on in pieces
+    static constexpr std::size_t MAX_LINE = 1 << 20;
+
+    const Streams::Callback & callback;
+    std::string & captured;
+    std::string partial;
+};
+
+/**
+ * Get a pidfd for a child, which becomes readable when it exits
+ *
+ * Returns -1 if the kernel doesn't support them.
+ */
+int open_pidfd(const pid_t & pid) {
+#ifdef SYS_pidfd_open
+    return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+    return -1;
+#endif
+}
+
+/// Report the exception being handled, which a callback let escape the pool's thread
+void report_exception() {
+    try {
+        throw;
+    } catch (const std::exception & e) {
+        std::cerr << "Error: uncaught exception in a process callback: " << e.what()
+                  << std::endl;
+    } catch (...) {
+        std::cerr << "Error: uncaught exception in a process callback" << std::endl;
+    }
+}
 
+/// Call a ProcessPool::Callback, which is not allowed to throw out of the pool's thread
+void deliver(const ProcessPool::Callback & done, Result && result) {
+    try {
+        done(std::move(result));
+    } catch (...) {
+        report_exception();
+    }
+}
+
+/**
+ * A child process, and the read ends of its pipes
+ *
+ * If it hasn't been waited for when it is destroyed, because reading from it
+ * failed or a callback threw, it is killed and reaped.
+ */
+class Child {
+  public:
+    Child(const pid_t & p, const int & out, const int & err)
+        : pid{p}, fds{{{out, POLLIN, 0}, {err, POLLIN, 0}}} {};
+    Child(const Child &) = delete;
+
+    ~Child() {
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            wait();
+        }
+    };
+
+    void close(pollfd & f) {
+        ::close(f.fd);
+        // Negative fds are ignored by poll
+        f.fd = -1;
+    }
+
+    /// Close the pipes, and wait for the process to exit
+    int wait() {
+        for (auto & f : fds) {
+            if (f.fd >= 0) {
+                close(f);
+            }
+        }
+        int status = 0;
+        while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+        }
+        pid = -1;
+        return status;
+    }
+
+    pid_t pid;
     std::array<pollfd, 2> fds;
-    fds[0] = {out_pipes[READ], POLLIN, 0};
-    fds[1] = {err_pipes[READ], POLLIN, 0};
+};
 
-    while (true) {
+/// Create the eventfd that wakes up a ProcessPool's thread
+int open_wake() {
+    const int fd = eventfd(0, EFD_CLOEXEC);
+    if (fd < 0) {
+        system_error("Could not create an eventfd for the process pool");
+    }
+    return fd;
+}
+
+/// Create the epoll instance for a ProcessPool, closing `wake` if that fails
+int open_epoll(const int & wake) {
+    const int fd = epoll_create1(EPOLL_CLOEXEC);
+    if (fd < 0) {
+        const int error = errno;
+        close(wake);
+        errno = error;
+        system_error("Could not create an epoll instance for the process pool");
+    }
+    return fd;
+}
+
+/// Match what a shell reports for a command that can't be run
+Result failed_to_spawn(const int & error) {
+    return Result{127, "", "Program failed to execute: " + std::string{strerror(error)}};
+}
+
+} // namespace
+
+Result process(const std::vector<std::string> & cmd) { return process(cmd, Streams{}); };
+
+Result process(const std::vector<std::string> & cmd, const Streams & streams) {
+    std::string out{}, err{};
+    int out_pipes[2];
+    int err_pipes[2];
+
+    pid_t pid;
+    if (const int error = spawn(cmd, pid, out_pipes, err_pipes); error != 0) {
+        return failed_to_spawn(error);
+    }
+    Child child{pid, out_pipes[READ], err_pipes[READ]};
+    auto & fds = child.fds;
+
+    // One buffer is reused for every read, callbacks only get views of it
+    std::array<char, 16384> buffer{};
+
+    std::array<Reader, 2> readers{
+        Reader{streams.out, out},
+        Reader{streams.err, err},
+    };
+    bool cancelled = false;
+    while (!cancelled && (fds[0].fd >= 0 || fds[1].fd >= 0)) {
         int rt = poll(fds.data(), fds.size(), 5 * 1000);
 
         if (rt < 0) {
             std::cerr << "Error: " << strerror(errno) << std::endl;
+            continue;
         } else if (rt == 0) {
-            kill(pid, SIGKILL);
-            for (auto const & f : fds) {
-                close(f.fd);
-            }
+            // The child is killed and reaped as this unwinds
             // XXX: do something less silly here.
             throw std::exception{};
         }
 
-        if (fds[0].revents & POLLIN) {
-            count = read(out_pipes[READ], buffer.data(), buffer.size());
-            out.append(buffer.begin(), buffer.begin() + count);
-        }
-        if (fds[1].revents & POLLIN) {
-            count = read(err_pipes[READ], buffer.data(), buffer.size());
-            err.append(buffer.begin(), buffer.begin() + count);
-        }
+        for (unsigned i = 0; i < fds.size() && !cancelled; ++i) {
+            auto & f = fds[i];
+            if (f.fd < 0 || !(f.revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
 
-        if (fds[0].revents & POLLHUP and fds[1].revents & POLLHUP) {
-            break;
+            const auto count = read(f.fd, buffer.data(), buffer.size());
+            if (count > 0) {
+                cancelled = !readers[i].feed({buffer.data(), static_cast<std::size_t>(count)},
+                                             streams);
+            } else {
+                cancelled = !readers[i].finish();
+                child.close(f);
+            }
         }
     }
 
-    for (auto const & f : fds) {
-        close(f.fd);
+    if (cancelled) {
+        kill(child.pid, SIGKILL);
     }
+    const int status = child.wait();
+
+    return Result{returncode(status), out, err};
+};
 
-    while (waitpid(pid, &status, 0) == -1)
-        ;
+/// A command that has been started, and hasn't finished yet
+struct ProcessPool::Running {
+    Running(const pid_t & p, const int & o, const int & e, Job && job)
+        : pid{p}, pid_fd{open_pidfd(p)}, out_fd{o}, err_fd{e}, out{}, err{},
+          deadline{std::chrono::steady_clock::now() + job.timeout},
+          streams{std::move(job.streams)}, done{std::move(job.done)}, killed{false}, status{},
+          readers{{Reader{streams.out, out}, Reader{streams.err, err}}} {};
 
-    if (status > 255) {
-        status %= 255;
+    pid_t pid;
+    /// Readable once the process exits, or -1 if pidfds aren't supported
+    int pid_fd;
+    int out_fd;
+    int err_fd;
+    std::string out;
+    std::string err;
+    std::chrono::steady_clock::time_point deadline;
+    Streams streams;
+    Callback done;
+    /// Set once the process has been killed for running past its deadline
+    bool killed;
+    /// The status from waitpid, set once the process has been reaped
+    std::optional<int> status;
+    /// Passes output from stdout and stderr on to the streams
+    std::array<Reader, 2> readers;
+};
+
+ProcessPool::ProcessPool(const unsigned & j)
+    : jobs{std::max(j, 1u)}, wake{open_wake()}, epfd{open_epoll(wake)}, queue{}, mutex{},
+      stopping{false}, thread{} {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = wake;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, wake, &ev);
+
+    thread = std::thread{&ProcessPool::loop, this};
+};
+
+ProcessPool::~ProcessPool() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        stopping = true;
+    }
+    uint64_t one = 1;
+    write(wake, &one, sizeof(one));
+    thread.join();
+    close(epfd);
+    close(wake);
+};
+
+void ProcessPool::submit(const std::vector<std::string> & cmd, const Streams & streams,
+                         Callback && done, const std::chrono::milliseconds & timeout) {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        queue.emplace_back(Job{cmd, timeout, streams, std::move(done)});
     }
+    uint64_t one = 1;
+    write(wake, &one, sizeof(one));
+};
+
+void ProcessPool::submit(const std::vector<std::string> & cmd, Callback && done,
+                         const std::chrono::milliseconds & timeout) {
+    submit(cmd, Streams{}, std::move(done), timeout);
+};
+
+std::future<Result> ProcessPool::submit(const std::vector<std::string> & cmd,
+                                        const Streams & streams,
+                                        const std::chrono::milliseconds & timeout) {
+    auto promise = std::make_shared<std::promise<Result>>();
+    auto fut = promise->get_future();
+    submit(
+        cmd, streams, [promise](Result r) { promise->set_value(std::move(r)); }, timeout);
+    return fut;
+};
+
+std::future<Result> ProcessPool::submit(const std::vector<std::string> & cmd,
+                                        const std::chrono::milliseconds & timeout) {
+    return submit(cmd, Streams{}, timeout);
+};
+
+void ProcessPool::loop() {
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+
+    std::list<Running> running{};
+    std::unordered_map<int, std::list<Running>::iterator> by_fd{};
+
+    const auto close_fd = [&](int & fd) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        by_fd.erase(fd);
+        fd = -1;
+    };
+
+    // Never blocks, a process that has closed its output may still be running
+    const auto reap = [&](std::list<Running>::iterator it) {
+        int status = 0;
+        const pid_t reaped = waitpid(it->pid, &status, WNOHANG);
+        if (reaped == 0 || (reaped == -1 && errno == EINTR)) {
+            return;
+        }
+        it->status = status;
+        if (it->pid_fd >= 0) {
+            close_fd(it->pid_fd);
+        }
+    };
+
+    // A process is done once both of its pipes are closed, and it has been reaped
+    const auto finish = [&](std::list<Running>::iterator it) {
+        if (it->out_fd >= 0 || it->err_fd >= 0) {
+            return;
+        }
+        if (!it->status) {
+            reap(it);
+            if (!it->status) {
+                return;
+            }
+        }
+
+        auto done = std::move(it->done);
+        Result result{returncode(*it->status), std::move(it->out), std::move(it->err)};
+        running.erase(it);
+        deliver(done, std::move(result));
+    };
+
+    // Kill the process, and stop reading from it. It is finished once it has
+    // been reaped, which the loop keeps waiting for.
+    const auto stop = [&](std::list<Running>::iterator it) {
+        kill(it->pid, SIGKILL);
+        it->killed = true;
+        for (auto * fd : {&it->out_fd, &it->err_fd}) {
+            if (*fd >= 0) {
+                close_fd(*fd);
+            }
+        }
+        finish(it);
+    };
+
+    std::array<char, 16384> buffer{};
+    std::array<epoll_event, 32> events{};
+
+    while (true) {
+        // Start as much queued work as we're allowed to
+        while (running.size() < jobs) {
+            Job job;
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                if (queue.empty()) {
+                    break;
+                }
+                job = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            pid_t pid;
+            int out_pipes[2];
+            int err_pipes[2];
+            // Nothing can be thrown out of this thread, so a failure is the job's result
+            int error;
+            try {
+                error = spawn(job.cmd, pid, out_pipes, err_pipes);
+            } catch (const Exceptions::MesonException & e) {
+                deliver(job.done, Result{127, "", e.message});
+                continue;
+            }
+            if (error != 0) {
+                deliver(job.done, failed_to_spawn(error));
+                continue;
+            }
 
-    // On Unix-like OSes return codes > 128 are traditionally used for
-    // returning error codes, 128 + n, where n is the code.
-    if (status > 128) {
-        status -= 128;
-        status *= -1;
+            // Built in place, as the readers refer to the streams and output
+            const auto it = running.emplace(running.end(), pid, out_pipes[READ],
+                                            err_pipes[READ], std::move(job));
+            for (const int fd : {it->pid_fd, it->out_fd, it->err_fd}) {
+                if (fd < 0) {
+                    continue;
+                }
+                ev.data.fd = fd;
+                epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+                by_fd.emplace(fd, it);
+            }
+        }
+
+        if (running.empty()) {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (stopping && queue.empty()) {
+                break;
+            }
+        }
+
+        // Sleep until there's output, an exit, new work, or the next deadline.
+        // Without pidfds, poll for processes that have closed their output.
+        int timeout = -1;
+        const auto now = std::chrono::steady_clock::now();
+        for (const auto & r : running) {
+            std::optional<std::chrono::milliseconds> wait{};
+            if (!r.killed) {
+                wait = std::chrono::duration_cast<std::chrono::milliseconds>(r.deadline - now);
+            }
+            if (r.pid_fd < 0 && r.out_fd < 0 && r.err_fd < 0) {
+                wait = std::min(wait.value_or(REAP_INTERVAL), REAP_INTERVAL);
+            }
+            if (wait) {
+                const int ms = std::max<int>(wait->count(), 0);
+                timeout = timeout < 0 ? ms : std::min(timeout, ms);
+            }
+        }
+
+        const int count = epoll_wait(epfd, events.data(), events.size(), timeout);
+        for (int i = 0; i < count; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == wake) {
+                uint64_t value;
+                read(wake, &value, sizeof(value));
+                continue;
+            }
+
+            const auto found = by_fd.find(fd);
+            if (found == by_fd.end()) {
+                // Already closed by an earlier event in this batch
+                continue;
+            }
+            const auto it = found->second;
+            if (fd == it->pid_fd) {
+                reap(it);
+                finish(it);
+                continue;
+            }
+            const bool is_out = fd == it->out_fd;
+            auto & reader = it->readers[is_out ? 0 : 1];
+
+            // A stream callback stops the process by returning false, or throwing
+            const auto n = read(fd, buffer.data(), buffer.size());
+            bool keep_going = false;
+            try {
+                keep_going = n > 0 ? reader.feed({buffer.data(), static_cast<std::size_t>(n)},
+                                                 it->streams)
+                                   : reader.finish();
+            } catch (...) {
+                report_exception();
+            }
+
+            if (!keep_going) {
+                stop(it);
+            } else if (n <= 0) {
+                close_fd(is_out ? it->out_fd : it->err_fd);
+                finish(it);
+            }
+        }
+
+        const auto after = std::chrono::steady_clock::now();
+        for (auto it = running.begin(); it != running.end();) {
+            auto cur = it++;
+            if (!cur->killed && cur->deadline <= after) {
+                stop(cur);
+            } else if (cur->pid_fd < 0) {
+                finish(cur);
+            }
+        }
     }
+};
 
-    return Result{status, out, err};
+ProcessPool & process_pool() {
+    static ProcessPool pool{default_jobs()};
+    return pool;
 };
 
 } // namespace Util
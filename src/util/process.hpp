@@ -7,8 +7,16 @@
 
 #pragma once
 
+#include <chrono>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <tuple>
 #include <vector>
 
@@ -21,6 +29,32 @@ namespace Util {
  */
 typedef std::tuple<int8_t, std::string, std::string> Result;
 
+/**
+ * How to handle the output of a process while it runs
+ */
+class Streams {
+  public:
+    /**
+     * Called with output as it is read
+     *
+     * The view is only valid for the length of the call. Return false to
+     * stop reading, and kill the process.
+     */
+    using Callback = std::function<bool(std::string_view)>;
+
+    /// Called with stdout, if set
+    Callback out;
+
+    /// Called with stderr, if set
+    Callback err;
+
+    /// Call back with each line, without the newline, instead of each chunk read
+    bool lines = true;
+
+    /// The most of each stream to keep in the Result, in bytes
+    std::size_t capture = std::numeric_limits<std::size_t>::max();
+};
+
 /**
  * Run an external process in a thread, and return the output, stdout, and stderr
  *
@@ -29,4 +63,93 @@ typedef std::tuple<int8_t, std::string, std::string> Result;
  */
 Result process(const std::vector<std::string> &);
 
+/**
+ * Run an external process, passing its output to callbacks as it is produced
+ *
+ * A process stopped by a callback is reported with a returncode of -SIGKILL.
+ */
+Result process(const std::vector<std::string> &, const Streams &);
+
+/**
+ * Runs many external processes at once
+ *
+ * Commands are queued, and up to `jobs` of them are run at a time. A single
+ * background thread starts them, and waits on the output of all of them
+ * together, so waiting on a command doesn't take up a thread.
+ *
+ * A command that runs longer than its timeout is killed, and is reported
+ * with a returncode of -SIGKILL, and whatever output it produced.
+ */
+class ProcessPool {
+  public:
+    using Callback = std::function<void(Result)>;
+
+    ProcessPool(const unsigned & jobs);
+    ProcessPool(const ProcessPool &) = delete;
+
+    /// Finishes every command already submitted before returning
+    ~ProcessPool();
+
+    /// Queue a command, and get a future for its result
+    std::future<Result> submit(const std::vector<std::string> & cmd,
+                               const std::chrono::milliseconds & timeout = DEFAULT_TIMEOUT);
+
+    /**
+     * Queue a command, passing its output to the streams as it is produced
+     *
+     * The stream callbacks are called on the pool's thread. One that throws
+     * stops the process, like one returning false, and the exception is
+     * reported.
+     */
+    std::future<Result> submit(const std::vector<std::string> & cmd, const Streams & streams,
+                               const std::chrono::milliseconds & timeout = DEFAULT_TIMEOUT);
+
+    /**
+     * Queue a command, and call `done` with its result
+     *
+     * `done` is called on the pool's thread, so it must not block. It must not
+     * throw either, an exception is reported, and otherwise ignored.
+     */
+    void submit(const std::vector<std::string> & cmd, Callback && done,
+                const std::chrono::milliseconds & timeout = DEFAULT_TIMEOUT);
+
+    /// Queue a command with streams, and call `done` with its result
+    void submit(const std::vector<std::string> & cmd, const Streams & streams, Callback && done,
+                const std::chrono::milliseconds & timeout = DEFAULT_TIMEOUT);
+
+    static constexpr std::chrono::milliseconds DEFAULT_TIMEOUT{5000};
+
+  private:
+    struct Job {
+        std::vector<std::string> cmd;
+        std::chrono::milliseconds timeout;
+        Streams streams;
+        Callback done;
+    };
+
+    struct Running;
+
+    void loop();
+
+    /// How often to check for exited processes when pidfds aren't supported
+    static constexpr std::chrono::milliseconds REAP_INTERVAL{10};
+
+    const unsigned jobs;
+
+    /// An eventfd used to wake up the loop when there is new work
+    const int wake;
+
+    /// The epoll instance used to wait on the wake eventfd, and all pipes
+    const int epfd;
+
+    std::deque<Job> queue;
+    std::mutex mutex;
+    bool stopping;
+
+    std::thread thread;
+};
+
+/// A ProcessPool shared by the whole process, created on first use
+ProcessPool & process_pool();
+
 }; // namespace Util
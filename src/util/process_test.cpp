@@ -0,0 +1,233 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <csignal>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <vector>
+
+#include "exceptions.hpp"
+#include "process.hpp"
+
+namespace {
+
+/**
+ * Use up every file descriptor but `spare`, until destroyed
+ *
+ * The limit is lowered first, so that there are only a few to use up.
+ */
+class FewDescriptors {
+  public:
+    FewDescriptors(const unsigned & spare) : old{}, held{} {
+        getrlimit(RLIMIT_NOFILE, &old);
+        rlimit low = old;
+        low.rlim_cur = 64;
+        setrlimit(RLIMIT_NOFILE, &low);
+        for (int fd; (fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) >= 0;) {
+            held.emplace_back(fd);
+        }
+        for (unsigned i = 0; i < spare; ++i) {
+            close(held.back());
+            held.pop_back();
+        }
+    }
+
+    ~FewDescriptors() {
+        for (const int fd : held) {
+            close(fd);
+        }
+        setrlimit(RLIMIT_NOFILE, &old);
+    }
+
+    /// How many descriptors can be opened
+    unsigned available() const {
+        std::vector<int> opened{};
+        for (int fd; (fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) >= 0;) {
+            opened.emplace_back(fd);
+        }
+        for (const int fd : opened) {
+            close(fd);
+        }
+        return opened.size();
+    }
+
+  private:
+    rlimit old;
+    std::vector<int> held;
+};
+
+} // namespace
+
+TEST(process_pool, output) {
+    Util::ProcessPool pool{2};
+    const auto & [ret, out, err] =
+        pool.submit(std::vector<std::string>{"sh", "-c", "echo out; echo err >&2; exit 3"}).get();
+    ASSERT_EQ(ret, 3);
+    ASSERT_EQ(out, "out\n");
+    ASSERT_EQ(err, "err\n");
+}
+
+TEST(process_pool, callback) {
+    Util::ProcessPool pool{2};
+    std::promise<std::string> p{};
+    pool.submit(std::vector<std::string>{"echo", "foo"},
+                [&](Util::Result r) { p.set_value(std::get<1>(r)); });
+    ASSERT_EQ(p.get_future().get(), "foo\n");
+}
+
+TEST(process_pool, not_found) {
+    Util::ProcessPool pool{2};
+    const auto & [ret, out, err] =
+        pool.submit(std::vector<std::string>{"this-program-does-not-exist"}).get();
+    ASSERT_EQ(ret, 127);
+}
+
+TEST(process_pool, timeout) {
+    Util::ProcessPool pool{2};
+    const auto & [ret, out, err] =
+        pool.submit(std::vector<std::string>{"sleep", "10"}, std::chrono::milliseconds{100}).get();
+    ASSERT_EQ(ret, -SIGKILL);
+}
+
+TEST(process_pool, more_than_jobs) {
+    Util::ProcessPool pool{3};
+    std::vector<std::future<Util::Result>> results{};
+    for (unsigned i = 0; i < 20; ++i) {
+        results.emplace_back(pool.submit(std::vector<std::string>{"echo", std::to_string(i)}));
+    }
+    for (unsigned i = 0; i < 20; ++i) {
+        const auto & [ret, out, err] = results[i].get();
+        ASSERT_EQ(ret, 0);
+        ASSERT_EQ(out, std::to_string(i) + "\n");
+    }
+}
+
+TEST(process_pool, closes_output) {
+    Util::ProcessPool pool{2};
+    const auto start = std::chrono::steady_clock::now();
+    const auto & [ret, out, err] =
+        pool.submit(std::vector<std::string>{"sh", "-c", "exec >&- 2>&-; sleep 10"},
+                    std::chrono::milliseconds{100})
+            .get();
+    ASSERT_EQ(ret, -SIGKILL);
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds{5});
+}
+
+TEST(process_pool, callback_throws) {
+    Util::ProcessPool pool{2};
+    pool.submit(std::vector<std::string>{"true"},
+                [](Util::Result) { throw std::runtime_error{"callback failed"}; });
+    const auto & [ret, out, err] = pool.submit(std::vector<std::string>{"echo", "foo"}).get();
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(out, "foo\n");
+}
+
+TEST(process_pool, streams) {
+    Util::ProcessPool pool{2};
+    std::vector<std::string> lines{};
+    Util::Streams streams{};
+    streams.out = [&](std::string_view l) {
+        lines.emplace_back(l);
+        return true;
+    };
+    const auto & [ret, out, err] =
+        pool.submit(std::vector<std::string>{"printf", "one\\ntwo"}, streams).get();
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(out, "one\ntwo");
+    ASSERT_EQ(lines, (std::vector<std::string>{"one", "two"}));
+}
+
+TEST(process_pool, streams_cancel) {
+    Util::ProcessPool pool{2};
+    Util::Streams streams{};
+    streams.out = [](std::string_view) -> bool { throw std::runtime_error{"stream failed"}; };
+    const auto & [ret, out, err] = pool.submit(std::vector<std::string>{"yes"}, streams).get();
+    ASSERT_EQ(ret, -SIGKILL);
+}
+
+TEST(process_streams, lines) {
+    std::vector<std::string> lines{};
+    Util::Streams streams{};
+    streams.out = [&](std::string_view l) {
+        lines.emplace_back(l);
+        return true;
+    };
+    const auto & [ret, out, err] =
+        Util::process({"printf", "one\\ntwo\\nthree"}, streams);
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(out, "one\ntwo\nthree");
+    ASSERT_EQ(lines, (std::vector<std::string>{"one", "two", "three"}));
+}
+
+TEST(process_streams, chunks) {
+    std::string chunks{};
+    Util::Streams streams{};
+    streams.lines = false;
+    streams.err = [&](std::string_view c) {
+        chunks += c;
+        return true;
+    };
+    const auto & [ret, out, err] = Util::process({"sh", "-c", "echo foo >&2"}, streams);
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(chunks, "foo\n");
+    ASSERT_EQ(err, "foo\n");
+}
+
+TEST(process_streams, cancel) {
+    unsigned count = 0;
+    Util::Streams streams{};
+    streams.out = [&](std::string_view) { return ++count < 10; };
+    const auto & [ret, out, err] = Util::process({"yes"}, streams);
+    ASSERT_EQ(ret, -SIGKILL);
+    ASSERT_EQ(count, 10);
+}
+
+TEST(process_streams, capture) {
+    std::size_t seen = 0;
+    Util::Streams streams{};
+    streams.capture = 4;
+    streams.out = [&](std::string_view l) {
+        seen += l.size() + 1;
+        return true;
+    };
+    const auto & [ret, out, err] =
+        Util::process({"sh", "-c", "for i in 1 2 3 4 5 6 7 8; do echo $i; done"}, streams);
+    ASSERT_EQ(ret, 0);
+    ASSERT_EQ(out, "1\n2\n");
+    ASSERT_EQ(seen, 16);
+}
+
+TEST(process_streams, callback_throws) {
+    Util::Streams streams{};
+    streams.out = [](std::string_view) -> bool { throw std::runtime_error{"stream failed"}; };
+    ASSERT_THROW(Util::process({"yes"}, streams), std::runtime_error);
+    // The child has been reaped, and there are no others
+    ASSERT_EQ(waitpid(-1, nullptr, WNOHANG), -1);
+}
+
+TEST(process, pipes_closed_on_failure) {
+    // Only stdout gets a pipe, so it has to be closed again
+    FewDescriptors few{3};
+    try {
+        (void)Util::process({"true"});
+        FAIL();
+    } catch (Util::Exceptions::MesonException & e) {
+        ASSERT_EQ(e.message.rfind("Could not create a pipe for true: ", 0), 0);
+    }
+    ASSERT_EQ(few.available(), 3);
+}
+
+TEST(process_pool, fds_closed_on_failure) {
+    // The eventfd is created, but epoll can't be
+    FewDescriptors few{1};
+    try {
+        Util::ProcessPool pool{1};
+        FAIL();
+    } catch (Util::Exceptions::MesonException & e) {
+        ASSERT_EQ(e.message.rfind("Could not create an epoll instance", 0), 0);
+    }
+    ASSERT_EQ(few.available(), 1);
+}
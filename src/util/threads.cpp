@@ -0,0 +1,111 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+#include <algorithm>
+#include <unistd.h>
+
+#include "threads.hpp"
+
+namespace Util {
+
+namespace {
+
+thread_local bool is_worker = false;
+
+} // namespace
+
+ThreadPool::ThreadPool(const unsigned & workers) : threads{}, queue{}, stopping{false} {
+    for (unsigned i = 0; i < workers; ++i) {
+        threads.emplace_back([this]() { work(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        stopping = true;
+    }
+    cond.notify_all();
+    for (auto & t : threads) {
+        t.join();
+    }
+}
+
+unsigned ThreadPool::size() const { return threads.size(); }
+
+bool ThreadPool::in_worker() { return is_worker; }
+
+void ThreadPool::work() {
+    is_worker = true;
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock{mutex};
+            cond.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        task();
+    }
+}
+
+unsigned default_jobs() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+uint64_t physical_memory() {
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || size <= 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(pages) * static_cast<uint64_t>(size);
+}
+
+ThreadPool & global_pool() {
+    static ThreadPool pool{default_jobs()};
+    return pool;
+}
+
+void parallel_for(const std::size_t & count, const std::size_t & grain,
+                  const std::function<void(std::size_t, std::size_t)> & func) {
+    const std::size_t chunks = std::min<std::size_t>(
+        std::max<std::size_t>(count / std::max<std::size_t>(grain, 1), 1), default_jobs());
+
+    if (chunks == 1 || ThreadPool::in_worker()) {
+        func(0, count);
+        return;
+    }
+
+    auto & pool = global_pool();
+    const std::size_t step = (count + chunks - 1) / chunks;
+
+    // The calling thread takes the first chunk itself rather than sitting idle
+    std::vector<std::future<void>> futures{};
+    for (std::size_t begin = step; begin < count; begin += step) {
+        const std::size_t end = std::min(begin + step, count);
+        futures.emplace_back(pool.submit([&func, begin, end]() { func(begin, end); }));
+    }
+
+    std::exception_ptr error = nullptr;
+    try {
+        func(0, std::min(step, count));
+    } catch (...) {
+        error = std::current_exception();
+    }
+    for (auto & f : futures) {
+        try {
+            f.get();
+        } catch (...) {
+            if (error == nullptr) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error != nullptr) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace Util
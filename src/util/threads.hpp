@@ -0,0 +1,87 @@
+// SPDX-license-identifier: Apache-2.0
+// Copyright © 2021 Intel Corporation
+
+/**
+ * Helpers for running work on multiple threads
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Util {
+
+/**
+ * A fixed size pool of worker threads
+ *
+ * Tasks are run in the order they are submitted, but may complete in any
+ * order. Any ordering of the results is the job of the caller, usually by
+ * waiting on the returned futures in order.
+ */
+class ThreadPool {
+  public:
+    ThreadPool(const unsigned & workers);
+    ThreadPool(const ThreadPool &) = delete;
+    ~ThreadPool();
+
+    /// Queue a callable, and get a future for its result
+    template <typename Func> auto submit(Func && func) -> std::future<decltype(func())> {
+        using Ret = decltype(func());
+        auto task = std::make_shared<std::packaged_task<Ret()>>(std::forward<Func>(func));
+        auto fut = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            queue.emplace_back([task]() { (*task)(); });
+        }
+        cond.notify_one();
+        return fut;
+    }
+
+    /// The number of worker threads in the pool
+    unsigned size() const;
+
+    /// Is the calling thread one of this process' pool workers?
+    static bool in_worker();
+
+  private:
+    void work();
+
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> queue;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool stopping;
+};
+
+/// The number of jobs to run at once, based on the number of cores available
+unsigned default_jobs();
+
+/// The amount of physical memory, in bytes, or 0 if it can't be found
+uint64_t physical_memory();
+
+/// A pool shared by the whole process, created on first use
+ThreadPool & global_pool();
+
+/**
+ * Call `func(begin, end)` over contiguous chunks of [0, count) in parallel
+ *
+ * Chunks are at least `grain` long, so small inputs are run on the calling
+ * thread without touching the pool at all. Calls made from inside the pool are
+ * also run serially, as waiting on the pool from a worker could deadlock.
+ *
+ * If any chunk throws, the exception from the earliest chunk is rethrown after
+ * all chunks have finished, so the error reported matches a serial loop.
+ */
+void parallel_for(const std::size_t & count, const std::size_t & grain,
+                  const std::function<void(std::size_t, std::size_t)> & func);
+
+} // namespace Util